@@ -11,6 +11,7 @@
 struct arch_ops;
 struct arch_serial_ops;
 struct arch_memory_ops;
+struct arch_timer_ops;
 
 typedef enum { ARCH_AARCH64, ARCH_LOONGARCH64, ARCH_RISCV64, ARCH_UNKNOWN } arch_type_t;
 
@@ -18,12 +19,30 @@ struct arch_serial_ops {
   void (*init)(void);
   void (*put_char)(char c);
   void (*get_char)(char *c);
+  // bytes the TX FIFO takes right now, NULL when there's no FIFO to poll
+  UINTN (*tx_room)(void);
+  // write n bytes, at most what tx_room() reported, without waiting
+  void (*tx_burst)(const char *buf, UINTN n);
 };
 
 struct arch_memory_ops {
   void (*init)(void);
   void (*setup_direct_mapping)(void);
   void (*clear_memory_regions)(void);
+  // bulk copy kernel, moves nblocks * ARCH_COPY_BLOCK_SIZE bytes
+  void (*copy_blocks)(void *dest, const void *src, UINTN nblocks);
+  // zero-fill kernel, clears nblocks * zero_block_size bytes starting at a
+  // zero_block_size aligned dest
+  void (*zero_blocks)(void *dest, UINTN nblocks);
+  UINTN zero_block_size;
+  // make size bytes written at addr visible to whatever runs there next:
+  // data caches written back, stale instructions dropped
+  void (*sync_range)(void *addr, UINTN size);
+};
+
+struct arch_timer_ops {
+  UINT64 (*read_counter)(void);
+  UINT64 (*get_frequency)(void);
 };
 
 // Architecture operations structure
@@ -38,6 +57,7 @@ struct arch_ops {
 
   struct arch_serial_ops serial;
   struct arch_memory_ops memory;
+  struct arch_timer_ops timer;
 
   void *arch_data;
 };
@@ -46,6 +66,10 @@ extern struct arch_ops *arch_ops;
 
 void arch_detect_and_init(void);
 
+// granularity of arch_memory_ops.copy_blocks, all SIMD kernels move 64 bytes
+// per iteration
+#define ARCH_COPY_BLOCK_SIZE 64
+
 #define ARCH_TYPE() (arch_ops->type)
 #define ARCH_NAME() (arch_ops->name)
 
@@ -58,10 +82,19 @@ void arch_detect_and_init(void);
 #define ARCH_SERIAL_INIT() arch_ops->serial.init()
 #define ARCH_PUT_CHAR(c) arch_ops->serial.put_char(c)
 #define ARCH_GET_CHAR(c) arch_ops->serial.get_char(c)
+#define ARCH_TX_ROOM() arch_ops->serial.tx_room()
+#define ARCH_TX_BURST(b, n) arch_ops->serial.tx_burst(b, n)
 
 #define ARCH_MEMORY_INIT() arch_ops->memory.init()
 #define ARCH_SETUP_DIRECT_MAPPING() arch_ops->memory.setup_direct_mapping()
 #define ARCH_CLEAR_MEMORY_REGIONS() arch_ops->memory.clear_memory_regions()
+#define ARCH_COPY_BLOCKS(d, s, n) arch_ops->memory.copy_blocks(d, s, n)
+#define ARCH_ZERO_BLOCKS(d, n) arch_ops->memory.zero_blocks(d, n)
+#define ARCH_ZERO_BLOCK_SIZE() (arch_ops->memory.zero_block_size)
+#define ARCH_SYNC_RANGE(a, n) arch_ops->memory.sync_range(a, n)
+
+#define ARCH_READ_COUNTER() arch_ops->timer.read_counter()
+#define ARCH_COUNTER_FREQ() arch_ops->timer.get_frequency()
 
 #define ARCH_IS_AARCH64() (ARCH_TYPE() == ARCH_AARCH64)
 #define ARCH_IS_LOONGARCH64() (ARCH_TYPE() == ARCH_LOONGARCH64)
@@ -69,4 +102,12 @@ void arch_detect_and_init(void);
 
 static inline int arch_has_direct_mapping(void) {
   return ARCH_IS_LOONGARCH64();
+}
+
+// loongarch addresses go through a DMW window picked by the top bits
+#define ARCH_DMW_MASK 0xf000000000000000ULL
+
+// physical address behind an address the loader writes to
+static inline UINTN arch_phys_addr(UINTN addr) {
+  return arch_has_direct_mapping() ? addr & ~ARCH_DMW_MASK : addr;
 }
\ No newline at end of file
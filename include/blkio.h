@@ -0,0 +1,64 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Requests kept in flight and the size of each, together they are how far
+// the reader may run ahead of the consumer.
+#define BLKIO_QUEUE_DEPTH 8
+#define BLKIO_CHUNK (4UL << 20)
+
+struct blkio_segment {
+  EFI_LBA lba;
+  UINT8 *dest;
+  UINTN size; // multiple of the block size
+};
+
+struct blkio_request {
+  EFI_BLOCK_IO2_TOKEN token;
+  UINTN end; // stream position once this request is done
+};
+
+// Reads a list of segments as one ordered stream. With BlockIo2 up to
+// BLKIO_QUEUE_DEPTH requests run in the background while the caller works
+// on data that has already arrived, otherwise every request is synchronous.
+struct blkio_reader {
+  EFI_BLOCK_IO *bio;
+  EFI_BLOCK_IO2_PROTOCOL *bio2; // NULL: synchronous fallback
+  UINT32 media_id;
+  UINT32 block_size;
+  UINT32 io_align;
+
+  struct blkio_segment *segments;
+  UINTN nr_segments, max_segments;
+  UINTN total; // stream bytes over all segments
+
+  UINTN cur_segment, cur_offset; // next byte to submit
+  UINTN submitted;               // stream position submitted
+  UINTN done;                    // stream position completed, in order
+  struct blkio_request requests[BLKIO_QUEUE_DEPTH];
+  UINTN head, inflight;
+  EFI_STATUS status;
+};
+
+EFI_STATUS blkio_init(struct blkio_reader *r, EFI_HANDLE handle,
+                      UINTN max_segments);
+void blkio_close(struct blkio_reader *r);
+
+// Queue size bytes at lba for dest, returns the stream position at which
+// they are complete. size is rounded up to whole blocks.
+UINTN blkio_add(struct blkio_reader *r, EFI_LBA lba, void *dest, UINTN size);
+
+// Keep the queue full and return once the stream is complete up to pos.
+EFI_STATUS blkio_wait(struct blkio_reader *r, UINTN pos);
+
+// Reap finished requests and refill the queue without blocking.
+UINTN blkio_poll(struct blkio_reader *r);
+
+// One-shot synchronous read, size is rounded up to whole blocks.
+EFI_STATUS blkio_read(EFI_HANDLE handle, EFI_LBA lba, void *dest, UINTN size);
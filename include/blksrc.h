@@ -0,0 +1,42 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "container.h"
+
+// Payload container read from raw blocks instead of the loader image. The
+// header and toc are read up front; blobs are streamed in by blksrc_load()
+// and decoded as they arrive.
+struct blksrc {
+  EFI_HANDLE handle;
+  EFI_LBA lba; // first block of the container
+  UINT32 block_size;
+  struct container_header *container; // image_size buffer, toc first
+  UINTN pages;
+};
+
+// GPT partition type of the raw payload partition, see
+// scripts/mkpayloadpart.py.
+#define BLKSRC_PARTITION_TYPE_GUID                                             \
+  {0x6d851684, 0xbbb0, 0x4c41, {0x93, 0x72, 0x17, 0x53, 0x0b, 0x2d, 0x01, 0x07}}
+
+// The whole disk the loader was started from.
+EFI_STATUS blksrc_boot_disk(EFI_HANDLE image, EFI_HANDLE *disk);
+
+// The first partition of type BLKSRC_PARTITION_TYPE_GUID on disk. Returns
+// the partition's own handle and lba 0 if the firmware exposes one, else
+// the disk and the partition's first block.
+EFI_STATUS blksrc_find_partition(EFI_HANDLE disk, EFI_HANDLE *handle,
+                                 EFI_LBA *lba);
+
+// Read and check the header and toc of the container at lba on handle.
+EFI_STATUS blksrc_open(struct blksrc *s, EFI_HANDLE handle, EFI_LBA lba);
+
+// Read every entry and load it, overlapping the reads with decoding.
+EFI_STATUS blksrc_load(struct blksrc *s);
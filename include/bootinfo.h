@@ -0,0 +1,119 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Boot-info block handed to hvisor in the second argument when
+// CONFIG_BOOT_INFO is set: a header followed by type-length-value records,
+// each starting 8 byte aligned, up to a BOOT_INFO_END record. Readers skip
+// records of unknown type by their length, so new types don't need a
+// version bump. All little endian.
+#define BOOT_INFO_MAGIC 0x4f464e49544f4f42ULL // "BOOTINFO"
+#define BOOT_INFO_VERSION 1
+
+struct boot_info_header {
+  UINT64 magic;
+  UINT32 version;
+  UINT32 size; // header and records, up to and including BOOT_INFO_END
+};
+
+struct boot_info_record {
+  UINT32 type;
+  UINT32 length; // of the data behind this header, without padding
+};
+
+enum boot_info_type {
+  BOOT_INFO_END = 0,
+  BOOT_INFO_MEMORY_MAP = 1,   // struct boot_info_memory_map
+  BOOT_INFO_ACPI_RSDP = 2,    // UINT64 physical address
+  BOOT_INFO_DTB = 3,          // UINT64 physical address
+  BOOT_INFO_BOOT_CPU = 4,     // UINT64, as passed in the first argument
+  BOOT_INFO_COUNTER_FREQ = 5, // UINT64 architectural counter ticks per second
+  BOOT_INFO_PAYLOAD = 6,      // struct boot_info_payload, one per payload
+  BOOT_INFO_BOOT_TIME = 7,    // struct boot_time_table, see boottime.h
+  BOOT_INFO_LOG = 8,          // loader console output, oldest byte first
+  BOOT_INFO_REGIONS = 9,      // struct boot_info_region[], see memregion.h
+  BOOT_INFO_PAGE_TABLES = 10, // struct boot_info_page_tables, see pgtable.h
+};
+
+// The map ExitBootServices() was called with.
+struct boot_info_memory_map {
+  UINT32 desc_size;
+  UINT32 desc_version;
+  // EFI_MEMORY_DESCRIPTOR, desc_size bytes apart
+};
+
+// Physical memory after the loader is done, sorted by base and without
+// overlaps. Neighbours of the same type are merged, usable ranges are then
+// cut at 2 MB and 1 GB boundaries so every piece maps with one block size.
+enum boot_info_region_type {
+  BOOT_INFO_REGION_USABLE = 1,   // free once hvisor runs, loader memory too
+  BOOT_INFO_REGION_RESERVED = 2, // reserved, unusable, persistent, ...
+  BOOT_INFO_REGION_RUNTIME = 3,  // UEFI runtime services code and data
+  BOOT_INFO_REGION_ACPI = 4,     // ACPI tables, reclaimable
+  BOOT_INFO_REGION_ACPI_NVS = 5,
+  BOOT_INFO_REGION_MMIO = 6,    // MMIO the firmware put in the map
+  BOOT_INFO_REGION_PAYLOAD = 7, // placed by the loader, see BOOT_INFO_PAYLOAD
+  BOOT_INFO_REGION_HANDOFF = 8, // boot-info block, boot time table, ...
+};
+
+struct boot_info_region {
+  UINT64 base;
+  UINT64 size;
+  UINT32 type;
+  UINT32 reserved;
+};
+
+enum boot_info_pgtable_format {
+  BOOT_INFO_PGTABLE_AARCH64_4K = 1, // VMSAv8-64, 4 KB granule, 48 bit
+  BOOT_INFO_PGTABLE_RISCV_SV39 = 2, // Sv39 and Sv39x4
+  BOOT_INFO_PGTABLE_RISCV_SV48 = 3, // Sv48 and Sv48x4
+  BOOT_INFO_PGTABLE_LOONGARCH_4K = 4,
+};
+
+// Identity maps built from the region table. hvisor's stage-1 covers
+// everything but reserved memory, zone0's stage-2 leaves out hvisor, its
+// payloads and the handoff data. Memory below the lowest RAM is mapped as
+// device memory in both. Attributes are listed in main/pgtable.c.
+struct boot_info_page_tables {
+  UINT32 format; // enum boot_info_pgtable_format
+  UINT32 levels;
+  UINT64 stage1_root; // 0: none, loongarch runs hvisor from the DMW
+  UINT64 stage2_root;
+  UINT64 pool; // every table lives in here, carved as handoff memory
+  UINT64 pool_size;
+};
+
+struct boot_info_payload {
+  UINT32 kind; // enum container_kind
+  UINT32 zone_id;
+  UINT64 addr;
+  UINT64 size;      // loaded bytes
+  UINT64 zero_size; // cleared bytes right behind them
+  UINT64 entry;     // 0: not executable
+  UINT8 sha256[32]; // all zero when unknown
+  char name[32];
+};
+
+#define BOOT_INFO_MAX_PAYLOADS 16
+
+#if defined(CONFIG_BOOT_INFO)
+// Remember a placed payload, up to BOOT_INFO_MAX_PAYLOADS.
+void boot_info_add_payload(const struct boot_info_payload *p);
+
+// Reserve the block and take what needs boot services: the configuration
+// table pointers and the counter frequency. Fails if the block can't be
+// claimed.
+EFI_STATUS boot_info_prepare(EFI_SYSTEM_TABLE *SystemTable,
+                             UINTN boot_cpu_id);
+
+// Write the block after ExitBootServices(), returns its address.
+UINTN boot_info_finish(void);
+#else
+static inline void boot_info_add_payload(const struct boot_info_payload *p) {}
+#endif
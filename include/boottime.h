@@ -0,0 +1,47 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Boot phase timestamps. Every mark records the architectural counter at
+// the end of the phase it names, the first one (taken as soon as arch_ops
+// is set) measures from the counter's reset, i.e. mostly firmware. The
+// table is copied to CONFIG_BOOT_TIME_ADDR right before the jump so hvisor
+// can report it, layout below, all little endian.
+#define BOOT_TIME_MAGIC 0x454d4954544f4f42ULL // "BOOTTIME"
+#define BOOT_TIME_VERSION 1
+#define BOOT_TIME_MAX_MARKS 32
+#define BOOT_TIME_NAME_LEN 32
+
+struct boot_time_mark {
+  char name[BOOT_TIME_NAME_LEN]; // NUL terminated
+  UINT64 counter;
+};
+
+struct boot_time_table {
+  UINT64 magic;
+  UINT32 version;
+  UINT32 nr_marks;
+  UINT64 frequency; // counter ticks per second
+  struct boot_time_mark marks[BOOT_TIME_MAX_MARKS];
+};
+
+// Record the end of phase name, marks beyond BOOT_TIME_MAX_MARKS are
+// dropped. Cheap enough for any point before the jump.
+void boot_time_mark(const char *name);
+
+// Take the counter frequency and reserve CONFIG_BOOT_TIME_ADDR, both need
+// boot services. Fails if the table's page can't be claimed.
+EFI_STATUS boot_time_prepare(void);
+
+// The marks so far, for the boot-info block.
+const struct boot_time_table *boot_time_table(void);
+
+// Print the per phase table and copy it to CONFIG_BOOT_TIME_ADDR, only
+// uses print_str() so it works after ExitBootServices().
+void boot_time_report(void);
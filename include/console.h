@@ -0,0 +1,52 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Raw UART console behind print_str(). Output is queued in a ring of
+// CONFIG_CONSOLE_RING_SIZE bytes and sent in bursts of whatever the TX FIFO
+// takes, so the boot cpu only waits on the UART once the ring is full.
+// Arches without arch_serial_ops.tx_room write every character directly.
+
+void console_write(const char *s, UINTN n);
+
+// Send what the TX FIFO takes right now, never waits. Called while the
+// loader waits on block reads, see blkio_reap().
+void console_poll(void);
+
+// Send everything still queued, waiting for the FIFO as needed. Called
+// before ExitBootServices() and before jumping to hvisor.
+void console_flush(void);
+
+// Copy the newest loader output kept for the boot-info block to dest,
+// oldest byte first, returns how many bytes. Nothing is kept unless
+// CONFIG_BOOT_INFO_LOG_SIZE is set.
+UINTN console_history(char *dest, UINTN size);
+
+#if defined(CONFIG_CONSOLE_QUIET) ||                                          \
+    (CONFIG_BOOT_INFO_LOG_SIZE > 0 && !defined(CONFIG_CONSOLE_TOKENIZED))
+// Only [ERROR] lines reach the firmware console under CONSOLE_QUIET, and
+// all of them are kept for the boot-info log, see console_print().
+UINTN console_print(const CHAR16 *fmt, ...);
+#define Print(...) console_print(__VA_ARGS__)
+#elif defined(CONFIG_CONSOLE_TOKENIZED)
+// Tokenized logging: every Print() format string goes to the .log_fmt
+// section, which main/log_fmt.lds places behind .data in the image. The
+// UART only gets a record of the string's offset in that section plus the
+// raw arguments, scripts/detokenize.py turns captured output back into text
+// with the section dumped by make_image.
+#define CONSOLE_RECORD 0x1e // ASCII RS, starts a record
+
+UINTN console_log(const CHAR16 *fmt, ...);
+#define Print(fmt, ...)                                                        \
+  ({                                                                           \
+    static const CHAR16 __log_fmt[]                                            \
+        __attribute__((section(".log_fmt"), used)) = fmt;                      \
+    console_log(__log_fmt, ##__VA_ARGS__);                                     \
+  })
+#endif
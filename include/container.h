@@ -0,0 +1,119 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Payload container built by scripts/mkcontainer.py and embedded by
+// main/data.S. A header and a table of contents are followed by the
+// payload blobs, each starting on a CONTAINER_BLOB_ALIGN boundary.
+//
+// Every loaded entry is a precomputed load plan: copy or decode the blob to
+// load_addr, zero zero_size bytes behind it and start at entry. ELF and PE
+// images are flattened into that form by scripts/mkloadplan.py at build
+// time, so the loader never parses their headers.
+#define CONTAINER_MAGIC 0x4b505648 // "HVPK"
+#define CONTAINER_VERSION 2
+#define CONTAINER_BLOB_ALIGN 4096
+
+enum container_kind {
+  CONTAINER_KIND_HVISOR = 1,
+  CONTAINER_KIND_ZONE0_KERNEL = 2,
+  CONTAINER_KIND_ZONE0_INITRD = 3,
+  CONTAINER_KIND_ZONE0_DTB = 4,
+  CONTAINER_KIND_ZONE_KERNEL = 5, // nonroot zones, zone_id from zones.json
+};
+
+enum container_flags {
+  // load_addr is a preference, the loader may move the entry when the
+  // firmware holds that memory
+  CONTAINER_FLAG_RELOCATABLE = 1 << 0,
+};
+
+enum container_codec {
+  CONTAINER_CODEC_NONE = 0,
+  CONTAINER_CODEC_LZ4 = 1,
+  CONTAINER_CODEC_ZSTD = 2,
+  CONTAINER_CODEC_ZBOOT = 3, // Linux EFI zboot image, stored as built
+};
+
+struct container_header {
+  UINT32 magic;
+  UINT16 version;
+  UINT16 entry_size; // sizeof(struct container_entry) of the packer
+  UINT32 header_size;
+  UINT32 nr_entries;
+  UINT64 image_size; // header, toc and blobs
+};
+
+struct container_entry {
+  UINT32 kind;
+  UINT32 codec;
+  UINT32 zone_id;
+  UINT32 flags;       // enum container_flags
+  UINT64 offset;      // from the start of the container
+  UINT64 stored_size; // bytes in the container
+  UINT64 size;        // bytes once decoded
+  UINT64 load_addr;   // 0: consumed in place
+  UINT64 align;       // required alignment of load_addr
+  UINT8 sha256[32];   // of the decoded bytes
+  char name[32];
+  UINT64 zero_size; // bytes cleared right behind the loaded ones (bss)
+  UINT64 entry;     // entry point, 0: none or the start of the image
+};
+
+// Embedded container, laid down by main/data.S
+extern UINT8 container_start[];
+extern UINT8 container_end[];
+
+// Validate the header and every toc entry against the container bounds.
+EFI_STATUS container_check(const struct container_header *hdr, UINTN size);
+
+const struct container_entry *
+container_entry(const struct container_header *hdr, UINT32 index);
+
+// First entry of the given kind and zone, NULL if there is none.
+const struct container_entry *
+container_find(const struct container_header *hdr, UINT32 kind,
+               UINT32 zone_id);
+
+// Where the entry's bytes live once loaded: load_addr, or the blob itself
+// for entries that are consumed in place.
+void *container_entry_addr(const struct container_header *hdr,
+                           const struct container_entry *e);
+
+// With PAYLOAD_PLACEMENT, lay out every relocatable entry in the free
+// memory of the current map around the fixed ones, see place_payloads().
+// Their load_addr and entry are updated, nothing is claimed yet.
+EFI_STATUS container_place(const struct container_header *hdr);
+
+// With PAYLOAD_PLACEMENT, point linux,initrd-start/end under /chosen of the
+// loaded zone0 device tree at wherever the zone0 initrd ended up. A tree
+// without them is left alone.
+EFI_STATUS container_fixup_dtb(const struct container_header *hdr);
+
+// Claim the entry's load range from the firmware, a relocatable entry may
+// be moved, load_addr and entry follow it.
+EFI_STATUS container_reserve(const struct container_entry *e);
+
+// Decode or copy one entry to its load address, returns how many cpus did
+// the work in cpus.
+EFI_STATUS container_load(const struct container_header *hdr,
+                          const struct container_entry *e, UINTN *cpus);
+
+// Clear the zero_size bytes behind a loaded entry.
+void container_zero(const struct container_entry *e);
+
+// Where execution starts in an executable entry.
+UINTN container_entry_point(const struct container_entry *e);
+
+// Check a loaded entry against its sha256 when CONTAINER_VERIFY_SHA256 is set.
+EFI_STATUS container_verify(const struct container_header *hdr,
+                            const struct container_entry *e);
+
+const char *container_kind_name(UINT32 kind);
+const char *container_codec_name(UINT32 codec);
@@ -8,13 +8,10 @@
 #include <efi.h>
 #include <efilib.h>
 
-extern void hvisor_bin_start();
-extern void hvisor_bin_end();
+#include "console.h"
 
-#if defined(CONFIG_ENABLE_VMLINUX)
-extern void hvisor_zone0_vmlinux_start();
-extern void hvisor_zone0_vmlinux_end();
-#endif
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((UINTN)(a) - 1))
+#define ALIGN_DOWN(x, a) ((x) & ~((UINTN)(a) - 1))
 
 void print_str(const char *str);
 void print_hex(UINT8 n);
@@ -22,13 +19,31 @@ void print_chars(char *c, int n);
 
 char *get_efi_status_string(EFI_STATUS status);
 const char *get_arch();
+UINT64 counter_to_us(UINT64 ticks);
+UINT64 throughput_mbps(UINTN bytes, UINT64 ticks);
 
-void memcpy2(void *dest, void *src, int n);
-void memset2(void *dest, int val, int n);
+void memcpy2(void *dest, const void *src, UINTN n);
+void memset2(void *dest, int val, UINTN n);
+void memzero(void *dest, UINTN n);
 
 void halt();
 void check(EFI_STATUS status, const char *prefix, EFI_STATUS expected,
            EFI_SYSTEM_TABLE *SystemTable);
 
+// Memory type of payload destinations, from the range UEFI leaves to OS
+// loaders, so they stand out in the map handed to hvisor.
+#define EFI_HVISOR_PAYLOAD ((EFI_MEMORY_TYPE)0x80000000)
+
+// Claim size bytes at *addr for name with AllocatePages(AllocateAddress).
+// A range the memory map doesn't describe is used as it is. If something
+// else holds the range, the descriptors in the way are printed and, for a
+// relocatable payload (align != 0), *addr moves to the free align aligned
+// range nearest to it. *addr may be a DMW address on loongarch.
+EFI_STATUS reserve_payload(const char *name, UINTN *addr, UINTN size,
+                           UINTN align);
+
 EFI_STATUS exit_boot_services(EFI_HANDLE ImageHandle,
-                              EFI_SYSTEM_TABLE *SystemTable);
\ No newline at end of file
+                              EFI_SYSTEM_TABLE *SystemTable);
+// The memory map ExitBootServices() was called with, NULL before that.
+EFI_MEMORY_DESCRIPTOR *boot_memory_map(UINTN *size, UINTN *desc_size,
+                                       UINT32 *desc_version);
\ No newline at end of file
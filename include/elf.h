@@ -0,0 +1,47 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+
+// The part of the ELF64 format needed to load an executable.
+
+#define ELFMAG "\177ELF"
+#define SELFMAG 4
+#define EI_CLASS 4
+#define EI_DATA 5
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define PT_LOAD 1
+
+typedef struct {
+  UINT8 e_ident[16];
+  UINT16 e_type;
+  UINT16 e_machine;
+  UINT32 e_version;
+  UINT64 e_entry;
+  UINT64 e_phoff;
+  UINT64 e_shoff;
+  UINT32 e_flags;
+  UINT16 e_ehsize;
+  UINT16 e_phentsize;
+  UINT16 e_phnum;
+  UINT16 e_shentsize;
+  UINT16 e_shnum;
+  UINT16 e_shstrndx;
+} Elf64_Ehdr;
+
+typedef struct {
+  UINT32 p_type;
+  UINT32 p_flags;
+  UINT64 p_offset;
+  UINT64 p_vaddr;
+  UINT64 p_paddr;
+  UINT64 p_filesz;
+  UINT64 p_memsz;
+  UINT64 p_align;
+} Elf64_Phdr;
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Payloads are read with requests of this size, straight into their load
+// address.
+#define ESP_READ_CHUNK (16UL << 20)
+
+// Open the directory the loader itself was started from.
+EFI_STATUS esp_open_dir(EFI_HANDLE image, EFI_FILE_HANDLE *dir);
+
+// Read a whole file from dir to load_addr, reserving the pages first. EFI
+// zboot kernels are decoded there instead, *size is then the Image size.
+EFI_STATUS esp_load_file(EFI_FILE_HANDLE dir, const char *name,
+                         UINTN load_addr, UINTN *size);
+
+// Read a whole file from dir into a pool buffer, FreePool() it when done.
+EFI_STATUS esp_read_file(EFI_FILE_HANDLE dir, const char *name, void **buf,
+                         UINTN *size);
@@ -0,0 +1,16 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Point the linux,initrd-start and linux,initrd-end properties under
+// /chosen of the flattened device tree at fdt (size bytes) to [start, end).
+// Both have to be there already, the tree is patched in place and never
+// grows. EFI_NOT_FOUND if either is missing, EFI_UNSUPPORTED if a 32 bit
+// cell can't hold the address.
+EFI_STATUS fdt_set_initrd(void *fdt, UINTN size, UINT64 start, UINT64 end);
@@ -0,0 +1,17 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Decoded size from the ISIZE trailer of a gzip member, modulo 4 GB.
+UINTN gzip_content_size(const void *src, UINTN src_size);
+
+// Decode one gzip member (RFC 1952, deflate after RFC 1951) straight into
+// dest. The CRC32 in the trailer is not checked.
+EFI_STATUS gzip_decompress(void *dest, UINTN dest_size, const void *src,
+                           UINTN src_size, UINTN *out_size);
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+
+// Boot headers at the start of a Linux Image, see
+// Documentation/arch/arm64/booting.rst,
+// Documentation/arch/riscv/boot-image-header.rst and
+// arch/loongarch/kernel/head.S. The magic sits at 0x38 in all three.
+
+#define LINUX_ARM64_MAGIC 0x644d5241     // "ARM\x64"
+#define LINUX_RISCV_MAGIC 0x05435352     // "RSC\x05"
+#define LINUX_LOONGARCH_MAGIC 0x818223cd // LINUX_PE_MAGIC
+#define LINUX_IMAGE_ALIGN 0x200000
+
+struct linux_arm64_header {
+  UINT32 code0;
+  UINT32 code1;
+  UINT64 text_offset; // from the 2 MB aligned base
+  UINT64 image_size;  // effective size including bss, 0 on old kernels
+  UINT64 flags;
+  UINT64 res2;
+  UINT64 res3;
+  UINT64 res4;
+  UINT32 magic;
+  UINT32 res5;
+};
+
+struct linux_riscv_header {
+  UINT32 code0;
+  UINT32 code1;
+  UINT64 text_offset; // from the start of RAM
+  UINT64 image_size;
+  UINT64 flags;
+  UINT32 version;
+  UINT32 res1;
+  UINT64 res2;
+  UINT64 magic; // "RISCV\0\0\0", deprecated
+  UINT32 magic2;
+  UINT32 res3;
+};
+
+struct linux_loongarch_header {
+  UINT16 mz_magic;
+  UINT8 res0[6];
+  UINT64 kernel_entry; // physical
+  UINT64 image_size;
+  UINT64 load_offset; // physical link address
+  UINT64 res1;
+  UINT64 res2;
+  UINT64 res3;
+  UINT32 magic;
+  UINT32 pe_header;
+};
@@ -0,0 +1,20 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#define LZ4_FRAME_MAGIC 0x184D2204
+
+// Content size recorded in the frame header (lz4 --content-size), 0 when the
+// frame doesn't carry one.
+UINTN lz4_frame_content_size(const void *src, UINTN src_size);
+
+// Decode a whole lz4 frame straight into dest. Blocks may depend on each
+// other since the output stays in place.
+EFI_STATUS lz4_decompress_frame(void *dest, UINTN dest_size, const void *src,
+                                UINTN src_size, UINTN *out_size);
@@ -0,0 +1,22 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "bootinfo.h"
+
+// Turn a UEFI memory map into at most max boot_info_regions in out: sorted,
+// merged, with the carve ranges (payloads, handoff data) cut out of the
+// usable memory they sit in, handoff data also out of the payload pages
+// reserve_payload() claimed for it, and usable ranges split at 2 MB and 1 GB
+// boundaries. Returns the number of regions, 0 if they don't fit. Doesn't
+// allocate, so it works after ExitBootServices().
+UINTN mem_regions_build(struct boot_info_region *out, UINTN max,
+                        const EFI_MEMORY_DESCRIPTOR *map, UINTN map_size,
+                        UINTN desc_size, const struct boot_info_region *carve,
+                        UINTN nr_carve);
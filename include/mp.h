@@ -0,0 +1,81 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// PI spec Vol 2, EFI_MP_SERVICES_PROTOCOL, gnu-efi doesn't carry it
+#define EFI_MP_SERVICES_PROTOCOL_GUID                                          \
+  {0x3fdda605, 0xa76e, 0x4f46, {0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08}}
+
+#define PROCESSOR_AS_BSP_BIT 0x00000001
+#define PROCESSOR_ENABLED_BIT 0x00000002
+#define PROCESSOR_HEALTH_STATUS_BIT 0x00000004
+
+typedef struct _EFI_MP_SERVICES_PROTOCOL EFI_MP_SERVICES_PROTOCOL;
+
+typedef struct {
+  UINT32 Package;
+  UINT32 Core;
+  UINT32 Thread;
+} EFI_CPU_PHYSICAL_LOCATION;
+
+typedef struct {
+  UINT64 ProcessorId;
+  UINT32 StatusFlag;
+  EFI_CPU_PHYSICAL_LOCATION Location;
+} EFI_PROCESSOR_INFORMATION;
+
+typedef VOID(EFIAPI *EFI_AP_PROCEDURE)(IN VOID *ProcedureArgument);
+
+typedef EFI_STATUS(EFIAPI *EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS)(
+    IN EFI_MP_SERVICES_PROTOCOL *This, OUT UINTN *NumberOfProcessors,
+    OUT UINTN *NumberOfEnabledProcessors);
+typedef EFI_STATUS(EFIAPI *EFI_MP_SERVICES_GET_PROCESSOR_INFO)(
+    IN EFI_MP_SERVICES_PROTOCOL *This, IN UINTN ProcessorNumber,
+    OUT EFI_PROCESSOR_INFORMATION *ProcessorInfoBuffer);
+typedef EFI_STATUS(EFIAPI *EFI_MP_SERVICES_STARTUP_ALL_APS)(
+    IN EFI_MP_SERVICES_PROTOCOL *This, IN EFI_AP_PROCEDURE Procedure,
+    IN BOOLEAN SingleThread, IN EFI_EVENT WaitEvent OPTIONAL,
+    IN UINTN TimeoutInMicroSeconds, IN VOID *ProcedureArgument OPTIONAL,
+    OUT UINTN **FailedCpuList OPTIONAL);
+typedef EFI_STATUS(EFIAPI *EFI_MP_SERVICES_STARTUP_THIS_AP)(
+    IN EFI_MP_SERVICES_PROTOCOL *This, IN EFI_AP_PROCEDURE Procedure,
+    IN UINTN ProcessorNumber, IN EFI_EVENT WaitEvent OPTIONAL,
+    IN UINTN TimeoutInMicroseconds, IN VOID *ProcedureArgument OPTIONAL,
+    OUT BOOLEAN *Finished OPTIONAL);
+typedef EFI_STATUS(EFIAPI *EFI_MP_SERVICES_SWITCH_BSP)(
+    IN EFI_MP_SERVICES_PROTOCOL *This, IN UINTN ProcessorNumber,
+    IN BOOLEAN EnableOldBSP);
+typedef EFI_STATUS(EFIAPI *EFI_MP_SERVICES_ENABLEDISABLEAP)(
+    IN EFI_MP_SERVICES_PROTOCOL *This, IN UINTN ProcessorNumber,
+    IN BOOLEAN EnableAP, IN UINT32 *HealthFlag OPTIONAL);
+typedef EFI_STATUS(EFIAPI *EFI_MP_SERVICES_WHOAMI)(
+    IN EFI_MP_SERVICES_PROTOCOL *This, OUT UINTN *ProcessorNumber);
+
+struct _EFI_MP_SERVICES_PROTOCOL {
+  EFI_MP_SERVICES_GET_NUMBER_OF_PROCESSORS GetNumberOfProcessors;
+  EFI_MP_SERVICES_GET_PROCESSOR_INFO GetProcessorInfo;
+  EFI_MP_SERVICES_STARTUP_ALL_APS StartupAllAPs;
+  EFI_MP_SERVICES_STARTUP_THIS_AP StartupThisAP;
+  EFI_MP_SERVICES_SWITCH_BSP SwitchBSP;
+  EFI_MP_SERVICES_ENABLEDISABLEAP EnableDisableAP;
+  EFI_MP_SERVICES_WHOAMI WhoAmI;
+};
+
+// upper bound on the processor numbers we hand work to
+#define MP_MAX_CPUS 64
+
+// a job runs once per worker, index is in [0, count)
+typedef void (*mp_job_fn)(void *ctx, UINTN index, UINTN count);
+
+void mp_init(EFI_SYSTEM_TABLE *SystemTable);
+UINTN mp_worker_count(void);
+void mp_run(mp_job_fn fn, void *ctx);
+
+void mp_copy(void *dest, const void *src, UINTN n);
+void mp_zero(void *dest, UINTN n);
@@ -7,4 +7,26 @@
 
 #include "core.h"
 
-UINTN parse_pe(UINTN efi_file_start_addr, UINTN efi_load_addr, UINTN efi_size);
\ No newline at end of file
+// Load a PE32+ image to *efi_load_addr, or to a free region picked here if
+// it is 0 or taken, applying base relocations and zeroing the bss. Returns
+// the entry point, 0 on error, and SizeOfImage in image_size.
+UINTN parse_pe(UINTN efi_file_start_addr, UINTN *efi_load_addr,
+               UINTN efi_size, UINTN *image_size);
+// Load an ELF64 executable's PT_LOAD segments to their physical addresses,
+// zeroing the bss. Returns the entry point, 0 on error, and the span of
+// the segments in [start, end).
+UINTN parse_elf(UINTN elf_file_start_addr, UINTN elf_size, UINTN *start,
+                UINTN *end);
+
+// Placement and footprint of a Linux Image from its arm64, RISC-V or
+// LoongArch boot header.
+struct linux_image {
+  const char *arch;
+  UINT64 image_size; // including the bss, at least the file size
+  UINT64 entry;
+  BOOLEAN placed; // at the 2 MB aligned base or link address it asks for
+};
+
+// Fill img for the Image of size bytes at addr, EFI_UNSUPPORTED if it has
+// no boot header.
+EFI_STATUS parse_linux_image(UINTN addr, UINTN size, struct linux_image *img);
@@ -195,6 +195,52 @@ typedef struct _IMAGE_NT_HEADERS {
   IMAGE_OPTIONAL_HEADER OptionalHeader;
 } IMAGE_NT_HEADERS, *PIMAGE_NT_HEADERS;
 
+//
+// PE32+ optional header, ImageBase and the reserve/commit sizes are 64 bit
+// and BaseOfData is gone.
+//
+
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC 0x20b
+
+typedef struct _IMAGE_OPTIONAL_HEADER64 {
+  UINT16 Magic;
+  UINT8 MajorLinkerVersion;
+  UINT8 MinorLinkerVersion;
+  UINT32 SizeOfCode;
+  UINT32 SizeOfInitializedData;
+  UINT32 SizeOfUninitializedData;
+  UINT32 AddressOfEntryPoint;
+  UINT32 BaseOfCode;
+  UINT64 ImageBase;
+  UINT32 SectionAlignment;
+  UINT32 FileAlignment;
+  UINT16 MajorOperatingSystemVersion;
+  UINT16 MinorOperatingSystemVersion;
+  UINT16 MajorImageVersion;
+  UINT16 MinorImageVersion;
+  UINT16 MajorSubsystemVersion;
+  UINT16 MinorSubsystemVersion;
+  UINT32 Win32VersionValue;
+  UINT32 SizeOfImage;
+  UINT32 SizeOfHeaders;
+  UINT32 CheckSum;
+  UINT16 Subsystem;
+  UINT16 DllCharacteristics;
+  UINT64 SizeOfStackReserve;
+  UINT64 SizeOfStackCommit;
+  UINT64 SizeOfHeapReserve;
+  UINT64 SizeOfHeapCommit;
+  UINT32 LoaderFlags;
+  UINT32 NumberOfRvaAndSizes;
+  IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+} IMAGE_OPTIONAL_HEADER64, *PIMAGE_OPTIONAL_HEADER64;
+
+typedef struct _IMAGE_NT_HEADERS64 {
+  UINT32 Signature;
+  IMAGE_FILE_HEADER FileHeader;
+  IMAGE_OPTIONAL_HEADER64 OptionalHeader;
+} IMAGE_NT_HEADERS64, *PIMAGE_NT_HEADERS64;
+
 typedef struct _IMAGE_ROM_HEADERS {
   IMAGE_FILE_HEADER FileHeader;
   IMAGE_ROM_OPTIONAL_HEADER OptionalHeader;
@@ -533,6 +579,8 @@ typedef struct _IMAGE_BASE_RELOCATION {
 #define IMAGE_REL_BASED_MIPS_JMPADDR 5
 #define IMAGE_REL_BASED_IA64_IMM64 9
 #define IMAGE_REL_BASED_DIR64 10
+// lu12i.w/ori/lu32i.d/lu52i.d sequence loading a 64 bit address
+#define IMAGE_REL_BASED_LOONGARCH64_MARK_LA 8
 
 //
 // Line number format.
@@ -0,0 +1,23 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "bootinfo.h"
+
+// Reserve CONFIG_PAGE_TABLES_SIZE bytes for the tables while boot
+// services are up, returns the pool address, 0 if that failed.
+UINTN pgtable_prepare(void);
+
+// Build hvisor's stage-1 and zone0's stage-2 identity maps of the nr
+// regions (struct boot_info_region, sorted) in the pool. Payload memory
+// goes to zone0 except for the pages of the nr_payloads payloads that are
+// hvisor's. Runs after ExitBootServices(), so it doesn't allocate.
+EFI_STATUS pgtable_build(const struct boot_info_region *regions, UINTN nr,
+                         const struct boot_info_payload *payloads,
+                         UINTN nr_payloads, struct boot_info_page_tables *pt);
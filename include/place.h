@@ -0,0 +1,33 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#define PLACE_MAX_REQUESTS 64
+// free ranges tracked, firmware maps rarely have more than a few dozen
+#define PLACE_MAX_RANGES 128
+
+// One payload to place: fixed ones stay at addr, the others get addr
+// assigned, a multiple of align.
+struct place_request {
+  const char *name;
+  UINT64 addr; // physical
+  UINT64 size;
+  UINT64 align;
+  BOOLEAN fixed;
+};
+
+// Place every movable request in free memory of map (still with boot
+// services, so EfiConventionalMemory) around the fixed ones, largest
+// first. Each one goes to the largest free range that still takes it
+// aligned to a 1 GB (at least 1 GB in size) or 2 MB block, so stage-2 maps
+// it with block entries, and only then to any range that fits its own
+// alignment. Doesn't allocate, the caller claims the result.
+EFI_STATUS place_payloads(struct place_request *req, UINTN nr,
+                          const EFI_MEMORY_DESCRIPTOR *map, UINTN map_size,
+                          UINTN desc_size);
@@ -0,0 +1,13 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+void sha256(const void *data, UINTN size, UINT8 digest[SHA256_DIGEST_SIZE]);
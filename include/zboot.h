@@ -0,0 +1,34 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+// Linux EFI zboot image (drivers/firmware/efi/libstub/zboot-header.S): a PE
+// wrapper whose EFI stub would decompress the payload, the actual Image.
+// The loader decodes the payload itself, straight to the load address.
+#define ZBOOT_IMAGE_TYPE 0x676d697a // "zimg"
+
+struct zboot_header {
+  UINT32 mz_magic;
+  UINT32 image_type;
+  UINT32 payload_offset; // from the start of the file
+  UINT32 payload_size;   // without the size trailer of zstd22
+  UINT32 reserved[2];
+  char comp_type[32]; // "gzip", "zstd22", ...
+};
+
+// Whether src starts with a zboot header, the payload itself isn't checked.
+BOOLEAN zboot_detect(const void *src, UINTN src_size);
+
+// Size of the decoded Image, 0 if malformed or compressed with a codec the
+// loader doesn't have.
+UINTN zboot_content_size(const void *src, UINTN src_size);
+
+// Decode the Image inside a zboot file to dest.
+EFI_STATUS zboot_decompress(void *dest, UINTN dest_size, const void *src,
+                            UINTN src_size, UINTN *out_size);
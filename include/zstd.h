@@ -0,0 +1,57 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#pragma once
+
+#include <efi.h>
+#include <efilib.h>
+
+#define ZSTD_FRAME_MAGIC 0xFD2FB528
+
+// Multi-frame payload written by scripts/mkzstdpayload.py: the input is cut
+// into fixed-size pieces that are compressed as independent zstd frames, so
+// any frame can be decoded on any cpu straight to dst_offset.
+#define ZSTD_PAYLOAD_MAGIC 0x535a5648 // "HVZS"
+
+struct zstd_payload_frame {
+  UINT64 src_offset; // from the start of the payload header
+  UINT64 src_size;
+  UINT64 dst_offset;
+  UINT64 dst_size;
+};
+
+struct zstd_payload_header {
+  UINT32 magic;
+  UINT32 nr_frames;
+  UINT64 content_size;
+  UINT64 frame_size;
+  struct zstd_payload_frame frames[];
+};
+
+// decoder state, one per worker
+struct zstd_dctx;
+
+struct zstd_dctx *zstd_alloc_dctx(void);
+void zstd_free_dctx(struct zstd_dctx *dctx);
+
+// Decode one frame into dest, no dictionary. Back-references may only point
+// into this frame's own output.
+EFI_STATUS zstd_decompress_frame(struct zstd_dctx *dctx, void *dest,
+                                 UINTN dest_size, const void *src,
+                                 UINTN src_size, UINTN *out_size);
+
+// Decoded size of a multi-frame payload, 0 if the header is malformed.
+UINTN zstd_payload_content_size(const void *src, UINTN src_size);
+
+// Decode every frame of a multi-frame payload, spread across the workers of
+// mp_run().
+EFI_STATUS zstd_payload_decompress(void *dest, UINTN dest_size,
+                                   const void *src, UINTN src_size);
+
+// Same for frames [first, first + count) only, so a payload that is still
+// arriving can be decoded a batch at a time.
+EFI_STATUS zstd_payload_decompress_frames(void *dest, UINTN dest_size,
+                                          const void *src, UINTN src_size,
+                                          UINTN first, UINTN count);
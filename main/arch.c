@@ -4,6 +4,7 @@
  */
 
 #include "arch.h"
+#include "boottime.h"
 
 #if defined(CONFIG_TARGET_ARCH_AARCH64)
 extern struct arch_ops aarch64_ops;
@@ -22,6 +23,7 @@ struct arch_ops *arch_ops = NULL;
 
 void arch_detect_and_init(void) {
   arch_ops = ARCH_OPS;
+  boot_time_mark("firmware");
   ARCH_EARLY_INIT();
   ARCH_INIT();
   ARCH_MEMORY_INIT();
@@ -4,11 +4,29 @@
  */
 
 #include "arch.h"
+#include "core.h"
 
 #define UART_BASE 0x9000000
 #define UART_FR 0x18          // Flag register
 #define UART_FR_TXFF (1 << 5) // Transmit FIFO full
+#define UART_FR_TXFE (1 << 7) // Transmit FIFO empty
 #define UART_DR 0x00          // Data register
+#define UART_FIFO_DEPTH 16    // PL011 r1p4 and older, r1p5 has 32
+
+#define DCZID_DZP (1 << 4) // DC ZVA prohibited
+#define DCZID_BS_MASK 0xf  // log2 of the block size in words
+
+#define CTR_IMINLINE(ctr) ((ctr) & 0xf) // log2 of the line size in words
+#define CTR_DMINLINE(ctr) (((ctr) >> 16) & 0xf)
+#define CTR_DIC (1UL << 29) // no I-cache invalidation needed
+
+extern void aarch64_copy_blocks_neon(void *dest, const void *src,
+                                     UINTN nblocks);
+extern void aarch64_zero_blocks_neon(void *dest, UINTN nblocks);
+
+extern struct arch_ops aarch64_ops;
+
+static UINT64 cache_type;
 
 static inline void mmio_write(uint64_t reg, uint32_t val) {
   *(volatile uint32_t *)(reg) = val;
@@ -26,13 +44,81 @@ static void arch_put_char(char c) {
 }
 
 static void arch_get_char(char *c) {}
-static void arch_memory_init(void) {}
+
+// the PL011 has no fill level, only empty and full
+static UINTN arch_tx_room(void) {
+  UINT32 fr = mmio_read(UART_BASE + UART_FR);
+  if (fr & UART_FR_TXFE) {
+    return UART_FIFO_DEPTH;
+  }
+  return fr & UART_FR_TXFF ? 0 : 1;
+}
+
+static void arch_tx_burst(const char *buf, UINTN n) {
+  while (n--) {
+    mmio_write(UART_BASE + UART_DR, *buf++);
+  }
+}
+
+static void arch_zero_blocks_dczva(void *dest, UINTN nblocks) {
+  UINTN block = aarch64_ops.memory.zero_block_size;
+  UINT8 *p = (UINT8 *)dest;
+
+  while (nblocks--) {
+    __asm__ volatile("dc zva, %0" : : "r"(p) : "memory");
+    p += block;
+  }
+}
+
+// Clean by VA to the point of coherency rather than unification: hvisor and
+// the kernels may well start with their caches off.
+static void arch_sync_range(void *addr, UINTN size) {
+  UINTN dline = 4UL << CTR_DMINLINE(cache_type);
+  UINTN iline = 4UL << CTR_IMINLINE(cache_type);
+  UINTN end = (UINTN)addr + size;
+
+  for (UINTN p = ALIGN_DOWN((UINTN)addr, dline); p < end; p += dline) {
+    __asm__ volatile("dc cvac, %0" : : "r"(p) : "memory");
+  }
+  __asm__ volatile("dsb ish" : : : "memory");
+  if (!(cache_type & CTR_DIC)) {
+    for (UINTN p = ALIGN_DOWN((UINTN)addr, iline); p < end; p += iline) {
+      __asm__ volatile("ic ivau, %0" : : "r"(p) : "memory");
+    }
+    __asm__ volatile("dsb ish" : : : "memory");
+  }
+  __asm__ volatile("isb" : : : "memory");
+}
+
+static void arch_memory_init(void) {
+  UINT64 dczid;
+  __asm__ volatile("mrs %0, ctr_el0" : "=r"(cache_type));
+  __asm__ volatile("mrs %0, dczid_el0" : "=r"(dczid));
+  if (!(dczid & DCZID_DZP)) {
+    aarch64_ops.memory.zero_blocks = arch_zero_blocks_dczva;
+    aarch64_ops.memory.zero_block_size = 4UL << (dczid & DCZID_BS_MASK);
+  }
+}
 static void arch_setup_direct_mapping(void) {}
 static void arch_clear_memory_regions(void) {}
 static void arch_early_init(void) {}
 static void arch_init(void) {}
 static void arch_before_exit_boot_services(void) {}
 
+static UINT64 arch_read_counter(void) {
+  UINT64 cnt;
+  __asm__ volatile("isb\n"
+                   "mrs %0, cntvct_el0"
+                   : "=r"(cnt));
+  return cnt;
+}
+
+static UINT64 arch_get_frequency(void) {
+  UINT64 freq;
+  __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+  return freq;
+}
+
 static UINTN arch_get_boot_cpu_id(EFI_BOOT_SERVICES *g_bs) {
   // Implementation can be added if needed
   return 0;
@@ -53,6 +139,8 @@ struct arch_ops aarch64_ops = {
             .init = arch_serial_init,
             .put_char = arch_put_char,
             .get_char = arch_get_char,
+            .tx_room = arch_tx_room,
+            .tx_burst = arch_tx_burst,
         },
 
     .memory =
@@ -60,6 +148,17 @@ struct arch_ops aarch64_ops = {
             .init = arch_memory_init,
             .setup_direct_mapping = arch_setup_direct_mapping,
             .clear_memory_regions = arch_clear_memory_regions,
+            .copy_blocks = aarch64_copy_blocks_neon,
+            // upgraded to DC ZVA in arch_memory_init() when permitted
+            .zero_blocks = aarch64_zero_blocks_neon,
+            .zero_block_size = 64,
+            .sync_range = arch_sync_range,
+        },
+
+    .timer =
+        {
+            .read_counter = arch_read_counter,
+            .get_frequency = arch_get_frequency,
         },
 
     .arch_data = NULL,
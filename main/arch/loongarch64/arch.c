@@ -4,36 +4,133 @@
  */
 
 #include "arch.h"
+#include "bootinfo.h"
+#include "container.h"
 #include "core.h"
+#include "mp.h"
 
 extern void uart_put_char(char c);
 extern void init_serial(void);
 extern void set_dmw(void);
 extern void loongarch_arch_init(void);
+extern void la_copy_blocks_lsx(void *dest, const void *src, UINTN nblocks);
+extern void la_copy_blocks_lasx(void *dest, const void *src, UINTN nblocks);
+extern void la_zero_blocks_lsx(void *dest, UINTN nblocks);
+extern void la_zero_blocks_lasx(void *dest, UINTN nblocks);
+
+#define CPUCFG2_LSX (1 << 6)
+#define CPUCFG2_LASX (1 << 7)
+
+// the console 16550 through the DMW window, see uart.S
+#define UART_BASE 0x800000001fe001e0ULL
+#define UART_THR 0
+#define UART_LSR 5
+#define UART_LSR_THRE 0x20
+#define UART_FIFO_DEPTH 16
+
+extern struct arch_ops loongarch64_ops;
+
+static inline UINT32 cpucfg(UINT32 word) {
+  UINT32 val;
+  __asm__ volatile("cpucfg %0, %1" : "=r"(val) : "r"(word));
+  return val;
+}
+
+static UINT64 arch_read_counter(void) {
+  UINT64 cnt;
+  __asm__ volatile("rdtime.d %0, $zero" : "=r"(cnt));
+  return cnt;
+}
+
+static UINT64 arch_get_frequency(void) {
+  // stable counter runs at CC_FREQ * CC_MUL / CC_DIV
+  UINT64 cc_freq = cpucfg(4);
+  UINT32 cfg5 = cpucfg(5);
+  UINT64 cc_mul = cfg5 & 0xffff;
+  UINT64 cc_div = cfg5 >> 16;
+  if (cc_div == 0) {
+    return 0;
+  }
+  return cc_freq * cc_mul / cc_div;
+}
 
 static void arch_serial_init(void) { init_serial(); }
 static void arch_put_char(char c) { uart_put_char(c); }
 static void arch_get_char(char *c) {}
-static void arch_memory_init(void) {}
+
+// THRE means the whole FIFO is empty on the 16550, init_serial() enabled it
+static UINTN arch_tx_room(void) {
+  volatile UINT8 *uart = (volatile UINT8 *)UART_BASE;
+  return uart[UART_LSR] & UART_LSR_THRE ? UART_FIFO_DEPTH : 0;
+}
+
+static void arch_tx_burst(const char *buf, UINTN n) {
+  volatile UINT8 *uart = (volatile UINT8 *)UART_BASE;
+  while (n--) {
+    uart[UART_THR] = *buf++;
+  }
+}
+static void arch_memory_init(void) {
+  UINT32 cfg2 = cpucfg(2);
+  if (cfg2 & CPUCFG2_LASX) {
+    loongarch64_ops.memory.copy_blocks = la_copy_blocks_lasx;
+    loongarch64_ops.memory.zero_blocks = la_zero_blocks_lasx;
+  } else if (cfg2 & CPUCFG2_LSX) {
+    loongarch64_ops.memory.copy_blocks = la_copy_blocks_lsx;
+    loongarch64_ops.memory.zero_blocks = la_zero_blocks_lsx;
+  }
+}
+// The data caches are coherent with each other and with instruction fetch
+// misses, only the fetch has to be ordered behind the stores.
+static void arch_sync_range(void *addr, UINTN size) {
+  __asm__ volatile("dbar 0\n"
+                   "ibar 0\n"
+                   :
+                   :
+                   : "memory");
+}
 static void arch_setup_direct_mapping(void) {}
 static void arch_clear_memory_regions(void) {
   UINTN memset1_st = CONFIG_HVISOR_BIN_LOAD_ADDR;
+#if defined(CONFIG_HVISOR_ELF)
+  // the ELF describes its bss, which is zeroed exactly when it is loaded
+  UINTN memset1_size = 0;
+#else
   UINTN memset1_size = 0x1000000ULL;
+#endif
   UINTN memset2_st = 0x9000000000001000ULL;
   UINTN memset2_size = 0x10000ULL;
-  UINTN memset3_st = 0x9000000000200000ULL;
-  UINTN memset3_size = 0x1000000ULL;
 
-  memset2((void *)memset1_st, 0, memset1_size);
-  memset2((void *)memset2_st, 0, memset2_size);
-  memset2((void *)memset3_st, 0, memset3_size);
+  // fixed addresses hvisor and the zone0 kernel expect. The kernel's own
+  // bss is cleared by the size its Image header gives when it is loaded.
+  if (EFI_ERROR(reserve_payload("hvisor", &memset1_st, memset1_size, 0)) ||
+      EFI_ERROR(reserve_payload("low memory", &memset2_st, memset2_size, 0))) {
+    halt();
+  }
+  // keep the whole hvisor window out of zone0, not only the loaded bytes
+  if (memset1_size != 0) {
+    struct boot_info_payload p = {
+        .kind = CONTAINER_KIND_HVISOR,
+        .addr = memset1_st,
+        .zero_size = memset1_size,
+        .name = "hvisor window",
+    };
+    boot_info_add_payload(&p);
+  }
+
+  UINT64 start = arch_read_counter();
+  mp_zero((void *)memset1_st, memset1_size);
+  mp_zero((void *)memset2_st, memset2_size);
+  UINT64 ticks = arch_read_counter() - start;
+
+  UINTN total = memset1_size + memset2_size;
+  Print(L"[INFO] arch_clear_memory_regions: cleared 0x%lx bytes, %ld MB/s\n",
+        total, throughput_mbps(total, ticks));
 }
 
 static void arch_early_init(void) { set_dmw(); }
 static void arch_init(void) { loongarch_arch_init(); }
-static void arch_before_exit_boot_services(void) {
-  arch_clear_memory_regions();
-}
+static void arch_before_exit_boot_services(void) {}
 
 static UINTN arch_get_boot_cpu_id(EFI_BOOT_SERVICES *g_bs) {
   // Implementation can be added if needed
@@ -55,6 +152,8 @@ struct arch_ops loongarch64_ops = {
             .init = arch_serial_init,
             .put_char = arch_put_char,
             .get_char = arch_get_char,
+            .tx_room = arch_tx_room,
+            .tx_burst = arch_tx_burst,
         },
 
     .memory =
@@ -62,6 +161,17 @@ struct arch_ops loongarch64_ops = {
             .init = arch_memory_init,
             .setup_direct_mapping = arch_setup_direct_mapping,
             .clear_memory_regions = arch_clear_memory_regions,
+            // selected in arch_memory_init() by CPUCFG
+            .copy_blocks = NULL,
+            .zero_blocks = NULL,
+            .zero_block_size = 64,
+            .sync_range = arch_sync_range,
+        },
+
+    .timer =
+        {
+            .read_counter = arch_read_counter,
+            .get_frequency = arch_get_frequency,
         },
 
     .arch_data = NULL,
@@ -4,11 +4,24 @@
  */
 
 #include "arch.h"
+#include "core.h"
 #include "efi.h"
 #include "efilib.h"
 #include "riscvbootptotocol.h"
 /// edk2: UefiCpuPkg/Include/Protocol/RiscVBootProtocol.h
 
+#define SSTATUS_VS (3UL << 9)
+#define SSTATUS_VS_INITIAL (1UL << 9)
+
+extern void riscv_copy_blocks_rvv(void *dest, const void *src, UINTN nblocks);
+extern void riscv_zero_blocks_rvv(void *dest, UINTN nblocks);
+
+extern struct arch_ops riscv64_ops;
+
+// from the device tree when available, see probe_fdt_cpu()
+static UINT64 timebase_frequency;
+static UINT32 cbom_block_size; // 0 without Zicbom
+
 struct sbiret {
   long error;
   long value;
@@ -34,13 +47,294 @@ static inline struct sbiret sbi_ecall(unsigned long eid, unsigned long fid,
   return ret;
 }
 
-static void arch_serial_init(void) {}
+#define SBI_EXT_LEGACY_PUTCHAR 0x1
+#define SBI_EXT_LEGACY_GETCHAR 0x2
+#define SBI_EXT_BASE 0x10
+#define SBI_BASE_PROBE_EXTENSION 3
+#define SBI_EXT_DBCN 0x4442434e // "DBCN"
+#define SBI_DBCN_WRITE 0
+#define SBI_DBCN_READ 1
+
+static int sbi_has_dbcn;
+
 static void arch_put_char(char c) {
-  (void)sbi_ecall(0x1, 0, (unsigned long)c, 0, 0, 0, 0, 0);
+  (void)sbi_ecall(SBI_EXT_LEGACY_PUTCHAR, 0, (unsigned long)c, 0, 0, 0, 0, 0);
+}
+
+static void arch_get_char(char *c) {
+  if (sbi_has_dbcn) {
+    struct sbiret ret;
+    do {
+      ret = sbi_ecall(SBI_EXT_DBCN, SBI_DBCN_READ, 1, (unsigned long)c, 0, 0,
+                      0, 0);
+    } while (ret.error == 0 && ret.value == 0);
+    return;
+  }
+  long ch;
+  do {
+    ch = sbi_ecall(SBI_EXT_LEGACY_GETCHAR, 0, 0, 0, 0, 0, 0, 0).error;
+  } while (ch < 0);
+  *c = (char)ch;
+}
+
+// the firmware takes the whole buffer in one trap, there is no FIFO to fill
+static UINTN arch_tx_room(void) { return (UINTN)-1; }
+
+// DBCN may take less than asked for, the buffer address is physical which
+// is fine under the identity mapping of UEFI and with satp cleared
+static void arch_tx_burst(const char *buf, UINTN n) {
+  while (n > 0) {
+    struct sbiret ret = sbi_ecall(SBI_EXT_DBCN, SBI_DBCN_WRITE, n,
+                                  (unsigned long)buf, 0, 0, 0, 0);
+    if (ret.error != 0) {
+      while (n--) {
+        arch_put_char(*buf++);
+      }
+      return;
+    }
+    buf += ret.value;
+    n -= ret.value;
+  }
+}
+
+// SBI v2.0 Debug Console writes whole strings per ecall, the legacy
+// console extension traps once per byte
+static void arch_serial_init(void) {
+  struct sbiret ret = sbi_ecall(SBI_EXT_BASE, SBI_BASE_PROBE_EXTENSION,
+                                SBI_EXT_DBCN, 0, 0, 0, 0, 0);
+  if (ret.error == 0 && ret.value != 0) {
+    sbi_has_dbcn = 1;
+    riscv64_ops.serial.tx_room = arch_tx_room;
+    riscv64_ops.serial.tx_burst = arch_tx_burst;
+  }
+}
+// sstatus.VS is WARL and hardwired to zero on harts without the V extension,
+// misa is not readable from S-mode so probe the field instead
+static int riscv_has_vector(void) {
+  unsigned long sstatus;
+  __asm__ volatile("csrs sstatus, %1\n"
+                   "csrr %0, sstatus"
+                   : "=r"(sstatus)
+                   : "r"(SSTATUS_VS_INITIAL));
+  return (sstatus & SSTATUS_VS) != 0;
+}
+
+static void arch_memory_init(void) {
+  if (riscv_has_vector()) {
+    riscv64_ops.memory.copy_blocks = riscv_copy_blocks_rvv;
+    riscv64_ops.memory.zero_blocks = riscv_zero_blocks_rvv;
+    riscv64_ops.memory.zero_block_size = 64;
+  }
+}
+
+static void arch_zero_blocks_cboz(void *dest, UINTN nblocks) {
+  UINTN block = riscv64_ops.memory.zero_block_size;
+  UINT8 *p = (UINT8 *)dest;
+
+  while (nblocks--) {
+    // cbo.zero (p)
+    __asm__ volatile(".insn i 0x0f, 2, x0, %0, 4" : : "r"(p) : "memory");
+    p += block;
+  }
+}
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_NOP 4
+#define FDT_END 9
+// /cpus/cpu@N is at depth 3, anything this deep is a broken tree
+#define FDT_MAX_DEPTH 64
+
+struct fdt_header {
+  UINT32 magic;
+  UINT32 totalsize;
+  UINT32 off_dt_struct;
+  UINT32 off_dt_strings;
+  UINT32 off_mem_rsvmap;
+  UINT32 version;
+  UINT32 last_comp_version;
+  UINT32 boot_cpuid_phys;
+  UINT32 size_dt_strings;
+  UINT32 size_dt_struct;
+};
+
+static inline UINT32 fdt32(UINT32 v) { return __builtin_bswap32(v); }
+
+static void *find_fdt(void) {
+  EFI_GUID fdt_guid = {0xb1b621d5,
+                       0xf19c,
+                       0x41a5,
+                       {0x83, 0x0b, 0xd9, 0x15, 0x2c, 0x69, 0xaa, 0xe0}};
+
+  for (UINTN i = 0; i < ST->NumberOfTableEntries; i++) {
+    EFI_CONFIGURATION_TABLE *t = &ST->ConfigurationTable[i];
+    if (CompareGuid(&t->VendorGuid, &fdt_guid) == 0) {
+      return t->VendorTable;
+    }
+  }
+  return NULL;
+}
+
+// ext as a whole word of a riscv,isa string or riscv,isa-extensions string
+// list entry
+static int isa_has(const char *str, UINT32 len, int is_list,
+                   const char *ext) {
+  const char *end = str + len;
+  UINTN ext_len = strlena((CHAR8 *)ext);
+  while (str < end) {
+    const char *p = str;
+    while (p < end && *p != '\0' && (is_list || *p != '_')) {
+      p++;
+    }
+    if ((UINTN)(p - str) == ext_len && CompareMem(str, ext, ext_len) == 0) {
+      return 1;
+    }
+    str = p + 1;
+  }
+  return 0;
+}
+
+// str, at most max bytes, equals the NUL terminated name
+static BOOLEAN fdt_str_is(const char *str, UINTN max, const char *name) {
+  UINTN i = 0;
+  for (; i < max && name[i]; i++) {
+    if (str[i] != name[i]) {
+      return FALSE;
+    }
+  }
+  return i < max && str[i] == '\0';
+}
+
+// n bytes past p, but not past end
+static const UINT8 *fdt_skip(const UINT8 *p, const UINT8 *end, UINTN n) {
+  return n < (UINTN)(end - p) ? p + n : end;
+}
+
+// Walk the first /cpus/cpu@N node of the firmware device tree for Zicboz
+// and Zicbom, their block sizes and the timebase frequency from /cpus.
+// Every step is checked against the structure block, a broken tree ends
+// the walk with whatever was found so far.
+static void probe_fdt_cpu(void) {
+  struct fdt_header *fdt = find_fdt();
+  if (fdt == NULL || fdt32(fdt->magic) != FDT_MAGIC) {
+    return;
+  }
+  UINT32 total = fdt32(fdt->totalsize);
+  UINT32 off_struct = fdt32(fdt->off_dt_struct);
+  UINT32 off_strings = fdt32(fdt->off_dt_strings);
+  UINT32 size_strings = fdt32(fdt->size_dt_strings);
+  // size_dt_struct is new in version 17
+  UINT32 size_struct = fdt32(fdt->version) >= 17 ? fdt32(fdt->size_dt_struct)
+                                                 : total - off_struct;
+  if (total < sizeof(*fdt) || off_struct > total ||
+      size_struct > total - off_struct || off_strings > total ||
+      size_strings > total - off_strings) {
+    return;
+  }
+
+  // every token takes at least 4 bytes, so the walk ends with the block
+  const UINT8 *p = (const UINT8 *)fdt + off_struct, *end = p + size_struct;
+  const char *strings = (const char *)fdt + off_strings;
+  int depth = 0, in_cpus = 0, in_cpu = 0, cpu_done = 0, zicboz = 0;
+  int zicbom = 0;
+  UINT32 block_size = 0, cbom_size = 0;
+
+  while (end - p >= 4) {
+    UINT32 token = fdt32(*(const UINT32 *)p);
+    p += 4;
+    if (token == FDT_BEGIN_NODE) {
+      const char *name = (const char *)p;
+      UINTN len = 0;
+      while (p + len < end && name[len] != '\0') {
+        len++;
+      }
+      if (p + len == end || ++depth > FDT_MAX_DEPTH) {
+        break;
+      }
+      if (depth == 2 && len == 4 && CompareMem(name, "cpus", 4) == 0) {
+        in_cpus = 1;
+      } else if (in_cpus && depth == 3 && !cpu_done && len >= 4 &&
+                 CompareMem(name, "cpu@", 4) == 0) {
+        in_cpu = 1;
+      }
+      p = fdt_skip(p, end, ALIGN_UP(len + 1, 4));
+    } else if (token == FDT_END_NODE) {
+      if (depth == 0) {
+        break;
+      }
+      if (in_cpu && depth == 3) {
+        in_cpu = 0;
+        cpu_done = 1;
+      } else if (in_cpus && depth == 2) {
+        break;
+      }
+      depth--;
+    } else if (token == FDT_PROP) {
+      if (end - p < 8) {
+        break;
+      }
+      UINT32 len = fdt32(((const UINT32 *)p)[0]);
+      UINT32 nameoff = fdt32(((const UINT32 *)p)[1]);
+      p += 8;
+      if (len > (UINTN)(end - p) || nameoff >= size_strings) {
+        break;
+      }
+      const char *name = strings + nameoff;
+      UINTN name_max = size_strings - nameoff;
+      const char *val = (const char *)p;
+      if (in_cpus && depth == 2 && len >= 4 &&
+          fdt_str_is(name, name_max, "timebase-frequency")) {
+        timebase_frequency = fdt32(*(UINT32 *)val);
+      } else if (in_cpu && fdt_str_is(name, name_max, "riscv,isa")) {
+        zicboz |= isa_has(val, len, 0, "zicboz");
+        zicbom |= isa_has(val, len, 0, "zicbom");
+      } else if (in_cpu &&
+                 fdt_str_is(name, name_max, "riscv,isa-extensions")) {
+        zicboz |= isa_has(val, len, 1, "zicboz");
+        zicbom |= isa_has(val, len, 1, "zicbom");
+      } else if (in_cpu && len >= 4 &&
+                 fdt_str_is(name, name_max, "riscv,cboz-block-size")) {
+        block_size = fdt32(*(UINT32 *)val);
+      } else if (in_cpu && len >= 4 &&
+                 fdt_str_is(name, name_max, "riscv,cbom-block-size")) {
+        cbom_size = fdt32(*(UINT32 *)val);
+      }
+      p = fdt_skip(p, end, ALIGN_UP(len, 4));
+    } else if (token == FDT_NOP) {
+      continue;
+    } else {
+      break;
+    }
+  }
+
+  if (zicboz && block_size != 0 && (block_size & (block_size - 1)) == 0) {
+    riscv64_ops.memory.zero_blocks = arch_zero_blocks_cboz;
+    riscv64_ops.memory.zero_block_size = block_size;
+    Print(L"[INFO] riscv64: using cbo.zero, block size %d\n", block_size);
+  }
+  if (zicbom && cbom_size != 0 && (cbom_size & (cbom_size - 1)) == 0) {
+    cbom_block_size = cbom_size;
+    Print(L"[INFO] riscv64: using cbo.clean, block size %d\n", cbom_size);
+  }
 }
 
-static void arch_get_char(char *c) {}
-static void arch_memory_init(void) {}
+// Harts without Zicbom are coherent with memory as far as the payloads are
+// concerned, with it the range is also written back for payloads that
+// start with caches off or hand it to non-coherent devices.
+static void arch_sync_range(void *addr, UINTN size) {
+  if (cbom_block_size != 0) {
+    UINTN end = (UINTN)addr + size;
+    UINTN p = ALIGN_DOWN((UINTN)addr, cbom_block_size);
+    for (; p < end; p += cbom_block_size) {
+      // cbo.clean (p)
+      __asm__ volatile(".insn i 0x0f, 2, x0, %0, 1" : : "r"(p) : "memory");
+    }
+    __asm__ volatile("fence rw, rw" : : : "memory");
+  }
+  __asm__ volatile("fence.i" : : : "memory");
+}
 static void arch_setup_direct_mapping(void) {}
 static void arch_clear_memory_regions(void) {}
 static void arch_early_init(void) {}
@@ -52,7 +346,26 @@ static void arch_init(void) {
   __asm__ volatile("csrw satp, x0\n"
                    "sfence.vma x0, x0\n");
 }
-static void arch_before_exit_boot_services(void) {}
+// ST is only usable after InitializeLib(), so the device tree probe can't
+// live in arch_memory_init()
+static void arch_before_exit_boot_services(void) { probe_fdt_cpu(); }
+
+static UINT64 arch_read_counter(void) {
+  UINT64 cnt;
+  __asm__ volatile("rdtime %0" : "=r"(cnt));
+  return cnt;
+}
+
+static UINT64 arch_get_frequency(void) {
+  // no timebase-frequency in the device tree (or not probed yet), calibrate
+  // it once against the firmware Stall() instead
+  if (timebase_frequency == 0 && BS != NULL) {
+    UINT64 start = arch_read_counter();
+    uefi_call_wrapper(BS->Stall, 1, 1000);
+    timebase_frequency = (arch_read_counter() - start) * 1000;
+  }
+  return timebase_frequency;
+}
 
 static UINTN arch_get_boot_hart_id(EFI_BOOT_SERVICES *g_bs) {
   EFI_STATUS Status;
@@ -97,6 +410,10 @@ struct arch_ops riscv64_ops = {
             .init = arch_serial_init,
             .put_char = arch_put_char,
             .get_char = arch_get_char,
+            // set in arch_serial_init() when SBI has DBCN, legacy putchar
+            // waits on its own
+            .tx_room = NULL,
+            .tx_burst = NULL,
         },
 
     .memory =
@@ -104,6 +421,18 @@ struct arch_ops riscv64_ops = {
             .init = arch_memory_init,
             .setup_direct_mapping = arch_setup_direct_mapping,
             .clear_memory_regions = arch_clear_memory_regions,
+            // selected in arch_memory_init() when the hart has RVV
+            .copy_blocks = NULL,
+            // RVV or cbo.zero, see arch_memory_init() and probe_fdt_cpu()
+            .zero_blocks = NULL,
+            .zero_block_size = 64,
+            .sync_range = arch_sync_range,
+        },
+
+    .timer =
+        {
+            .read_counter = arch_read_counter,
+            .get_frequency = arch_get_frequency,
         },
 
     .arch_data = NULL,
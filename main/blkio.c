@@ -0,0 +1,198 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "blkio.h"
+#include "console.h"
+#include "core.h"
+
+EFI_STATUS blkio_init(struct blkio_reader *r, EFI_HANDLE handle,
+                      UINTN max_segments) {
+  EFI_STATUS status;
+
+  ZeroMem(r, sizeof(*r));
+  status = uefi_call_wrapper(BS->HandleProtocol, 3, handle, &BlockIoProtocol,
+                             (void **)&r->bio);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  if (!r->bio->Media->MediaPresent) {
+    return EFI_NO_MEDIA;
+  }
+  r->media_id = r->bio->Media->MediaId;
+  r->block_size = r->bio->Media->BlockSize;
+  r->io_align = r->bio->Media->IoAlign ? r->bio->Media->IoAlign : 1;
+
+  r->segments = AllocatePool(max_segments * sizeof(r->segments[0]));
+  if (r->segments == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  r->max_segments = max_segments;
+
+  // BlockIo2 is optional, plain BlockIo is read one request at a time
+  if (EFI_ERROR(uefi_call_wrapper(BS->HandleProtocol, 3, handle,
+                                  &BlockIo2Protocol, (void **)&r->bio2))) {
+    r->bio2 = NULL;
+    return EFI_SUCCESS;
+  }
+  for (UINTN i = 0; i < BLKIO_QUEUE_DEPTH; i++) {
+    status = uefi_call_wrapper(BS->CreateEvent, 5, 0, 0, NULL, NULL,
+                               &r->requests[i].token.Event);
+    if (EFI_ERROR(status)) {
+      Print(L"[WARN] blkio_init: no events, falling back to BlockIo: %a\n",
+            get_efi_status_string(status));
+      while (i--) {
+        uefi_call_wrapper(BS->CloseEvent, 1, r->requests[i].token.Event);
+      }
+      r->bio2 = NULL;
+      break;
+    }
+  }
+  return EFI_SUCCESS;
+}
+
+UINTN blkio_add(struct blkio_reader *r, EFI_LBA lba, void *dest, UINTN size) {
+  size = ALIGN_UP(size, r->block_size);
+  if (size == 0) {
+    return r->total;
+  }
+  if (r->nr_segments == r->max_segments) {
+    r->status = EFI_BUFFER_TOO_SMALL;
+    return r->total;
+  }
+  struct blkio_segment *s = &r->segments[r->nr_segments++];
+  s->lba = lba;
+  s->dest = (UINT8 *)dest;
+  s->size = size;
+  r->total += size;
+  return r->total;
+}
+
+// submit requests until the queue is full or everything is submitted
+static void blkio_fill(struct blkio_reader *r) {
+  while (!EFI_ERROR(r->status) && r->submitted < r->total) {
+    if (r->bio2 && r->inflight == BLKIO_QUEUE_DEPTH) {
+      return;
+    }
+
+    struct blkio_segment *s = &r->segments[r->cur_segment];
+    UINTN len = s->size - r->cur_offset;
+    if (len > BLKIO_CHUNK) {
+      len = BLKIO_CHUNK;
+    }
+    EFI_LBA lba = s->lba + r->cur_offset / r->block_size;
+    UINT8 *dest = s->dest + r->cur_offset;
+    EFI_STATUS status;
+
+    if (r->bio2) {
+      struct blkio_request *req =
+          &r->requests[(r->head + r->inflight) % BLKIO_QUEUE_DEPTH];
+      req->token.TransactionStatus = EFI_SUCCESS;
+      req->end = r->submitted + len;
+      status = uefi_call_wrapper(r->bio2->ReadBlocksEx, 6, r->bio2,
+                                 r->media_id, lba, &req->token, len, dest);
+      if (!EFI_ERROR(status)) {
+        r->inflight++;
+      }
+    } else {
+      status = uefi_call_wrapper(r->bio->ReadBlocks, 5, r->bio, r->media_id,
+                                 lba, len, dest);
+      if (!EFI_ERROR(status)) {
+        r->done = r->submitted + len;
+      }
+    }
+    if (EFI_ERROR(status)) {
+      Print(L"[ERROR] blkio_fill: read of lba 0x%lx failed: %a\n", lba,
+            get_efi_status_string(status));
+      r->status = status;
+      return;
+    }
+
+    r->submitted += len;
+    r->cur_offset += len;
+    if (r->cur_offset == s->size) {
+      r->cur_segment++;
+      r->cur_offset = 0;
+    }
+    // synchronous reads go one chunk per call so the caller sees progress
+    if (r->bio2 == NULL) {
+      return;
+    }
+  }
+}
+
+// retire finished requests in submission order, block on the oldest one
+// if asked to
+static void blkio_reap(struct blkio_reader *r, BOOLEAN block) {
+  while (r->inflight > 0) {
+    struct blkio_request *req = &r->requests[r->head];
+    EFI_STATUS status;
+
+    // the disk is busy, so is the UART if there's any output queued
+    if (block) {
+      console_poll();
+      status = WaitForSingleEvent(req->token.Event, 0);
+      block = FALSE;
+    } else {
+      status = uefi_call_wrapper(BS->CheckEvent, 1, req->token.Event);
+      if (status == EFI_NOT_READY) {
+        console_poll();
+        return;
+      }
+    }
+    if (EFI_ERROR(status) || EFI_ERROR(req->token.TransactionStatus)) {
+      r->status = EFI_ERROR(status) ? status : req->token.TransactionStatus;
+      Print(L"[ERROR] blkio_reap: read failed: %a\n",
+            get_efi_status_string(r->status));
+    }
+    r->done = req->end;
+    r->head = (r->head + 1) % BLKIO_QUEUE_DEPTH;
+    r->inflight--;
+  }
+}
+
+UINTN blkio_poll(struct blkio_reader *r) {
+  blkio_reap(r, FALSE);
+  blkio_fill(r);
+  return r->done;
+}
+
+EFI_STATUS blkio_wait(struct blkio_reader *r, UINTN pos) {
+  if (pos > r->total) {
+    return EFI_INVALID_PARAMETER;
+  }
+  for (;;) {
+    blkio_poll(r);
+    if (EFI_ERROR(r->status) || r->done >= pos) {
+      return r->status;
+    }
+    blkio_reap(r, TRUE);
+  }
+}
+
+void blkio_close(struct blkio_reader *r) {
+  // the firmware still owns the tokens of requests in flight
+  blkio_reap(r, FALSE);
+  while (r->inflight > 0) {
+    blkio_reap(r, TRUE);
+  }
+  if (r->bio2) {
+    for (UINTN i = 0; i < BLKIO_QUEUE_DEPTH; i++) {
+      uefi_call_wrapper(BS->CloseEvent, 1, r->requests[i].token.Event);
+    }
+  }
+  if (r->segments) {
+    FreePool(r->segments);
+  }
+}
+
+EFI_STATUS blkio_read(EFI_HANDLE handle, EFI_LBA lba, void *dest, UINTN size) {
+  struct blkio_reader r;
+  EFI_STATUS status = blkio_init(&r, handle, 1);
+  if (!EFI_ERROR(status)) {
+    status = blkio_wait(&r, blkio_add(&r, lba, dest, size));
+  }
+  blkio_close(&r);
+  return status;
+}
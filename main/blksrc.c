@@ -0,0 +1,430 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "blksrc.h"
+#include "arch.h"
+#include "blkio.h"
+#include "boottime.h"
+#include "core.h"
+#include "mp.h"
+#include "zstd.h"
+
+#include <efigpt.h>
+
+EFI_STATUS blksrc_boot_disk(EFI_HANDLE image, EFI_HANDLE *disk) {
+  EFI_LOADED_IMAGE *loaded;
+  EFI_STATUS status;
+
+  status = uefi_call_wrapper(BS->HandleProtocol, 3, image,
+                             &LoadedImageProtocol, (void **)&loaded);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  EFI_DEVICE_PATH *path = DevicePathFromHandle(loaded->DeviceHandle);
+  if (path == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  // cut the partition node off the ESP's path, what is left is the disk
+  path = DuplicateDevicePath(path);
+  if (path == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  for (EFI_DEVICE_PATH *node = path; !IsDevicePathEnd(node);
+       node = NextDevicePathNode(node)) {
+    if (DevicePathType(node) == MEDIA_DEVICE_PATH &&
+        DevicePathSubType(node) == MEDIA_HARDDRIVE_DP) {
+      SetDevicePathEndNode(node);
+      break;
+    }
+  }
+
+  EFI_DEVICE_PATH *rest = path;
+  status = uefi_call_wrapper(BS->LocateDevicePath, 3, &BlockIoProtocol, &rest,
+                             disk);
+  FreePool(path);
+  return status;
+}
+
+// Read size bytes at lba into a fresh page buffer.
+static EFI_STATUS blksrc_read_pages(EFI_HANDLE handle, EFI_LBA lba, UINTN size,
+                                    EFI_PHYSICAL_ADDRESS *addr) {
+  EFI_STATUS status;
+
+  status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages,
+                             EfiLoaderData, EFI_SIZE_TO_PAGES(size), addr);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  status = blkio_read(handle, lba, (void *)*addr, size);
+  if (EFI_ERROR(status)) {
+    uefi_call_wrapper(BS->FreePages, 2, *addr, EFI_SIZE_TO_PAGES(size));
+  }
+  return status;
+}
+
+// bytes of a GPT header the spec defines, up to PartitionEntryArrayCRC32
+#define GPT_HEADER_SIZE 92
+
+// Read the GPT header at header_lba and its partition entries, checking
+// both CRCs. The entries are left in a page buffer of *size bytes.
+static EFI_STATUS blksrc_read_gpt(EFI_HANDLE disk, EFI_LBA header_lba,
+                                  UINT32 block_size,
+                                  EFI_PARTITION_TABLE_HEADER *gpt,
+                                  EFI_PHYSICAL_ADDRESS *entries, UINTN *size) {
+  EFI_PHYSICAL_ADDRESS addr;
+  UINT32 crc;
+  EFI_STATUS status = blksrc_read_pages(disk, header_lba, block_size, &addr);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  EFI_PARTITION_TABLE_HEADER *h = (EFI_PARTITION_TABLE_HEADER *)addr;
+  *gpt = *h;
+  status = EFI_NOT_FOUND;
+  if (CompareMem(&gpt->Header.Signature, EFI_PTAB_HEADER_ID, 8) == 0 &&
+      gpt->Header.HeaderSize >= GPT_HEADER_SIZE &&
+      gpt->Header.HeaderSize <= block_size) {
+    // the CRC is taken with its own field zeroed
+    h->Header.CRC32 = 0;
+    status = uefi_call_wrapper(BS->CalculateCrc32, 3, h,
+                               gpt->Header.HeaderSize, &crc);
+    if (!EFI_ERROR(status) &&
+        (crc != gpt->Header.CRC32 || gpt->MyLBA != header_lba)) {
+      status = EFI_CRC_ERROR;
+    }
+  }
+  uefi_call_wrapper(BS->FreePages, 2, addr, EFI_SIZE_TO_PAGES(block_size));
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  if (gpt->NumberOfPartitionEntries == 0 ||
+      gpt->SizeOfPartitionEntry < sizeof(EFI_PARTITION_ENTRY)) {
+    return EFI_NOT_FOUND;
+  }
+
+  *size = (UINTN)gpt->NumberOfPartitionEntries * gpt->SizeOfPartitionEntry;
+  status = blksrc_read_pages(disk, gpt->PartitionEntryLBA, *size, entries);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  status = uefi_call_wrapper(BS->CalculateCrc32, 3, (void *)*entries, *size,
+                             &crc);
+  if (!EFI_ERROR(status) && crc != gpt->PartitionEntryArrayCRC32) {
+    status = EFI_CRC_ERROR;
+  }
+  if (EFI_ERROR(status)) {
+    uefi_call_wrapper(BS->FreePages, 2, *entries, EFI_SIZE_TO_PAGES(*size));
+  }
+  return status;
+}
+
+// The partition handle whose device path names the GPT partition unique.
+static EFI_HANDLE blksrc_partition_handle(const EFI_GUID *unique) {
+  EFI_HANDLE *handles, found = NULL;
+  UINTN nr_handles;
+
+  if (EFI_ERROR(LibLocateHandle(ByProtocol, &BlockIoProtocol, NULL,
+                                &nr_handles, &handles))) {
+    return NULL;
+  }
+  for (UINTN i = 0; i < nr_handles && found == NULL; i++) {
+    EFI_DEVICE_PATH *node = DevicePathFromHandle(handles[i]);
+    for (; node != NULL && !IsDevicePathEnd(node);
+         node = NextDevicePathNode(node)) {
+      HARDDRIVE_DEVICE_PATH *hd = (HARDDRIVE_DEVICE_PATH *)node;
+      if (DevicePathType(node) == MEDIA_DEVICE_PATH &&
+          DevicePathSubType(node) == MEDIA_HARDDRIVE_DP &&
+          hd->SignatureType == SIGNATURE_TYPE_GUID &&
+          CompareMem(hd->Signature, unique, sizeof(*unique)) == 0) {
+        found = handles[i];
+        break;
+      }
+    }
+  }
+  FreePool(handles);
+  return found;
+}
+
+EFI_STATUS blksrc_find_partition(EFI_HANDLE disk, EFI_HANDLE *handle,
+                                 EFI_LBA *lba) {
+  EFI_GUID type = BLKSRC_PARTITION_TYPE_GUID;
+  EFI_PHYSICAL_ADDRESS addr;
+  EFI_BLOCK_IO *bio;
+  EFI_STATUS status;
+
+  status = uefi_call_wrapper(BS->HandleProtocol, 3, disk, &BlockIoProtocol,
+                             (void **)&bio);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  UINT32 block_size = bio->Media->BlockSize;
+  EFI_PARTITION_TABLE_HEADER gpt;
+  UINTN size;
+  status = blksrc_read_gpt(disk, PRIMARY_PART_HEADER_LBA, block_size, &gpt,
+                           &addr, &size);
+  if (EFI_ERROR(status)) {
+    // the backup header sits in the last block of the disk
+    Print(L"[WARN] blksrc_find_partition: primary GPT unusable (%a), trying "
+          L"the backup\n",
+          get_efi_status_string(status));
+    status = blksrc_read_gpt(disk, bio->Media->LastBlock, block_size, &gpt,
+                             &addr, &size);
+  }
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  status = EFI_NOT_FOUND;
+  for (UINT32 i = 0; i < gpt.NumberOfPartitionEntries; i++) {
+    const EFI_PARTITION_ENTRY *p =
+        (const EFI_PARTITION_ENTRY *)(addr + i * gpt.SizeOfPartitionEntry);
+    if (CompareGuid((EFI_GUID *)&p->PartitionTypeGUID, &type) != 0) {
+      continue;
+    }
+    // whole partition reads skip the disk offset math in the firmware
+    *handle = blksrc_partition_handle(&p->UniquePartitionGUID);
+    *lba = 0;
+    if (*handle == NULL) {
+      *handle = disk;
+      *lba = p->StartingLBA;
+    }
+    Print(L"[INFO] blksrc_find_partition: payload partition %d at lba 0x%lx, "
+          L"%a handle\n",
+          i + 1, p->StartingLBA, *handle == disk ? "disk" : "partition");
+    status = EFI_SUCCESS;
+    break;
+  }
+  uefi_call_wrapper(BS->FreePages, 2, addr, EFI_SIZE_TO_PAGES(size));
+  return status;
+}
+
+EFI_STATUS blksrc_open(struct blksrc *s, EFI_HANDLE handle, EFI_LBA lba) {
+  EFI_BLOCK_IO *bio;
+  EFI_STATUS status;
+
+  ZeroMem(s, sizeof(*s));
+  s->handle = handle;
+  s->lba = lba;
+
+  status = uefi_call_wrapper(BS->HandleProtocol, 3, handle, &BlockIoProtocol,
+                             (void **)&bio);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  // blobs must start on a block boundary to be read in place
+  s->block_size = bio->Media->BlockSize;
+  if (s->block_size == 0 || CONTAINER_BLOB_ALIGN % s->block_size) {
+    return EFI_UNSUPPORTED;
+  }
+
+  EFI_PHYSICAL_ADDRESS addr;
+  status = blksrc_read_pages(handle, lba, s->block_size, &addr);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  struct container_header hdr = *(struct container_header *)addr;
+  uefi_call_wrapper(BS->FreePages, 2, addr, EFI_SIZE_TO_PAGES(s->block_size));
+  if (hdr.magic != CONTAINER_MAGIC || hdr.image_size < sizeof(hdr)) {
+    return EFI_NOT_FOUND;
+  }
+  if (lba > bio->Media->LastBlock ||
+      hdr.image_size > (bio->Media->LastBlock + 1 - lba) * s->block_size) {
+    Print(L"[ERROR] blksrc_open: container of 0x%lx bytes doesn't fit\n",
+          hdr.image_size);
+    return EFI_VOLUME_FULL;
+  }
+
+  // the blobs are read into the same buffer right behind the toc, so
+  // in-place entries resolve exactly as in the embedded container
+  s->pages = EFI_SIZE_TO_PAGES(ALIGN_UP(hdr.image_size, s->block_size));
+  status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages,
+                             EfiLoaderData, s->pages, &addr);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  s->container = (struct container_header *)addr;
+
+  UINT64 toc_size = hdr.header_size + (UINT64)hdr.nr_entries * hdr.entry_size;
+  status = toc_size > hdr.image_size
+               ? EFI_COMPROMISED_DATA
+               : blkio_read(handle, lba, s->container, toc_size);
+  if (!EFI_ERROR(status)) {
+    status = container_check(s->container, hdr.image_size);
+  }
+  if (EFI_ERROR(status)) {
+    uefi_call_wrapper(BS->FreePages, 2, addr, s->pages);
+    s->container = NULL;
+    s->pages = 0;
+  }
+  return status;
+}
+
+// Decode a zstd payload a batch of frames at a time, starting as soon as
+// enough frames for every worker have arrived.
+static EFI_STATUS blksrc_load_zstd(struct blkio_reader *r, const UINT8 *blob,
+                                   UINTN start,
+                                   const struct container_entry *e) {
+  const struct zstd_payload_header *zh =
+      (const struct zstd_payload_header *)blob;
+  void *dest = (void *)e->load_addr;
+  EFI_STATUS status;
+
+  status = blkio_wait(r, start + sizeof(*zh));
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  if (zstd_payload_content_size(blob, e->stored_size) != e->size) {
+    return EFI_COMPROMISED_DATA;
+  }
+  status = blkio_wait(r, start + sizeof(*zh) +
+                             zh->nr_frames * sizeof(zh->frames[0]));
+
+  UINTN batch = mp_worker_count();
+  UINTN first = 0;
+  while (!EFI_ERROR(status) && first < zh->nr_frames) {
+    UINTN last = first + batch - 1;
+    if (last >= zh->nr_frames) {
+      last = zh->nr_frames - 1;
+    }
+    const struct zstd_payload_frame *f = &zh->frames[last];
+    if (f->src_offset + f->src_size > e->stored_size) {
+      return EFI_COMPROMISED_DATA;
+    }
+    status = blkio_wait(r, start + f->src_offset + f->src_size);
+    if (EFI_ERROR(status)) {
+      break;
+    }
+
+    // take whatever else has already landed as well
+    UINTN arrived = blkio_poll(r) - start;
+    while (last + 1 < zh->nr_frames &&
+           zh->frames[last + 1].src_offset + zh->frames[last + 1].src_size <=
+               arrived) {
+      last++;
+    }
+    status = zstd_payload_decompress_frames(dest, e->size, blob,
+                                            e->stored_size, first,
+                                            last + 1 - first);
+    first = last + 1;
+  }
+  return status;
+}
+
+// raw entries that can be read straight to their load address
+static BOOLEAN blksrc_direct(const struct blkio_reader *r,
+                             const struct container_entry *e) {
+  return e->codec == CONTAINER_CODEC_NONE && e->load_addr != 0 &&
+         e->load_addr % r->io_align == 0;
+}
+
+EFI_STATUS blksrc_load(struct blksrc *s) {
+  struct container_header *hdr = s->container;
+  struct blkio_reader r;
+  EFI_STATUS status;
+
+  UINTN *start = AllocatePool(hdr->nr_entries * 2 * sizeof(UINTN));
+  if (start == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  UINTN *end = start + hdr->nr_entries;
+
+  // the toc is only known once the buffer is allocated, which the firmware
+  // may have placed over a load region
+  UINTN buf_start = (UINTN)hdr;
+  UINTN buf_end = buf_start + s->pages * EFI_PAGE_SIZE;
+  status = container_place(hdr);
+  if (EFI_ERROR(status)) {
+    FreePool(start);
+    return status;
+  }
+  for (UINT32 i = 0; i < hdr->nr_entries; i++) {
+    const struct container_entry *e = container_entry(hdr, i);
+    status = e->load_addr != 0 ? container_reserve(e) : EFI_SUCCESS;
+    if (EFI_ERROR(status)) {
+      FreePool(start);
+      return status;
+    }
+    if (e->load_addr != 0 && e->load_addr < buf_end &&
+        e->load_addr + e->size > buf_start) {
+      Print(L"[ERROR] blksrc_load: %a at 0x%lx overlaps the read buffer\n",
+            e->name, e->load_addr);
+      FreePool(start);
+      return EFI_OUT_OF_RESOURCES;
+    }
+  }
+
+  status = blkio_init(&r, s->handle, 2 * hdr->nr_entries);
+  if (EFI_ERROR(status)) {
+    FreePool(start);
+    return status;
+  }
+
+  // Raw entries go straight to their load address except for the last
+  // partial block, which is bounced through the buffer so the read doesn't
+  // spill past the end of the payload. Everything else lands in the buffer.
+  for (UINT32 i = 0; i < hdr->nr_entries; i++) {
+    const struct container_entry *e = container_entry(hdr, i);
+    EFI_LBA lba = s->lba + e->offset / s->block_size;
+    UINT8 *buf = (UINT8 *)hdr + e->offset;
+
+    start[i] = r.total;
+    if (blksrc_direct(&r, e)) {
+      UINTN body = ALIGN_DOWN(e->size, s->block_size);
+      blkio_add(&r, lba, (void *)e->load_addr, body);
+      end[i] = blkio_add(&r, lba + body / s->block_size, buf + body,
+                         e->size - body);
+    } else {
+      end[i] = blkio_add(&r, lba, buf, e->stored_size);
+    }
+  }
+
+  UINT64 t0 = ARCH_READ_COUNTER();
+  for (UINT32 i = 0; i < hdr->nr_entries && !EFI_ERROR(status); i++) {
+    const struct container_entry *e = container_entry(hdr, i);
+    const UINT8 *buf = (const UINT8 *)hdr + e->offset;
+    UINT64 t = ARCH_READ_COUNTER();
+    UINTN cpus = 1;
+
+    if (e->codec == CONTAINER_CODEC_ZSTD) {
+      status = blksrc_load_zstd(&r, buf, start[i], e);
+      if (!EFI_ERROR(status)) {
+        container_zero(e);
+      }
+      cpus = mp_worker_count();
+    } else {
+      // in-place entries are done once they are in the buffer
+      status = blkio_wait(&r, end[i]);
+      if (!EFI_ERROR(status) && blksrc_direct(&r, e)) {
+        UINTN body = ALIGN_DOWN(e->size, s->block_size);
+        memcpy2((UINT8 *)e->load_addr + body, buf + body, e->size - body);
+        container_zero(e);
+      } else if (!EFI_ERROR(status) && e->load_addr != 0) {
+        status = container_load(hdr, e, &cpus);
+      }
+    }
+    if (!EFI_ERROR(status)) {
+      status = container_verify(hdr, e);
+    }
+    if (EFI_ERROR(status)) {
+      Print(L"[ERROR] blksrc_load: %a failed: %a\n", e->name,
+            get_efi_status_string(status));
+      break;
+    }
+    UINT64 ticks = ARCH_READ_COUNTER() - t;
+    Print(L"[INFO] %a loaded to 0x%lx, size: 0x%lx, %ld MB/s on %d cpus\n",
+          e->name, (UINTN)container_entry_addr(hdr, e), e->size,
+          throughput_mbps(e->size, ticks), cpus);
+    boot_time_mark(e->name);
+  }
+
+  if (!EFI_ERROR(status)) {
+    UINT64 ticks = ARCH_READ_COUNTER() - t0;
+    Print(L"[INFO] blksrc_load: read 0x%lx bytes in %ld us, %ld MB/s, %a\n",
+          r.total, counter_to_us(ticks), throughput_mbps(r.total, ticks),
+          r.bio2 ? "BlockIo2" : "BlockIo");
+  }
+  blkio_close(&r);
+  FreePool(start);
+  return status;
+}
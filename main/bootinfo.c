@@ -0,0 +1,226 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "bootinfo.h"
+#include "arch.h"
+#include "boottime.h"
+#include "core.h"
+#include "memregion.h"
+#include "pgtable.h"
+
+static struct boot_info_payload payloads[BOOT_INFO_MAX_PAYLOADS];
+static UINT32 nr_payloads;
+static UINT64 rsdp, dtb, boot_cpu, frequency;
+#if defined(CONFIG_PAGE_TABLES)
+static UINT64 pgtable_pool;
+#endif
+
+// write position in the block, the end record always has room
+static UINT8 *cur, *limit;
+
+void boot_info_add_payload(const struct boot_info_payload *p) {
+  if (nr_payloads == BOOT_INFO_MAX_PAYLOADS) {
+    Print(L"[WARN] boot_info_add_payload: no room for %a\n", p->name);
+    return;
+  }
+  payloads[nr_payloads++] = *p;
+}
+
+static UINT64 find_config_table(EFI_SYSTEM_TABLE *st, EFI_GUID guid) {
+  for (UINTN i = 0; i < st->NumberOfTableEntries; i++) {
+    if (CompareGuid(&st->ConfigurationTable[i].VendorGuid, &guid) == 0) {
+      return (UINT64)st->ConfigurationTable[i].VendorTable;
+    }
+  }
+  return 0;
+}
+
+EFI_STATUS boot_info_prepare(EFI_SYSTEM_TABLE *SystemTable,
+                             UINTN boot_cpu_id) {
+  UINTN addr = CONFIG_BOOT_INFO_ADDR;
+  EFI_STATUS status =
+      reserve_payload("boot-info block", &addr, CONFIG_BOOT_INFO_SIZE, 0);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  rsdp = find_config_table(SystemTable, (EFI_GUID)ACPI_20_TABLE_GUID);
+  if (rsdp == 0) {
+    rsdp = find_config_table(SystemTable, (EFI_GUID)ACPI_TABLE_GUID);
+  }
+  dtb = find_config_table(SystemTable, (EFI_GUID)EFI_DTB_TABLE_GUID);
+  boot_cpu = boot_cpu_id;
+  frequency = ARCH_COUNTER_FREQ();
+#if defined(CONFIG_PAGE_TABLES)
+  pgtable_pool = pgtable_prepare();
+#endif
+  Print(L"[INFO] boot_info_prepare: block at 0x%lx, rsdp 0x%lx, dtb 0x%lx\n",
+        addr, rsdp, dtb);
+  return EFI_SUCCESS;
+}
+
+// Start a record of length bytes, NULL if it doesn't fit. Only the padding
+// is cleared, the data may already be in place.
+static void *record(UINT32 type, UINTN length) {
+  UINTN need = sizeof(struct boot_info_record) + ALIGN_UP(length, 8);
+  if (need > (UINTN)(limit - cur)) {
+    return NULL;
+  }
+  struct boot_info_record *r = (struct boot_info_record *)cur;
+  r->type = type;
+  r->length = length;
+  memzero((UINT8 *)(r + 1) + length, ALIGN_UP(length, 8) - length);
+  cur += need;
+  return r + 1;
+}
+
+// Build the region table straight into the block, the loader's own data
+// is carved out of the usable memory so hvisor doesn't hand it out.
+// Returns the table, NULL if it doesn't fit.
+static struct boot_info_region *record_regions(EFI_MEMORY_DESCRIPTOR *map,
+                                               UINTN map_size,
+                                               UINTN desc_size, UINTN *nr) {
+  struct boot_info_region carve[BOOT_INFO_MAX_PAYLOADS + 3];
+  UINTN nr_carve = 0;
+
+  for (UINT32 i = 0; i < nr_payloads; i++) {
+    if (payloads[i].size + payloads[i].zero_size != 0) {
+      carve[nr_carve++] = (struct boot_info_region){
+          arch_phys_addr(payloads[i].addr),
+          payloads[i].size + payloads[i].zero_size, BOOT_INFO_REGION_PAYLOAD,
+          0};
+    }
+  }
+#if defined(CONFIG_PAGE_TABLES)
+  if (pgtable_pool != 0) {
+    carve[nr_carve++] = (struct boot_info_region){
+        pgtable_pool, CONFIG_PAGE_TABLES_SIZE, BOOT_INFO_REGION_HANDOFF, 0};
+  }
+#endif
+  carve[nr_carve++] = (struct boot_info_region){
+      CONFIG_BOOT_INFO_ADDR, CONFIG_BOOT_INFO_SIZE, BOOT_INFO_REGION_HANDOFF,
+      0};
+  if (CONFIG_BOOT_TIME_ADDR != 0) {
+    carve[nr_carve++] = (struct boot_info_region){
+        CONFIG_BOOT_TIME_ADDR, sizeof(struct boot_time_table),
+        BOOT_INFO_REGION_HANDOFF, 0};
+  }
+
+  UINTN room = limit - cur;
+  if (room <= sizeof(struct boot_info_record)) {
+    return NULL;
+  }
+  *nr = mem_regions_build(
+      (struct boot_info_region *)(cur + sizeof(struct boot_info_record)),
+      (room - sizeof(struct boot_info_record)) /
+          sizeof(struct boot_info_region),
+      map, map_size, desc_size, carve, nr_carve);
+  if (*nr == 0) {
+    print_str("[WARN] boot_info_finish: region table doesn't fit\n");
+    return NULL;
+  }
+  return record(BOOT_INFO_REGIONS, *nr * sizeof(struct boot_info_region));
+}
+
+#if defined(CONFIG_PAGE_TABLES)
+static void record_page_tables(const struct boot_info_region *regions,
+                               UINTN nr) {
+  struct boot_info_page_tables pt;
+  EFI_STATUS status = pgtable_build(regions, nr, payloads, nr_payloads, &pt);
+  if (EFI_ERROR(status)) {
+    print_str("[WARN] boot_info_finish: no page tables: ");
+    print_str(get_efi_status_string(status));
+    print_str("\n");
+    return;
+  }
+  struct boot_info_page_tables *p = record(BOOT_INFO_PAGE_TABLES, sizeof(pt));
+  if (p != NULL) {
+    *p = pt;
+  }
+}
+#endif
+
+static void record_u64(UINT32 type, UINT64 value) {
+  UINT64 *p = record(type, sizeof(value));
+  if (p != NULL) {
+    *p = value;
+  }
+}
+
+UINTN boot_info_finish(void) {
+  struct boot_info_header *hdr =
+      (struct boot_info_header *)CONFIG_BOOT_INFO_ADDR;
+
+  cur = (UINT8 *)(hdr + 1);
+  limit = (UINT8 *)hdr + CONFIG_BOOT_INFO_SIZE -
+          sizeof(struct boot_info_record);
+
+  UINTN map_size, desc_size;
+  UINT32 desc_version;
+  EFI_MEMORY_DESCRIPTOR *map =
+      boot_memory_map(&map_size, &desc_size, &desc_version);
+  if (map != NULL) {
+    struct boot_info_memory_map *m =
+        record(BOOT_INFO_MEMORY_MAP, sizeof(*m) + map_size);
+    if (m != NULL) {
+      m->desc_size = desc_size;
+      m->desc_version = desc_version;
+      memcpy2(m + 1, map, map_size);
+    } else {
+      print_str("[WARN] boot_info_finish: memory map doesn't fit\n");
+    }
+    UINTN nr_regions;
+    struct boot_info_region *regions =
+        record_regions(map, map_size, desc_size, &nr_regions);
+#if defined(CONFIG_PAGE_TABLES)
+    if (regions != NULL) {
+      record_page_tables(regions, nr_regions);
+    }
+#else
+    (void)regions;
+#endif
+  }
+  if (rsdp != 0) {
+    record_u64(BOOT_INFO_ACPI_RSDP, rsdp);
+  }
+  if (dtb != 0) {
+    record_u64(BOOT_INFO_DTB, dtb);
+  }
+  record_u64(BOOT_INFO_BOOT_CPU, boot_cpu);
+  record_u64(BOOT_INFO_COUNTER_FREQ, frequency);
+  for (UINT32 i = 0; i < nr_payloads; i++) {
+    struct boot_info_payload *p = record(BOOT_INFO_PAYLOAD, sizeof(*p));
+    if (p != NULL) {
+      *p = payloads[i];
+    }
+  }
+  struct boot_time_table *t =
+      record(BOOT_INFO_BOOT_TIME, sizeof(struct boot_time_table));
+  if (t != NULL) {
+    *t = *boot_time_table();
+  }
+
+  // the log takes whatever room is left, the oldest bytes are cut
+  UINTN room = limit - cur;
+  if (room > sizeof(struct boot_info_record)) {
+    room = ALIGN_DOWN(room - sizeof(struct boot_info_record), 8);
+    UINTN n = console_history((char *)cur + sizeof(struct boot_info_record),
+                              room);
+    if (n > 0) {
+      record(BOOT_INFO_LOG, n);
+    }
+  }
+
+  struct boot_info_record *end = (struct boot_info_record *)cur;
+  end->type = BOOT_INFO_END;
+  end->length = 0;
+  cur += sizeof(*end);
+
+  hdr->magic = BOOT_INFO_MAGIC;
+  hdr->version = BOOT_INFO_VERSION;
+  hdr->size = cur - (UINT8 *)hdr;
+  ARCH_SYNC_RANGE(hdr, hdr->size);
+  return (UINTN)hdr;
+}
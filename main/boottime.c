@@ -0,0 +1,107 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "boottime.h"
+#include "arch.h"
+#include "core.h"
+
+static struct boot_time_table table = {
+    .magic = BOOT_TIME_MAGIC,
+    .version = BOOT_TIME_VERSION,
+};
+
+void boot_time_mark(const char *name) {
+  if (arch_ops == NULL || table.nr_marks == BOOT_TIME_MAX_MARKS) {
+    return;
+  }
+  struct boot_time_mark *m = &table.marks[table.nr_marks++];
+  m->counter = ARCH_READ_COUNTER();
+  UINTN i = 0;
+  for (; i < BOOT_TIME_NAME_LEN - 1 && name[i]; i++) {
+    m->name[i] = name[i];
+  }
+  m->name[i] = 0;
+}
+
+EFI_STATUS boot_time_prepare(void) {
+  // riscv64 may calibrate against Stall(), not possible once boot services
+  // are gone
+  table.frequency = ARCH_COUNTER_FREQ();
+
+#if CONFIG_BOOT_TIME_ADDR != 0
+  UINTN addr = CONFIG_BOOT_TIME_ADDR;
+  return reserve_payload("boot time table", &addr, sizeof(table), 0);
+#else
+  return EFI_SUCCESS;
+#endif
+}
+
+const struct boot_time_table *boot_time_table(void) { return &table; }
+
+static UINT64 ticks_to_us(UINT64 ticks) {
+  UINT64 freq = table.frequency;
+  if (freq == 0) {
+    return 0;
+  }
+  return ticks / freq * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
+// append s padded with spaces to width, left aligned
+static char *put_str(char *p, const char *s, UINTN width) {
+  UINTN i = 0;
+  for (; s[i]; i++) {
+    *p++ = s[i];
+  }
+  for (; i < width; i++) {
+    *p++ = ' ';
+  }
+  return p;
+}
+
+// append v right aligned in width characters
+static char *put_dec(char *p, UINT64 v, UINTN width) {
+  char digits[20];
+  UINTN n = 0;
+
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  for (; width > n; width--) {
+    *p++ = ' ';
+  }
+  while (n) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+// one line per print_str() so CONSOLE_QUIET filters whole lines
+static void print_row(const char *name, UINT64 us, BOOLEAN header) {
+  char line[96];
+  char *p = put_str(line, "[INFO] boot_time: ", 0);
+  p = put_str(p, name, BOOT_TIME_NAME_LEN);
+  p = header ? put_str(p, "        us", 0) : put_dec(p, us, 10);
+  *p++ = '\n';
+  *p = 0;
+  print_str(line);
+}
+
+void boot_time_report(void) {
+  UINT64 prev = 0;
+
+  print_row("phase", 0, TRUE);
+  for (UINT32 i = 0; i < table.nr_marks; i++) {
+    const struct boot_time_mark *m = &table.marks[i];
+    print_row(m->name, ticks_to_us(m->counter - prev), FALSE);
+    prev = m->counter;
+  }
+  print_row("total", ticks_to_us(prev), FALSE);
+
+#if CONFIG_BOOT_TIME_ADDR != 0
+  memcpy2((void *)CONFIG_BOOT_TIME_ADDR, &table, sizeof(table));
+  ARCH_SYNC_RANGE((void *)CONFIG_BOOT_TIME_ADDR, sizeof(table));
+#endif
+}
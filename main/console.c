@@ -0,0 +1,312 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "console.h"
+#include "arch.h"
+
+#if CONFIG_CONSOLE_RING_SIZE & (CONFIG_CONSOLE_RING_SIZE - 1)
+#error "CONFIG_CONSOLE_RING_SIZE must be a power of two"
+#endif
+
+#define RING_SIZE CONFIG_CONSOLE_RING_SIZE
+
+#if CONFIG_BOOT_INFO_LOG_SIZE & (CONFIG_BOOT_INFO_LOG_SIZE - 1)
+#error "CONFIG_BOOT_INFO_LOG_SIZE must be a power of two"
+#endif
+
+#define HISTORY_SIZE CONFIG_BOOT_INFO_LOG_SIZE
+
+#if HISTORY_SIZE > 0
+static char history[HISTORY_SIZE];
+static UINTN history_len; // free running, the last HISTORY_SIZE are kept
+
+static void history_add(const char *s, UINTN n) {
+  while (n--) {
+    history[history_len++ & (HISTORY_SIZE - 1)] = *s++;
+  }
+}
+
+UINTN console_history(char *dest, UINTN size) {
+  UINTN n = history_len < HISTORY_SIZE ? history_len : HISTORY_SIZE;
+  if (n > size) {
+    n = size;
+  }
+  for (UINTN i = 0, at = history_len - n; i < n; i++, at++) {
+    dest[i] = history[at & (HISTORY_SIZE - 1)];
+  }
+  return n;
+}
+#else
+static void history_add(const char *s, UINTN n) {}
+UINTN console_history(char *dest, UINTN size) { return 0; }
+#endif
+
+#if RING_SIZE > 0
+static char ring[RING_SIZE];
+// free running, head - tail bytes are queued
+static UINTN head, tail;
+
+static BOOLEAN console_buffered(void) {
+  return arch_ops != NULL && arch_ops->serial.tx_room != NULL;
+}
+
+static void drain(void) {
+  UINTN room = ARCH_TX_ROOM();
+
+  while (room > 0 && tail != head) {
+    UINTN at = tail & (RING_SIZE - 1);
+    UINTN n = head - tail;
+    if (n > RING_SIZE - at) {
+      n = RING_SIZE - at; // up to the wrap, the rest in the next round
+    }
+    if (n > room) {
+      n = room;
+    }
+    ARCH_TX_BURST(&ring[at], n);
+    tail += n;
+    room -= n;
+  }
+}
+#else
+static BOOLEAN console_buffered(void) { return FALSE; }
+static void drain(void) {}
+#endif
+
+void console_write(const char *s, UINTN n) {
+  history_add(s, n);
+  if (arch_ops == NULL) {
+    return;
+  }
+  if (!console_buffered()) {
+    while (n--) {
+      ARCH_PUT_CHAR(*s++);
+    }
+    return;
+  }
+
+#if RING_SIZE > 0
+  while (n > 0) {
+    // a full ring is the only place the cpu waits for the UART
+    while (head - tail == RING_SIZE) {
+      drain();
+    }
+    UINTN at = head & (RING_SIZE - 1);
+    UINTN len = RING_SIZE - (head - tail);
+    if (len > RING_SIZE - at) {
+      len = RING_SIZE - at;
+    }
+    if (len > n) {
+      len = n;
+    }
+    for (UINTN i = 0; i < len; i++) {
+      ring[at + i] = s[i];
+    }
+    head += len;
+    s += len;
+    n -= len;
+  }
+  drain();
+#endif
+}
+
+void console_poll(void) {
+  if (console_buffered()) {
+    drain();
+  }
+}
+
+void console_flush(void) {
+#if RING_SIZE > 0
+  while (console_buffered() && tail != head) {
+    drain();
+  }
+#endif
+}
+
+#if defined(CONFIG_CONSOLE_QUIET) ||                                          \
+    (HISTORY_SIZE > 0 && !defined(CONFIG_CONSOLE_TOKENIZED))
+#undef Print
+
+// Print() for CONSOLE_QUIET builds and builds keeping a log: the firmware
+// console is slow, drop everything but errors under CONSOLE_QUIET, and
+// keep a copy of every line in the history.
+UINTN console_print(const CHAR16 *fmt, ...) {
+  va_list args;
+  UINTN ret;
+
+#if HISTORY_SIZE > 0
+  // formatted once, the same text goes to the history and the console
+  CHAR16 text[256];
+  va_start(args, fmt);
+  ret = UnicodeVSPrint(text, sizeof(text), fmt, args);
+  va_end(args);
+  for (UINTN i = 0; text[i]; i++) {
+    char c = text[i] < 0x80 ? (char)text[i] : '?';
+    history_add(&c, 1);
+  }
+#endif
+
+#if defined(CONFIG_CONSOLE_QUIET)
+  static const CHAR16 error[] = L"[ERROR]";
+  for (UINTN i = 0; i < sizeof(error) / sizeof(error[0]) - 1; i++) {
+    if (fmt[i] != error[i]) {
+      return 0;
+    }
+  }
+#endif
+#if HISTORY_SIZE > 0
+  // the rare line that didn't fit is printed in full, the log keeps the
+  // cut one
+  if (ret < sizeof(text) / sizeof(text[0]) - 1) {
+    uefi_call_wrapper(ST->ConOut->OutputString, 2, ST->ConOut, text);
+    return ret;
+  }
+#endif
+  va_start(args, fmt);
+  ret = VPrint(fmt, args);
+  va_end(args);
+  return ret;
+}
+#endif
+
+#if defined(CONFIG_CONSOLE_TOKENIZED)
+#undef Print
+
+// start of the .log_fmt section, see main/log_fmt.lds
+extern const CHAR16 __log_fmt_start[] __attribute__((visibility("hidden")));
+
+// LEB128, small values are one byte
+static void log_varint(UINT64 v) {
+  char buf[10];
+  UINTN n = 0;
+
+  do {
+    buf[n] = v & 0x7f;
+    v >>= 7;
+    if (v) {
+      buf[n] |= 0x80;
+    }
+    n++;
+  } while (v);
+  console_write(buf, n);
+}
+
+static void log_signed(INT64 v) {
+  log_varint(((UINT64)v << 1) ^ (UINT64)(v >> 63));
+}
+
+// NUL terminated, UCS-2 is cut down to its low byte
+static void log_string(const CHAR8 *a, const CHAR16 *w) {
+  static const char null[] = "(null)";
+  char c = 0;
+
+  if (a == NULL && w == NULL) {
+    console_write(null, sizeof(null));
+    return;
+  }
+  for (UINTN i = 0;; i++) {
+    c = a != NULL ? (char)a[i] : (char)w[i];
+    console_write(&c, 1);
+    if (c == 0) {
+      break;
+    }
+  }
+}
+
+// Print() for CONSOLE_TOKENIZED builds. A record is CONSOLE_RECORD, the
+// varint offset of fmt in .log_fmt in CHAR16 units, then one field per
+// argument fmt takes, walked the way gnu-efi's _Print() does: integers as
+// varints (zigzag for %d), %a/%s as NUL terminated bytes, %g and %t as raw
+// structs, %f as a raw double.
+UINTN console_log(const CHAR16 *fmt, ...) {
+  char record = CONSOLE_RECORD;
+  va_list args;
+
+  va_start(args, fmt);
+  if (arch_ops == NULL) {
+    // no UART yet, nothing to tokenize for
+    UINTN ret = VPrint(fmt, args);
+    va_end(args);
+    return ret;
+  }
+
+  console_write(&record, 1);
+  log_varint(fmt - __log_fmt_start);
+  for (const CHAR16 *p = fmt; *p; p++) {
+    if (*p != '%') {
+      continue;
+    }
+    BOOLEAN is_long = FALSE, done = FALSE;
+    while (!done && p[1]) {
+      CHAR16 c = *++p;
+      done = TRUE;
+      switch (c) {
+      case '*':
+        log_varint(va_arg(args, UINTN));
+        done = FALSE;
+        break;
+      case 'l':
+        is_long = TRUE;
+        done = FALSE;
+        break;
+      case '0' ... '9':
+      case '-':
+      case ',':
+      case '.':
+      case 'n':
+      case 'h':
+      case 'e':
+        done = FALSE;
+        break;
+      case 'a':
+        log_string(va_arg(args, CHAR8 *), NULL);
+        break;
+      case 's': {
+        CHAR16 *w = va_arg(args, CHAR16 *);
+        log_string(NULL, w);
+        break;
+      }
+      case 'D': {
+        CHAR16 *w = DevicePathToStr(va_arg(args, EFI_DEVICE_PATH *));
+        log_string(NULL, w);
+        if (w != NULL) {
+          FreePool(w);
+        }
+        break;
+      }
+      case 'c':
+      case 'r':
+        log_varint(va_arg(args, UINTN));
+        break;
+      case 'x':
+      case 'X':
+      case 'u':
+        log_varint(is_long ? va_arg(args, UINT64) : va_arg(args, UINT32));
+        break;
+      case 'd':
+        log_signed(is_long ? va_arg(args, INT64) : va_arg(args, INT32));
+        break;
+      case 'g':
+        console_write((const char *)va_arg(args, EFI_GUID *),
+                      sizeof(EFI_GUID));
+        break;
+      case 't':
+        console_write((const char *)va_arg(args, EFI_TIME *),
+                      sizeof(EFI_TIME));
+        break;
+      case 'f': {
+        double f = va_arg(args, double);
+        console_write((const char *)&f, sizeof(f));
+        break;
+      }
+      default: // %%, attributes and unknown conversions take nothing
+        break;
+      }
+    }
+  }
+  va_end(args);
+  return 0;
+}
+#endif
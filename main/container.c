@@ -0,0 +1,289 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "container.h"
+#include "arch.h"
+#include "core.h"
+#include "fdt.h"
+#include "generated/autoconf.h"
+#include "lz4.h"
+#include "mp.h"
+#include "place.h"
+#include "sha256.h"
+#include "zboot.h"
+#include "zstd.h"
+
+EFI_STATUS container_check(const struct container_header *hdr, UINTN size) {
+  if (size < sizeof(*hdr) || hdr->magic != CONTAINER_MAGIC) {
+    return EFI_UNSUPPORTED;
+  }
+  if (hdr->version != CONTAINER_VERSION) {
+    Print(L"[ERROR] container_check: version %d, expected %d\n", hdr->version,
+          CONTAINER_VERSION);
+    return EFI_INCOMPATIBLE_VERSION;
+  }
+  // newer packers may append fields to the header and the entries
+  if (hdr->header_size < sizeof(*hdr) ||
+      hdr->entry_size < sizeof(struct container_entry) ||
+      hdr->image_size > size ||
+      hdr->header_size + (UINT64)hdr->nr_entries * hdr->entry_size >
+          hdr->image_size) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  for (UINT32 i = 0; i < hdr->nr_entries; i++) {
+    const struct container_entry *e = container_entry(hdr, i);
+    BOOLEAN compressed = e->codec != CONTAINER_CODEC_NONE;
+
+    if (e->offset % CONTAINER_BLOB_ALIGN || e->offset > hdr->image_size ||
+        e->stored_size > hdr->image_size - e->offset ||
+        e->codec > CONTAINER_CODEC_ZBOOT ||
+        (!compressed && e->stored_size != e->size) ||
+        (compressed && e->load_addr == 0) ||
+        (e->align & (e->align - 1)) ||
+        (e->align && e->load_addr % e->align) ||
+        (e->load_addr == 0 && (e->zero_size || e->entry)) ||
+        ((e->flags & CONTAINER_FLAG_RELOCATABLE) &&
+         (e->load_addr == 0 || e->kind == CONTAINER_KIND_HVISOR)) ||
+        (e->entry && (e->entry < e->load_addr ||
+                      e->entry - e->load_addr >= e->size + e->zero_size))) {
+      Print(L"[ERROR] container_check: bad toc entry %d (%a)\n", i,
+            container_kind_name(e->kind));
+      return EFI_COMPROMISED_DATA;
+    }
+  }
+  return EFI_SUCCESS;
+}
+
+const struct container_entry *
+container_entry(const struct container_header *hdr, UINT32 index) {
+  return (const struct container_entry *)((const UINT8 *)hdr +
+                                          hdr->header_size +
+                                          (UINTN)index * hdr->entry_size);
+}
+
+const struct container_entry *
+container_find(const struct container_header *hdr, UINT32 kind,
+               UINT32 zone_id) {
+  for (UINT32 i = 0; i < hdr->nr_entries; i++) {
+    const struct container_entry *e = container_entry(hdr, i);
+    if (e->kind == kind && e->zone_id == zone_id) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+void *container_entry_addr(const struct container_header *hdr,
+                           const struct container_entry *e) {
+  if (e->load_addr == 0) {
+    return (UINT8 *)hdr + e->offset;
+  }
+  return (void *)e->load_addr;
+}
+
+// Point a relocatable entry at addr, the entry point moves along.
+static void container_move(const struct container_entry *e, UINTN addr) {
+  // the toc sits in .data or in the block read buffer, both writable
+  struct container_entry *w = (struct container_entry *)e;
+  if (w->entry != 0) {
+    w->entry += addr - w->load_addr;
+  }
+  w->load_addr = addr;
+}
+
+EFI_STATUS container_place(const struct container_header *hdr) {
+#if defined(CONFIG_PAYLOAD_PLACEMENT)
+  struct place_request req[PLACE_MAX_REQUESTS];
+  UINTN nr = 0, movable = 0;
+
+  for (UINT32 i = 0; i < hdr->nr_entries && nr < PLACE_MAX_REQUESTS; i++) {
+    const struct container_entry *e = container_entry(hdr, i);
+    if (e->load_addr == 0) {
+      continue;
+    }
+    BOOLEAN fixed = !(e->flags & CONTAINER_FLAG_RELOCATABLE);
+    req[nr++] = (struct place_request){e->name, arch_phys_addr(e->load_addr),
+                                       e->size + e->zero_size, e->align,
+                                       fixed};
+    movable += !fixed;
+  }
+  if (movable == 0) {
+    return EFI_SUCCESS;
+  }
+
+  UINTN nr_desc, key, desc_size;
+  UINT32 version;
+  EFI_MEMORY_DESCRIPTOR *map =
+      LibMemoryMap(&nr_desc, &key, &desc_size, &version);
+  if (map == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  EFI_STATUS status =
+      place_payloads(req, nr, map, nr_desc * desc_size, desc_size);
+  FreePool(map);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  nr = 0;
+  for (UINT32 i = 0; i < hdr->nr_entries && nr < PLACE_MAX_REQUESTS; i++) {
+    const struct container_entry *e = container_entry(hdr, i);
+    if (e->load_addr == 0 || req[nr++].fixed) {
+      continue;
+    }
+    // keep the DMW window on loongarch
+    UINTN addr = e->load_addr - arch_phys_addr(e->load_addr) + req[nr - 1].addr;
+    Print(L"[INFO] container_place: %a 0x%lx -> 0x%lx\n", e->name,
+          e->load_addr, addr);
+    container_move(e, addr);
+  }
+#endif
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS container_fixup_dtb(const struct container_header *hdr) {
+#if defined(CONFIG_PAYLOAD_PLACEMENT)
+  const struct container_entry *initrd =
+      container_find(hdr, CONTAINER_KIND_ZONE0_INITRD, 0);
+  const struct container_entry *dtb =
+      container_find(hdr, CONTAINER_KIND_ZONE0_DTB, 0);
+  if (initrd == NULL || dtb == NULL) {
+    return EFI_SUCCESS;
+  }
+
+  UINTN start = arch_phys_addr((UINTN)container_entry_addr(hdr, initrd));
+  EFI_STATUS status = fdt_set_initrd(container_entry_addr(hdr, dtb), dtb->size,
+                                     start, start + initrd->size);
+  if (status == EFI_NOT_FOUND) {
+    Print(L"[INFO] container_fixup_dtb: no initrd in /chosen of %a, left "
+          L"alone\n",
+          dtb->name);
+    return EFI_SUCCESS;
+  }
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] container_fixup_dtb: can't point /chosen of %a at 0x%lx: "
+          L"%a\n",
+          dtb->name, start, get_efi_status_string(status));
+    return status;
+  }
+  Print(L"[INFO] container_fixup_dtb: /chosen initrd 0x%lx - 0x%lx\n", start,
+        start + initrd->size);
+#endif
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS container_reserve(const struct container_entry *e) {
+  UINTN addr = e->load_addr;
+  BOOLEAN reloc = e->flags & CONTAINER_FLAG_RELOCATABLE;
+  EFI_STATUS status =
+      reserve_payload(e->name, &addr, e->size + e->zero_size,
+                      reloc ? (e->align ? e->align : EFI_PAGE_SIZE) : 0);
+
+  if (!EFI_ERROR(status) && addr != e->load_addr) {
+    container_move(e, addr);
+  }
+  return status;
+}
+
+EFI_STATUS container_load(const struct container_header *hdr,
+                          const struct container_entry *e, UINTN *cpus) {
+  const UINT8 *blob = (const UINT8 *)hdr + e->offset;
+  void *dest = container_entry_addr(hdr, e);
+  EFI_STATUS status = EFI_SUCCESS;
+  UINTN out;
+
+  *cpus = 1;
+  switch (e->codec) {
+  case CONTAINER_CODEC_NONE:
+    // blobs are page aligned, in-place entries need no copy at all
+    if (e->load_addr != 0) {
+      mp_copy(dest, blob, e->size);
+      *cpus = mp_worker_count();
+    }
+    break;
+  case CONTAINER_CODEC_LZ4:
+    status = lz4_decompress_frame(dest, e->size, blob, e->stored_size, &out);
+    if (!EFI_ERROR(status) && out != e->size) {
+      status = EFI_COMPROMISED_DATA;
+    }
+    break;
+  case CONTAINER_CODEC_ZSTD:
+    if (zstd_payload_content_size(blob, e->stored_size) != e->size) {
+      return EFI_COMPROMISED_DATA;
+    }
+    status = zstd_payload_decompress(dest, e->size, blob, e->stored_size);
+    *cpus = mp_worker_count();
+    break;
+  case CONTAINER_CODEC_ZBOOT:
+    status = zboot_decompress(dest, e->size, blob, e->stored_size, &out);
+    if (!EFI_ERROR(status) && out != e->size) {
+      status = EFI_COMPROMISED_DATA;
+    }
+    break;
+  default:
+    return EFI_UNSUPPORTED;
+  }
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  container_zero(e);
+  return container_verify(hdr, e);
+}
+
+void container_zero(const struct container_entry *e) {
+  if (e->zero_size != 0) {
+    mp_zero((void *)(e->load_addr + e->size), e->zero_size);
+  }
+}
+
+UINTN container_entry_point(const struct container_entry *e) {
+  return e->entry ? e->entry : e->load_addr;
+}
+
+EFI_STATUS container_verify(const struct container_header *hdr,
+                            const struct container_entry *e) {
+#if defined(CONFIG_CONTAINER_VERIFY_SHA256)
+  UINT8 digest[SHA256_DIGEST_SIZE];
+  sha256(container_entry_addr(hdr, e), e->size, digest);
+  if (CompareMem(digest, e->sha256, sizeof(digest)) != 0) {
+    Print(L"[ERROR] container_verify: sha256 mismatch for %a\n", e->name);
+    return EFI_CRC_ERROR;
+  }
+#endif
+  return EFI_SUCCESS;
+}
+
+const char *container_kind_name(UINT32 kind) {
+  switch (kind) {
+  case CONTAINER_KIND_HVISOR:
+    return "hvisor";
+  case CONTAINER_KIND_ZONE0_KERNEL:
+    return "zone0-kernel";
+  case CONTAINER_KIND_ZONE0_INITRD:
+    return "zone0-initrd";
+  case CONTAINER_KIND_ZONE0_DTB:
+    return "zone0-dtb";
+  case CONTAINER_KIND_ZONE_KERNEL:
+    return "zone-kernel";
+  default:
+    return "unknown";
+  }
+}
+
+const char *container_codec_name(UINT32 codec) {
+  switch (codec) {
+  case CONTAINER_CODEC_NONE:
+    return "none";
+  case CONTAINER_CODEC_LZ4:
+    return "lz4";
+  case CONTAINER_CODEC_ZSTD:
+    return "zstd";
+  case CONTAINER_CODEC_ZBOOT:
+    return "zboot";
+  default:
+    return "unknown";
+  }
+}
@@ -5,42 +5,147 @@
 
 #include "core.h"
 #include "arch.h"
+#include "boottime.h"
+#include "console.h"
 
-void memcpy2(void *dest, void *src, int n) {
-  char *csrc = (char *)src;
-  char *cdest = (char *)dest;
+// Aligned 64-bit word copy. This is the generic fallback and also moves the
+// unaligned head/tail around the arch block kernel. Loop distribution is off
+// so gcc doesn't turn it back into a call to the byte-wise memcpy of gnu-efi.
+static void __attribute__((optimize("no-tree-loop-distribute-patterns")))
+copy_words(UINT8 *d, const UINT8 *s, UINTN n) {
+  // words only pay off when both sides share the same alignment
+  if ((((UINTN)d ^ (UINTN)s) & 7) == 0) {
+    while (n && ((UINTN)d & 7)) {
+      *d++ = *s++;
+      n--;
+    }
+    for (; n >= 8; n -= 8, d += 8, s += 8) {
+      *(UINT64 *)d = *(const UINT64 *)s;
+    }
+  }
+  while (n--) {
+    *d++ = *s++;
+  }
+}
+
+void memcpy2(void *dest, const void *src, UINTN n) {
+  UINT8 *d = (UINT8 *)dest;
+  const UINT8 *s = (const UINT8 *)src;
+
+  if (arch_ops == NULL || arch_ops->memory.copy_blocks == NULL ||
+      n < 2 * ARCH_COPY_BLOCK_SIZE) {
+    copy_words(d, s, n);
+    return;
+  }
+
+  // align the destination to a whole block, the kernels tolerate any source
+  // alignment but split stores are expensive on all three arches
+  UINTN head = (-(UINTN)d) & (ARCH_COPY_BLOCK_SIZE - 1);
+  copy_words(d, s, head);
+  d += head;
+  s += head;
+  n -= head;
+
+  UINTN nblocks = n / ARCH_COPY_BLOCK_SIZE;
+  ARCH_COPY_BLOCKS(d, s, nblocks);
+  d += nblocks * ARCH_COPY_BLOCK_SIZE;
+  s += nblocks * ARCH_COPY_BLOCK_SIZE;
+
+  copy_words(d, s, n % ARCH_COPY_BLOCK_SIZE);
+}
+
+static void __attribute__((optimize("no-tree-loop-distribute-patterns")))
+zero_words(UINT8 *d, UINTN n) {
+  while (n && ((UINTN)d & 7)) {
+    *d++ = 0;
+    n--;
+  }
+  for (; n >= 8; n -= 8, d += 8) {
+    *(UINT64 *)d = 0;
+  }
+  while (n--) {
+    *d++ = 0;
+  }
+}
 
-  for (int i = 0; i < n; i++) {
-    cdest[i] = csrc[i];
+void memzero(void *dest, UINTN n) {
+  UINT8 *d = (UINT8 *)dest;
+
+  if (arch_ops == NULL || arch_ops->memory.zero_blocks == NULL) {
+    zero_words(d, n);
+    return;
+  }
+
+  UINTN block = ARCH_ZERO_BLOCK_SIZE();
+  if (n < 2 * block) {
+    zero_words(d, n);
+    return;
   }
+
+  // DC ZVA and cbo.zero ignore the low address bits, so the block kernels
+  // must only ever see block aligned addresses
+  UINTN head = (-(UINTN)d) & (block - 1);
+  zero_words(d, head);
+  d += head;
+  n -= head;
+
+  UINTN nblocks = n / block;
+  ARCH_ZERO_BLOCKS(d, nblocks);
+  d += nblocks * block;
+
+  zero_words(d, n % block);
 }
 
-void memset2(void *dest, int val, int n) {
+void memset2(void *dest, int val, UINTN n) {
+  if (val == 0) {
+    memzero(dest, n);
+    return;
+  }
+
   char *cdest = (char *)dest;
 
-  for (int i = 0; i < n; i++) {
+  for (UINTN i = 0; i < n; i++) {
     cdest[i] = val;
   }
 }
 
 void halt() {
   Print(L"[INFO] halt: halting system\n");
+  console_flush();
   while (1)
     ;
 }
 
-void print_char(char c) {
-  if (arch_ops != NULL) {
-    ARCH_PUT_CHAR(c);
-  }
-}
+#if defined(CONFIG_CONSOLE_QUIET)
+// CONSOLE_QUIET keeps [ERROR] lines only. A line is often put together
+// from several calls, so the piece that starts it decides for all of it.
+static BOOLEAN line_start = TRUE, line_shown;
 
-void print_str(const char *str) {
-  while (*str) {
-    print_char(*str);
-    str++;
+static void print_write(const char *s, UINTN n) {
+  while (n > 0) {
+    UINTN len = 0;
+    if (line_start) {
+      line_shown =
+          n >= 7 && strncmpa((CHAR8 *)s, (CHAR8 *)"[ERROR]", 7) == 0;
+      line_start = FALSE;
+    }
+    while (len < n && s[len++] != '\n')
+      ;
+    line_start = s[len - 1] == '\n';
+    if (line_shown) {
+      console_write(s, len);
+    }
+    s += len;
+    n -= len;
   }
 }
+#else
+static void print_write(const char *s, UINTN n) { console_write(s, n); }
+#endif
+
+void print_char(char c) { print_write(&c, 1); }
+
+void print_str(const char *str) { print_write(str, strlena((CHAR8 *)str)); }
 
 void print_hex(UINT8 n) {
   UINT8 c = n >> 4;
@@ -135,6 +240,23 @@ const char *get_arch() {
   return "unknown";
 }
 
+UINT64 counter_to_us(UINT64 ticks) {
+  UINT64 freq = arch_ops != NULL ? ARCH_COUNTER_FREQ() : 0;
+  if (freq == 0) {
+    return 0;
+  }
+  return ticks / freq * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
+UINT64 throughput_mbps(UINTN bytes, UINT64 ticks) {
+  UINT64 us = counter_to_us(ticks);
+  if (us == 0) {
+    return 0;
+  }
+  // bytes per microsecond is (decimal) MB/s
+  return bytes / us;
+}
+
 void check(EFI_STATUS status, const char *prefix, EFI_STATUS expected,
            EFI_SYSTEM_TABLE *SystemTable) {
   if (status != expected) {
@@ -158,40 +280,184 @@ void print_chars(char *c, int n) {
   }
 }
 
+static EFI_STATUS claim_pages(UINTN base, UINTN end) {
+  EFI_PHYSICAL_ADDRESS addr = base;
+  return uefi_call_wrapper(BS->AllocatePages, 4, AllocateAddress,
+                           EFI_HVISOR_PAYLOAD, EFI_SIZE_TO_PAGES(end - base),
+                           &addr);
+}
+
+// The claim of [base, end) failed, find out why from the current map. A
+// range nobody describes is used as it is, one that only overlaps earlier
+// claims gets its free pieces claimed. Otherwise the descriptors in the way
+// are printed and *to is the free align aligned range nearest to base, 0 if
+// there is none or align is 0.
+static EFI_STATUS reserve_conflicts(const char *name, UINTN base, UINTN end,
+                                    UINTN align, UINTN *to) {
+  UINTN nr, key, size, dist = (UINTN)-1, len = end - base;
+  UINT32 version;
+  BOOLEAN described = FALSE, foreign = FALSE;
+  EFI_MEMORY_DESCRIPTOR *map = LibMemoryMap(&nr, &key, &size, &version);
+
+  if (map == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  *to = 0;
+  for (UINTN i = 0; i < nr; i++) {
+    EFI_MEMORY_DESCRIPTOR *d =
+        (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + i * size);
+    UINTN s = d->PhysicalStart, e = s + d->NumberOfPages * EFI_PAGE_SIZE;
+    if (s < end && e > base) {
+      described = TRUE;
+      if (d->Type != EfiConventionalMemory && d->Type != EFI_HVISOR_PAYLOAD) {
+        foreign = TRUE;
+        Print(L"[ERROR] reserve_payload: %a 0x%lx - 0x%lx overlaps type "
+              L"0x%x at 0x%lx - 0x%lx\n",
+              name, base, end, d->Type, s, e);
+      }
+    }
+    if (align == 0 || d->Type != EfiConventionalMemory || e - s < len) {
+      continue;
+    }
+    // as close to base as the descriptor allows
+    UINTN at = base < s ? ALIGN_UP(s, align)
+                        : ALIGN_DOWN(base < e - len ? base : e - len, align);
+    UINTN off = at > base ? at - base : base - at;
+    if (at >= s && at + len <= e && off < dist) {
+      *to = at;
+      dist = off;
+    }
+  }
+
+  EFI_STATUS status = foreign ? EFI_ACCESS_DENIED : EFI_SUCCESS;
+  if (!described) {
+    Print(L"[WARN] reserve_payload: %a 0x%lx - 0x%lx isn't in the memory "
+          L"map, using it as it is\n",
+          name, base, end);
+  }
+  // e.g. an arch clear region around hvisor, overlaps between payloads are
+  // ruled out by mkcontainer.py
+  for (UINTN i = 0; described && !foreign && i < nr; i++) {
+    EFI_MEMORY_DESCRIPTOR *d =
+        (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + i * size);
+    UINTN s = d->PhysicalStart, e = s + d->NumberOfPages * EFI_PAGE_SIZE;
+    if (d->Type == EfiConventionalMemory && s < end && e > base) {
+      status = claim_pages(s > base ? s : base, e < end ? e : end);
+      if (EFI_ERROR(status)) {
+        break;
+      }
+    }
+  }
+  FreePool(map);
+  return status;
+}
+
+EFI_STATUS reserve_payload(const char *name, UINTN *addr, UINTN size,
+                           UINTN align) {
+  UINTN phys = arch_phys_addr(*addr);
+  UINTN base = ALIGN_DOWN(phys, EFI_PAGE_SIZE);
+  UINTN end = ALIGN_UP(phys + size, EFI_PAGE_SIZE);
+  UINTN to;
+
+  if (size == 0 || !EFI_ERROR(claim_pages(base, end))) {
+    return EFI_SUCCESS;
+  }
+  if (align != 0 && align < EFI_PAGE_SIZE) {
+    align = EFI_PAGE_SIZE;
+  }
+  EFI_STATUS status = reserve_conflicts(name, base, end, align, &to);
+  if (!EFI_ERROR(status)) {
+    return status;
+  }
+  if (to == 0 || EFI_ERROR(claim_pages(to, to + (end - base)))) {
+    Print(L"[ERROR] reserve_payload: can't claim 0x%lx - 0x%lx for %a%a\n",
+          base, end, name, align ? " or move it" : "");
+    return status;
+  }
+  Print(L"[WARN] reserve_payload: %a moved from 0x%lx to 0x%lx\n", name,
+        base, to);
+  // keep the DMW window and the offset into the first page
+  *addr = *addr - phys + to + (phys - base);
+  return EFI_SUCCESS;
+}
+
 // UEFI boot services management
 static UINTN memory_map_size = 0;
 static UINTN map_key, desc_size;
 static UINT32 desc_version;
 static EFI_MEMORY_DESCRIPTOR *memory_map_desc;
 
+// descriptors the map may grow by between sizing it and the final
+// GetMemoryMap(), the buffer allocation itself adds one or two
+#define MEMORY_MAP_HEADROOM 32
+#define EXIT_BOOT_SERVICES_TRIES 8
+
+// Size a page backed map buffer once, then loop GetMemoryMap() and
+// ExitBootServices() until the key holds. Nothing in the loop allocates or
+// prints, firmware events that change the map in between only cost
+// another round. After the first failed ExitBootServices() only those two
+// calls are allowed, so a map that outgrows the headroom is an error.
 EFI_STATUS exit_boot_services(EFI_HANDLE ImageHandle,
                               EFI_SYSTEM_TABLE *SystemTable) {
+  EFI_BOOT_SERVICES *bs = SystemTable->BootServices;
+  EFI_PHYSICAL_ADDRESS buf;
   EFI_STATUS status;
-  // get memory map
+  UINTN capacity;
+
   memory_map_size = 0;
   memory_map_desc = NULL;
-  status = uefi_call_wrapper(SystemTable->BootServices->GetMemoryMap, 5,
-                             &memory_map_size, memory_map_desc, &map_key,
-                             &desc_size, &desc_version);
-
+  status = uefi_call_wrapper(bs->GetMemoryMap, 5, &memory_map_size,
+                             memory_map_desc, &map_key, &desc_size,
+                             &desc_version);
   check(status, "GetMemoryMap (1st call)", EFI_BUFFER_TOO_SMALL, SystemTable);
-  Print(L"[INFO] exit_boot_services: memory_map_size = %ld\n", memory_map_size);
-
-  memory_map_size += 20 * desc_size;
-  status = uefi_call_wrapper(SystemTable->BootServices->AllocatePool, 3,
-                             EfiLoaderData, memory_map_size,
-                             (void **)&memory_map_desc);
-  if (memory_map_desc == NULL) {
-    Print(L"[ERROR] exit_boot_services: AllocatePool failed !!!\n");
+
+  capacity = ALIGN_UP(memory_map_size + MEMORY_MAP_HEADROOM * desc_size,
+                      EFI_PAGE_SIZE);
+  status = uefi_call_wrapper(bs->AllocatePages, 4, AllocateAnyPages,
+                             EfiLoaderData, EFI_SIZE_TO_PAGES(capacity), &buf);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] exit_boot_services: can't allocate 0x%lx bytes for the "
+          L"memory map: %a\n",
+          capacity, get_efi_status_string(status));
     halt();
   }
+  memory_map_desc = (EFI_MEMORY_DESCRIPTOR *)buf;
+  Print(L"[INFO] exit_boot_services: memory map 0x%lx bytes, buffer 0x%lx\n",
+        memory_map_size, capacity);
+  console_flush();
 
-  // the below two call should be place just in next to each other
-  // otherwise, the map key will changed when call ExitBootServices()!!
-  status = uefi_call_wrapper(SystemTable->BootServices->GetMemoryMap, 5,
-                             &memory_map_size, memory_map_desc, &map_key,
-                             &desc_size, &desc_version);
-  status = uefi_call_wrapper(SystemTable->BootServices->ExitBootServices, 2,
-                             ImageHandle, map_key);
+  boot_time_mark("memory map");
+  for (UINTN try = 1; try <= EXIT_BOOT_SERVICES_TRIES; try++) {
+    memory_map_size = capacity;
+    status = uefi_call_wrapper(bs->GetMemoryMap, 5, &memory_map_size,
+                               memory_map_desc, &map_key, &desc_size,
+                               &desc_version);
+    if (EFI_ERROR(status)) {
+      break;
+    }
+    status = uefi_call_wrapper(bs->ExitBootServices, 2, ImageHandle, map_key);
+    if (status != EFI_INVALID_PARAMETER) {
+      if (try > 1) {
+        print_str("[WARN] exit_boot_services: map key changed, tries: 0x");
+        print_hex(try);
+        print_str("\n");
+      }
+      break;
+    }
+  }
+  if (EFI_ERROR(status)) {
+    // boot services may be half gone, only the raw UART is safe
+    print_str("[ERROR] exit_boot_services: ");
+    print_str(get_efi_status_string(status));
+    print_str("\n");
+  }
   return status;
-}
\ No newline at end of file
+}
+
+EFI_MEMORY_DESCRIPTOR *boot_memory_map(UINTN *size, UINTN *desc_size_out,
+                                       UINT32 *desc_version_out) {
+  *size = memory_map_size;
+  *desc_size_out = desc_size;
+  *desc_version_out = desc_version;
+  return memory_map_desc;
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "esp.h"
+#include "core.h"
+#include "zboot.h"
+
+#define ESP_PATH_MAX 256
+
+EFI_STATUS esp_open_dir(EFI_HANDLE image, EFI_FILE_HANDLE *dir) {
+  EFI_LOADED_IMAGE *loaded;
+  CHAR16 path[ESP_PATH_MAX];
+  UINTN len = 0;
+  EFI_STATUS status;
+
+  status = uefi_call_wrapper(BS->HandleProtocol, 3, image,
+                             &LoadedImageProtocol, (void **)&loaded);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  EFI_FILE_HANDLE root = LibOpenRoot(loaded->DeviceHandle);
+  if (root == NULL) {
+    return EFI_NOT_FOUND;
+  }
+
+  // the image path is one or more file path nodes, e.g. \EFI\BOOT\BOOTAA64.EFI
+  EFI_DEVICE_PATH *node = loaded->FilePath;
+  for (; node && !IsDevicePathEnd(node); node = NextDevicePathNode(node)) {
+    if (DevicePathType(node) != MEDIA_DEVICE_PATH ||
+        DevicePathSubType(node) != MEDIA_FILEPATH_DP) {
+      continue;
+    }
+    CHAR16 *name = ((FILEPATH_DEVICE_PATH *)node)->PathName;
+    for (; *name && len < ESP_PATH_MAX - 1; name++) {
+      path[len++] = *name;
+    }
+  }
+
+  // strip the file name, keep the directory
+  while (len > 0 && path[len - 1] != L'\\') {
+    len--;
+  }
+  path[len] = 0;
+  if (len <= 1) {
+    *dir = root;
+    return EFI_SUCCESS;
+  }
+
+  status = uefi_call_wrapper(root->Open, 5, root, dir, path, EFI_FILE_MODE_READ,
+                             0);
+  uefi_call_wrapper(root->Close, 1, root);
+  return status;
+}
+
+// Open name in dir and get its size.
+static EFI_STATUS esp_open_file(EFI_FILE_HANDLE dir, const char *name,
+                                EFI_FILE_HANDLE *file, UINTN *size) {
+  CHAR16 wname[ESP_PATH_MAX];
+  EFI_STATUS status;
+  UINTN i;
+
+  for (i = 0; name[i] && i < ESP_PATH_MAX - 1; i++) {
+    wname[i] = name[i];
+  }
+  wname[i] = 0;
+
+  status =
+      uefi_call_wrapper(dir->Open, 5, dir, file, wname, EFI_FILE_MODE_READ, 0);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  EFI_FILE_INFO *info = LibFileInfo(*file);
+  if (info == NULL) {
+    uefi_call_wrapper((*file)->Close, 1, *file);
+    return EFI_DEVICE_ERROR;
+  }
+  *size = info->FileSize;
+  FreePool(info);
+  return EFI_SUCCESS;
+}
+
+// Read size bytes of file to dest and close it.
+static EFI_STATUS esp_read(EFI_FILE_HANDLE file, UINT8 *dest, UINTN size) {
+  EFI_STATUS status = EFI_SUCCESS;
+
+  while (size > 0) {
+    UINTN len = size < ESP_READ_CHUNK ? size : ESP_READ_CHUNK;
+    status = uefi_call_wrapper(file->Read, 3, file, &len, dest);
+    if (EFI_ERROR(status)) {
+      break;
+    }
+    if (len == 0) {
+      status = EFI_END_OF_FILE;
+      break;
+    }
+    dest += len;
+    size -= len;
+  }
+
+  uefi_call_wrapper(file->Close, 1, file);
+  return status;
+}
+
+// Read a zboot kernel of file_size bytes into a bounce buffer and decode the
+// Image in it to load_addr.
+static EFI_STATUS esp_load_zboot(EFI_FILE_HANDLE file, const char *name,
+                                 UINTN file_size, UINTN load_addr,
+                                 UINTN *size) {
+  EFI_STATUS status;
+
+  UINT8 *buf = AllocatePool(file_size);
+  if (buf == NULL) {
+    uefi_call_wrapper(file->Close, 1, file);
+    return EFI_OUT_OF_RESOURCES;
+  }
+  UINTN content_size = 0;
+  status = esp_read(file, buf, file_size);
+  if (!EFI_ERROR(status)) {
+    content_size = zboot_content_size(buf, file_size);
+    Print(L"[INFO] esp_load_zboot: %a is a zboot image, 0x%lx -> 0x%lx\n",
+          name, file_size, content_size);
+    // Kconfig load addresses are fixed, hvisor expects the kernel there
+    status = reserve_payload(name, &load_addr, content_size, 0);
+  }
+  if (!EFI_ERROR(status)) {
+    status = zboot_decompress((void *)load_addr, content_size, buf, file_size,
+                              size);
+  }
+  FreePool(buf);
+  return status;
+}
+
+EFI_STATUS esp_load_file(EFI_FILE_HANDLE dir, const char *name,
+                         UINTN load_addr, UINTN *size) {
+  EFI_FILE_HANDLE file;
+  struct zboot_header zh;
+  UINTN file_size, len = sizeof(zh);
+  EFI_STATUS status;
+
+  status = esp_open_file(dir, name, &file, &file_size);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  // compressed kernels are decoded to load_addr rather than read there
+  status = uefi_call_wrapper(file->Read, 3, file, &len, &zh);
+  if (!EFI_ERROR(status)) {
+    status = uefi_call_wrapper(file->SetPosition, 2, file, 0);
+  }
+  if (EFI_ERROR(status)) {
+    uefi_call_wrapper(file->Close, 1, file);
+    return status;
+  }
+  if (zboot_detect(&zh, len)) {
+    return esp_load_zboot(file, name, file_size, load_addr, size);
+  }
+
+  *size = file_size;
+  status = reserve_payload(name, &load_addr, file_size, 0);
+  if (EFI_ERROR(status)) {
+    uefi_call_wrapper(file->Close, 1, file);
+    return status;
+  }
+  return esp_read(file, (UINT8 *)load_addr, file_size);
+}
+
+EFI_STATUS esp_read_file(EFI_FILE_HANDLE dir, const char *name, void **buf,
+                         UINTN *size) {
+  EFI_FILE_HANDLE file;
+  EFI_STATUS status;
+
+  status = esp_open_file(dir, name, &file, size);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  *buf = AllocatePool(*size);
+  if (*buf == NULL) {
+    uefi_call_wrapper(file->Close, 1, file);
+    return EFI_OUT_OF_RESOURCES;
+  }
+  status = esp_read(file, *buf, *size);
+  if (EFI_ERROR(status)) {
+    FreePool(*buf);
+  }
+  return status;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "fdt.h"
+#include "core.h"
+
+// Devicetree Specification, chapter 5, just enough to find a property
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_HEADER_SIZE 40
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_NOP 4
+#define FDT_END 9
+
+static UINT32 be32(const UINT8 *p) {
+  return (UINT32)p[0] << 24 | (UINT32)p[1] << 16 | (UINT32)p[2] << 8 | p[3];
+}
+
+static void put_be32(UINT8 *p, UINT32 v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+// s, at most max bytes long, equals the NUL terminated name
+static BOOLEAN name_is(const UINT8 *s, UINTN max, const char *name) {
+  UINTN i = 0;
+  for (; i < max && name[i]; i++) {
+    if (s[i] != (UINT8)name[i]) {
+      return FALSE;
+    }
+  }
+  return i < max && s[i] == 0;
+}
+
+// The value of property name in the top level node, NULL if it isn't
+// there or the tree is broken.
+static UINT8 *find_prop(UINT8 *fdt, UINTN size, const char *node,
+                        const char *name, UINT32 *len) {
+  if (size < FDT_HEADER_SIZE || be32(fdt) != FDT_MAGIC) {
+    return NULL;
+  }
+  UINT32 total = be32(fdt + 4), off_struct = be32(fdt + 8);
+  UINT32 off_strings = be32(fdt + 12), version = be32(fdt + 20);
+  UINT32 size_strings = be32(fdt + 32);
+  UINT32 size_struct = version >= 17 ? be32(fdt + 36) : total - off_struct;
+  if (total > size || off_struct > total || size_struct > total - off_struct ||
+      off_strings > total || size_strings > total - off_strings) {
+    return NULL;
+  }
+
+  const UINT8 *strings = fdt + off_strings;
+  UINT8 *p = fdt + off_struct, *end = p + size_struct;
+  UINTN depth = 0;
+  BOOLEAN in_node = FALSE;
+
+  while (end - p >= 4) {
+    UINT32 token = be32(p);
+    p += 4;
+    switch (token) {
+    case FDT_BEGIN_NODE: {
+      UINTN n = 0;
+      while (p + n < end && p[n]) {
+        n++;
+      }
+      if (p + n == end) {
+        return NULL;
+      }
+      // the root is the only node at depth 1
+      in_node = ++depth == 2 && name_is(p, n + 1, node);
+      p += ALIGN_UP(n + 1, 4);
+      break;
+    }
+    case FDT_END_NODE:
+      if (depth-- == 0) {
+        return NULL;
+      }
+      in_node = FALSE;
+      break;
+    case FDT_PROP: {
+      if (end - p < 8) {
+        return NULL;
+      }
+      UINT32 plen = be32(p), nameoff = be32(p + 4);
+      p += 8;
+      if (plen > (UINTN)(end - p) || nameoff >= size_strings) {
+        return NULL;
+      }
+      if (in_node &&
+          name_is(strings + nameoff, size_strings - nameoff, name)) {
+        *len = plen;
+        return p;
+      }
+      p += ALIGN_UP(plen, 4);
+      break;
+    }
+    case FDT_NOP:
+      break;
+    default: // FDT_END or garbage
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+// one or two cells, big endian
+static void put_cells(UINT8 *v, UINT32 len, UINT64 value) {
+  if (len == 8) {
+    put_be32(v, value >> 32);
+    v += 4;
+  }
+  put_be32(v, value);
+}
+
+EFI_STATUS fdt_set_initrd(void *fdt, UINTN size, UINT64 start, UINT64 end) {
+  UINT32 start_len, end_len;
+  UINT8 *start_val =
+      find_prop(fdt, size, "chosen", "linux,initrd-start", &start_len);
+  UINT8 *end_val = find_prop(fdt, size, "chosen", "linux,initrd-end", &end_len);
+
+  if (start_val == NULL || end_val == NULL) {
+    return EFI_NOT_FOUND;
+  }
+  // check both before touching either
+  if ((start_len != 4 && start_len != 8) || (end_len != 4 && end_len != 8) ||
+      (start_len == 4 && start >> 32) || (end_len == 4 && end >> 32)) {
+    return EFI_UNSUPPORTED;
+  }
+  put_cells(start_val, start_len, start);
+  put_cells(end_val, end_len, end);
+  return EFI_SUCCESS;
+}
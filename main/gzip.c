@@ -0,0 +1,443 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "gzip.h"
+#include "core.h"
+
+// Single-pass inflate after RFC 1951. Like the zstd decoder the output is
+// flat, so there is no window: matches are copied from output that is
+// already there. Codes of up to FAST_BITS bits are resolved with one table
+// lookup, the rare longer ones are walked bit by bit in canonical order.
+
+#define GZIP_ID1 0x1f
+#define GZIP_ID2 0x8b
+#define GZIP_CM_DEFLATE 8
+#define FLG_FHCRC (1 << 1)
+#define FLG_FEXTRA (1 << 2)
+#define FLG_FNAME (1 << 3)
+#define FLG_FCOMMENT (1 << 4)
+
+#define MAX_BITS 15
+#define FAST_BITS 10
+#define LITLEN_CODES 288
+#define DIST_CODES 32
+#define CODELEN_CODES 19
+#define END_OF_BLOCK 256
+
+enum { BLOCK_STORED = 0, BLOCK_FIXED = 1, BLOCK_DYNAMIC = 2 };
+
+struct huffman {
+  // symbol | length << 9 for codes of up to FAST_BITS, 0 for longer ones
+  UINT16 fast[1 << FAST_BITS];
+  UINT16 count[MAX_BITS + 1];
+  UINT16 symbol[LITLEN_CODES];
+};
+
+struct bits {
+  const UINT8 *ip;
+  const UINT8 *iend;
+  UINT64 buf;
+  UINT32 cnt;
+  UINT32 over; // zero bytes fed in past the end of the input
+};
+
+static const UINT16 len_base[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const UINT8 len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+                                    1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                                    4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const UINT16 dist_base[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const UINT8 dist_extra[30] = {0, 0, 0, 0, 1, 1, 2,  2,  3,  3,
+                                     4, 4, 5, 5, 6, 6, 7,  7,  8,  8,
+                                     9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const UINT8 codelen_order[CODELEN_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static inline UINT32 get_le32(const UINT8 *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+// keep at least 56 bits buffered, past the end of the input zeros are fed in
+// and counted so a truncated stream can be told apart at the end
+static inline void refill(struct bits *b) {
+  if (b->iend - b->ip >= 8) {
+    UINT64 v;
+    __builtin_memcpy(&v, b->ip, 8);
+    b->buf |= v << b->cnt;
+    b->ip += (63 - b->cnt) >> 3;
+    b->cnt |= 56;
+    return;
+  }
+  while (b->cnt <= 56) {
+    if (b->ip < b->iend) {
+      b->buf |= (UINT64)*b->ip++ << b->cnt;
+    } else {
+      b->over++;
+    }
+    b->cnt += 8;
+  }
+}
+
+static inline UINT32 peek(struct bits *b, UINT32 n) {
+  return b->buf & ((1ULL << n) - 1);
+}
+
+static inline void consume(struct bits *b, UINT32 n) {
+  b->buf >>= n;
+  b->cnt -= n;
+}
+
+static inline UINT32 get_bits(struct bits *b, UINT32 n) {
+  refill(b);
+  UINT32 v = peek(b, n);
+  consume(b, n);
+  return v;
+}
+
+// input consumed so far went past the end
+static inline BOOLEAN overrun(const struct bits *b) {
+  return b->over * 8 > b->cnt;
+}
+
+static inline UINT32 reverse_bits(UINT32 code, UINT32 len) {
+  UINT32 r = 0;
+  for (UINT32 i = 0; i < len; i++, code >>= 1) {
+    r = (r << 1) | (code & 1);
+  }
+  return r;
+}
+
+// Build the tables of a canonical code from its code lengths. Incomplete
+// codes are fine, reaching one of the missing codes fails in decode().
+static EFI_STATUS build(struct huffman *h, const UINT8 *lens, UINT32 n) {
+  UINT16 offs[MAX_BITS + 2];
+  UINT32 next[MAX_BITS + 1];
+
+  SetMem(h->count, sizeof(h->count), 0);
+  for (UINT32 i = 0; i < n; i++) {
+    h->count[lens[i]]++;
+  }
+  h->count[0] = 0;
+
+  INT32 left = 1;
+  UINT32 code = 0;
+  offs[1] = 0;
+  for (UINT32 len = 1; len <= MAX_BITS; len++) {
+    left = (left << 1) - h->count[len];
+    if (left < 0) {
+      return EFI_COMPROMISED_DATA; // over-subscribed
+    }
+    offs[len + 1] = offs[len] + h->count[len];
+    next[len] = code;
+    code = (code + h->count[len]) << 1;
+  }
+
+  SetMem(h->fast, sizeof(h->fast), 0);
+  for (UINT32 sym = 0; sym < n; sym++) {
+    UINT32 len = lens[sym];
+    if (len == 0) {
+      continue;
+    }
+    h->symbol[offs[len]++] = sym;
+    UINT32 c = next[len]++;
+    if (len <= FAST_BITS) {
+      for (UINT32 i = reverse_bits(c, len); i < (1 << FAST_BITS);
+           i += 1 << len) {
+        h->fast[i] = sym | (len << 9);
+      }
+    }
+  }
+  return EFI_SUCCESS;
+}
+
+// next symbol, -1 for a code that isn't in the table
+static inline INT32 decode(struct bits *b, const struct huffman *h) {
+  refill(b);
+  UINT16 e = h->fast[peek(b, FAST_BITS)];
+  if (e != 0) {
+    consume(b, e >> 9);
+    return e & 0x1ff;
+  }
+
+  // the stream holds codes msb first, walk them one bit at a time
+  INT32 code = 0, first = 0, index = 0;
+  for (UINT32 len = 1; len <= MAX_BITS; len++) {
+    code |= (b->buf >> (len - 1)) & 1;
+    INT32 count = h->count[len];
+    if (code - count < first) {
+      consume(b, len);
+      return h->symbol[index + (code - first)];
+    }
+    index += count;
+    first = (first + count) << 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+static EFI_STATUS inflate_stored(struct bits *b, UINT8 **opp, UINT8 *oend) {
+  // hand the whole bytes still buffered back to the input
+  consume(b, b->cnt & 7);
+  if (overrun(b)) {
+    return EFI_COMPROMISED_DATA;
+  }
+  b->ip -= (b->cnt >> 3) - b->over;
+  b->over = 0;
+  b->buf = 0;
+  b->cnt = 0;
+
+  if (b->iend - b->ip < 4) {
+    return EFI_COMPROMISED_DATA;
+  }
+  UINTN len = b->ip[0] | (b->ip[1] << 8);
+  UINTN nlen = b->ip[2] | (b->ip[3] << 8);
+  b->ip += 4;
+  if (len != (~nlen & 0xffff) || len > (UINTN)(b->iend - b->ip) ||
+      len > (UINTN)(oend - *opp)) {
+    return EFI_COMPROMISED_DATA;
+  }
+  memcpy2(*opp, b->ip, len);
+  b->ip += len;
+  *opp += len;
+  return EFI_SUCCESS;
+}
+
+static void build_fixed(struct huffman *litlen, struct huffman *dist) {
+  UINT8 lens[LITLEN_CODES];
+  UINT32 i = 0;
+
+  for (; i < 144; i++) {
+    lens[i] = 8;
+  }
+  for (; i < 256; i++) {
+    lens[i] = 9;
+  }
+  for (; i < 280; i++) {
+    lens[i] = 7;
+  }
+  for (; i < LITLEN_CODES; i++) {
+    lens[i] = 8;
+  }
+  build(litlen, lens, LITLEN_CODES);
+  for (i = 0; i < DIST_CODES; i++) {
+    lens[i] = 5;
+  }
+  build(dist, lens, DIST_CODES);
+}
+
+static EFI_STATUS build_dynamic(struct bits *b, struct huffman *litlen,
+                                struct huffman *dist) {
+  UINT8 lens[LITLEN_CODES + DIST_CODES];
+  struct huffman codelen;
+  EFI_STATUS status;
+
+  UINT32 nlen = get_bits(b, 5) + 257;
+  UINT32 ndist = get_bits(b, 5) + 1;
+  UINT32 ncode = get_bits(b, 4) + 4;
+  if (nlen > 286 || ndist > 30) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  SetMem(lens, CODELEN_CODES, 0);
+  for (UINT32 i = 0; i < ncode; i++) {
+    lens[codelen_order[i]] = get_bits(b, 3);
+  }
+  status = build(&codelen, lens, CODELEN_CODES);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  for (UINT32 i = 0; i < nlen + ndist;) {
+    INT32 sym = decode(b, &codelen);
+    UINT32 len = 0, repeat;
+
+    if (sym < 0) {
+      return EFI_COMPROMISED_DATA;
+    }
+    if (sym < 16) {
+      lens[i++] = sym;
+      continue;
+    }
+    if (sym == 16) {
+      if (i == 0) {
+        return EFI_COMPROMISED_DATA;
+      }
+      len = lens[i - 1];
+      repeat = 3 + get_bits(b, 2);
+    } else if (sym == 17) {
+      repeat = 3 + get_bits(b, 3);
+    } else {
+      repeat = 11 + get_bits(b, 7);
+    }
+    if (i + repeat > nlen + ndist) {
+      return EFI_COMPROMISED_DATA;
+    }
+    while (repeat--) {
+      lens[i++] = len;
+    }
+  }
+  if (lens[END_OF_BLOCK] == 0) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  status = build(litlen, lens, nlen);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  return build(dist, lens + nlen, ndist);
+}
+
+// Match copies overlap whenever dist < length, in that case the bytes must
+// be replicated in order. Longer distances copy whole words.
+static inline void copy_match(UINT8 *d, const UINT8 *m, UINTN len) {
+  if ((UINTN)(d - m) >= 8) {
+    for (; len >= 8; len -= 8, d += 8, m += 8) {
+      __builtin_memcpy(d, m, 8);
+    }
+  }
+  while (len--) {
+    *d++ = *m++;
+  }
+}
+
+static EFI_STATUS inflate_codes(struct bits *b, const struct huffman *litlen,
+                                const struct huffman *dist, UINT8 *dest,
+                                UINT8 **opp, UINT8 *oend) {
+  UINT8 *op = *opp;
+
+  for (;;) {
+    INT32 sym = decode(b, litlen);
+    if (sym < 0) {
+      return EFI_COMPROMISED_DATA;
+    }
+    if (sym < END_OF_BLOCK) {
+      if (op >= oend) {
+        return EFI_BUFFER_TOO_SMALL;
+      }
+      *op++ = sym;
+      continue;
+    }
+    if (sym == END_OF_BLOCK) {
+      break;
+    }
+
+    sym -= END_OF_BLOCK + 1;
+    if (sym >= 29) {
+      return EFI_COMPROMISED_DATA;
+    }
+    // decode() leaves at least 41 bits, plenty for the extra ones
+    UINTN len = len_base[sym] + peek(b, len_extra[sym]);
+    consume(b, len_extra[sym]);
+    sym = decode(b, dist);
+    if (sym < 0 || sym >= 30) {
+      return EFI_COMPROMISED_DATA;
+    }
+    UINTN d = dist_base[sym] + peek(b, dist_extra[sym]);
+    consume(b, dist_extra[sym]);
+
+    if (d > (UINTN)(op - dest) || len > (UINTN)(oend - op)) {
+      return EFI_COMPROMISED_DATA;
+    }
+    copy_match(op, op - d, len);
+    op += len;
+  }
+
+  *opp = op;
+  return EFI_SUCCESS;
+}
+
+// skip the member header, returns its length or 0 if malformed
+static UINTN parse_header(const UINT8 *src, UINTN src_size) {
+  if (src_size < 18 || src[0] != GZIP_ID1 || src[1] != GZIP_ID2 ||
+      src[2] != GZIP_CM_DEFLATE) {
+    return 0;
+  }
+  UINT8 flg = src[3];
+  UINTN len = 10;
+
+  if (flg & FLG_FEXTRA) {
+    if (src_size - len < 2) {
+      return 0;
+    }
+    len += 2 + (src[len] | (src[len + 1] << 8));
+  }
+  for (UINT8 f = FLG_FNAME; f <= FLG_FCOMMENT; f <<= 1) {
+    if (!(flg & f)) {
+      continue;
+    }
+    while (len < src_size && src[len] != 0) {
+      len++;
+    }
+    len++;
+  }
+  if (flg & FLG_FHCRC) {
+    len += 2;
+  }
+  return len + 8 <= src_size ? len : 0;
+}
+
+UINTN gzip_content_size(const void *src, UINTN src_size) {
+  if (parse_header(src, src_size) == 0) {
+    return 0;
+  }
+  return get_le32((const UINT8 *)src + src_size - 4);
+}
+
+EFI_STATUS gzip_decompress(void *dest, UINTN dest_size, const void *src,
+                           UINTN src_size, UINTN *out_size) {
+  struct huffman litlen, dist;
+  struct bits b;
+  UINT8 *op = (UINT8 *)dest;
+  UINT8 *oend = op + dest_size;
+  EFI_STATUS status = EFI_SUCCESS;
+  BOOLEAN last = FALSE;
+
+  UINTN hlen = parse_header(src, src_size);
+  if (hlen == 0) {
+    return EFI_UNSUPPORTED;
+  }
+  b.ip = (const UINT8 *)src + hlen;
+  b.iend = (const UINT8 *)src + src_size - 8; // CRC32 and ISIZE
+  b.buf = 0;
+  b.cnt = 0;
+  b.over = 0;
+
+  while (!last && !EFI_ERROR(status)) {
+    last = get_bits(&b, 1);
+    switch (get_bits(&b, 2)) {
+    case BLOCK_STORED:
+      status = inflate_stored(&b, &op, oend);
+      break;
+    case BLOCK_FIXED:
+      build_fixed(&litlen, &dist);
+      status = inflate_codes(&b, &litlen, &dist, dest, &op, oend);
+      break;
+    case BLOCK_DYNAMIC:
+      status = build_dynamic(&b, &litlen, &dist);
+      if (!EFI_ERROR(status)) {
+        status = inflate_codes(&b, &litlen, &dist, dest, &op, oend);
+      }
+      break;
+    default:
+      status = EFI_COMPROMISED_DATA;
+    }
+    if (overrun(&b)) {
+      status = EFI_COMPROMISED_DATA;
+    }
+  }
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  *out_size = op - (UINT8 *)dest;
+  if ((UINT32)*out_size != get_le32(b.iend + 4)) {
+    return EFI_COMPROMISED_DATA;
+  }
+  return EFI_SUCCESS;
+}
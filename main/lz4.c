@@ -0,0 +1,190 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "lz4.h"
+#include "core.h"
+
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+#define FLG_VERSION_MASK 0xc0
+#define FLG_VERSION 0x40
+#define FLG_BLOCK_CHECKSUM (1 << 4)
+#define FLG_CONTENT_SIZE (1 << 3)
+#define FLG_CONTENT_CHECKSUM (1 << 2)
+#define FLG_DICT_ID (1 << 0)
+#define BLOCK_UNCOMPRESSED (1U << 31)
+#define MIN_MATCH 4
+
+static inline UINT32 get_le32(const UINT8 *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+static inline UINT64 get_le64(const UINT8 *p) {
+  return get_le32(p) | ((UINT64)get_le32(p + 4) << 32);
+}
+
+// parse the frame descriptor, returns the header length or 0 if malformed
+static UINTN parse_header(const UINT8 *src, UINTN src_size, UINT8 *flg,
+                          UINT64 *content_size) {
+  if (src_size < 7 || get_le32(src) != LZ4_FRAME_MAGIC) {
+    return 0;
+  }
+  *flg = src[4];
+  if ((*flg & FLG_VERSION_MASK) != FLG_VERSION) {
+    return 0;
+  }
+
+  UINTN len = 6; // magic, FLG, BD
+  *content_size = 0;
+  if (*flg & FLG_CONTENT_SIZE) {
+    if (src_size < len + 8) {
+      return 0;
+    }
+    *content_size = get_le64(src + len);
+    len += 8;
+  }
+  if (*flg & FLG_DICT_ID) {
+    len += 4;
+  }
+  return len + 1; // header checksum
+}
+
+UINTN lz4_frame_content_size(const void *src, UINTN src_size) {
+  UINT8 flg;
+  UINT64 content_size;
+
+  if (parse_header(src, src_size, &flg, &content_size) == 0) {
+    return 0;
+  }
+  return content_size;
+}
+
+// Match copies overlap whenever offset < length, in that case the bytes
+// must be replicated in order. Longer distances copy whole words.
+static inline void copy_match(UINT8 *d, const UINT8 *m, UINTN len) {
+  if ((UINTN)(d - m) >= 8) {
+    for (; len >= 8; len -= 8, d += 8, m += 8) {
+      __builtin_memcpy(d, m, 8);
+    }
+  }
+  while (len--) {
+    *d++ = *m++;
+  }
+}
+
+static EFI_STATUS decode_block(UINT8 *dest, UINT8 *op, UINT8 *oend,
+                               const UINT8 *ip, const UINT8 *iend,
+                               UINT8 **op_out) {
+  while (ip < iend) {
+    UINT8 token = *ip++;
+
+    UINTN lit = token >> 4;
+    if (lit == 15) {
+      UINT8 b;
+      do {
+        if (ip >= iend) {
+          return EFI_COMPROMISED_DATA;
+        }
+        b = *ip++;
+        lit += b;
+      } while (b == 255);
+    }
+    if (lit > (UINTN)(iend - ip) || lit > (UINTN)(oend - op)) {
+      return EFI_COMPROMISED_DATA;
+    }
+    memcpy2(op, ip, lit);
+    op += lit;
+    ip += lit;
+
+    // the last sequence of a block has literals only
+    if (ip == iend) {
+      break;
+    }
+
+    if (iend - ip < 2) {
+      return EFI_COMPROMISED_DATA;
+    }
+    UINTN offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > (UINTN)(op - dest)) {
+      return EFI_COMPROMISED_DATA;
+    }
+
+    UINTN mlen = token & 15;
+    if (mlen == 15) {
+      UINT8 b;
+      do {
+        if (ip >= iend) {
+          return EFI_COMPROMISED_DATA;
+        }
+        b = *ip++;
+        mlen += b;
+      } while (b == 255);
+    }
+    mlen += MIN_MATCH;
+    if (mlen > (UINTN)(oend - op)) {
+      return EFI_COMPROMISED_DATA;
+    }
+    copy_match(op, op - offset, mlen);
+    op += mlen;
+  }
+
+  *op_out = op;
+  return EFI_SUCCESS;
+}
+
+EFI_STATUS lz4_decompress_frame(void *dest, UINTN dest_size, const void *src,
+                                UINTN src_size, UINTN *out_size) {
+  const UINT8 *ip = (const UINT8 *)src;
+  const UINT8 *iend = ip + src_size;
+  UINT8 *op = (UINT8 *)dest;
+  UINT8 *oend = op + dest_size;
+  UINT8 flg;
+  UINT64 content_size;
+  EFI_STATUS status;
+
+  UINTN hlen = parse_header(ip, src_size, &flg, &content_size);
+  if (hlen == 0 || hlen > src_size) {
+    return EFI_UNSUPPORTED;
+  }
+  ip += hlen;
+
+  for (;;) {
+    if (iend - ip < 4) {
+      return EFI_COMPROMISED_DATA;
+    }
+    UINT32 bsize = get_le32(ip);
+    ip += 4;
+    if (bsize == 0) {
+      break; // EndMark
+    }
+
+    UINTN len = bsize & ~BLOCK_UNCOMPRESSED;
+    if (len > (UINTN)(iend - ip)) {
+      return EFI_COMPROMISED_DATA;
+    }
+    if (bsize & BLOCK_UNCOMPRESSED) {
+      if (len > (UINTN)(oend - op)) {
+        return EFI_BUFFER_TOO_SMALL;
+      }
+      memcpy2(op, ip, len);
+      op += len;
+    } else {
+      status = decode_block((UINT8 *)dest, op, oend, ip, ip + len, &op);
+      if (EFI_ERROR(status)) {
+        return status;
+      }
+    }
+    ip += len;
+    if (flg & FLG_BLOCK_CHECKSUM) {
+      ip += 4;
+    }
+  }
+
+  *out_size = op - (UINT8 *)dest;
+  if ((flg & FLG_CONTENT_SIZE) && *out_size != content_size) {
+    return EFI_COMPROMISED_DATA;
+  }
+  return EFI_SUCCESS;
+}
@@ -5,8 +5,16 @@
 
 #include "acpi.h"
 #include "arch.h"
+#include "blksrc.h"
+#include "bootinfo.h"
+#include "boottime.h"
+#include "container.h"
 #include "core.h"
+#include "esp.h"
 #include "generated/autoconf.h"
+#include "linux_image.h"
+#include "mp.h"
+#include "parse.h"
 
 EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
 EFI_SYSTEM_TABLE *g_st;
@@ -20,53 +28,343 @@ static void print_system_info(EFI_SYSTEM_TABLE *SystemTable) {
   Print(L"[INFO] con out addr: 0x%lx\n", SystemTable->ConOut);
 }
 
-// Helper function to print binary information
-static void print_binary_info(UINTN hvisor_bin_addr) {
+// Helper function to print the payload table of contents
+static void print_binary_info(const struct container_header *container) {
   Print(L"---------------------------------------------------------------------"
         L"\n");
   Print(L"hvisor uefi packer target arch: %a\n", get_arch());
-  Print(L"hvisor binary range: 0x%lx - 0x%lx\n", hvisor_bin_addr,
-        hvisor_bin_addr + (hvisor_bin_end - hvisor_bin_start));
-#if defined(CONFIG_ENABLE_VMLINUX)
-  const UINTN hvisor_zone0_vmlinux_addr = CONFIG_VMLINUX_LOAD_ADDR;
-  Print(L"hvisor vmlinux.bin: 0x%lx - 0x%lx\n", hvisor_zone0_vmlinux_addr,
-        hvisor_zone0_vmlinux_addr +
-            (hvisor_zone0_vmlinux_end - hvisor_zone0_vmlinux_start));
-#endif
+  for (UINT32 i = 0; i < container->nr_entries; i++) {
+    const struct container_entry *e = container_entry(container, i);
+    UINTN addr = (UINTN)container_entry_addr(container, e);
+    Print(L"%-12a %-16a 0x%lx - 0x%lx, %a 0x%lx -> 0x%lx\n",
+          container_kind_name(e->kind), e->name, addr, addr + e->size,
+          container_codec_name(e->codec), e->stored_size, e->size);
+    if (e->zero_size != 0) {
+      Print(L"%-29a zero 0x%lx - 0x%lx\n", "", addr + e->size,
+            addr + e->size + e->zero_size);
+    }
+    if (e->entry != 0) {
+      Print(L"%-29a entry 0x%lx\n", "", e->entry);
+    }
+    // kernel placement and bss come from the Image header, see mkloadplan.py
+    if ((e->kind == CONTAINER_KIND_ZONE0_KERNEL ||
+         e->kind == CONTAINER_KIND_ZONE_KERNEL) &&
+        e->load_addr != 0) {
+      Print(L"%-29a footprint 0x%lx - 0x%lx, %a\n", "", addr,
+            addr + e->size + e->zero_size,
+            addr % LINUX_IMAGE_ALIGN ? "not 2 MB aligned" : "2 MB aligned");
+    }
+  }
   Print(L"---------------------------------------------------------------------"
         L"\n");
 }
 
-// Helper function to copy hvisor binary
-static void copy_hvisor_binary(UINTN hvisor_bin_addr) {
-  memcpy2((void *)hvisor_bin_addr, (void *)hvisor_bin_start,
-          hvisor_bin_end - hvisor_bin_start);
-  Print(L"[INFO] hvisor binary copied to 0x%lx, size: 0x%lx\n", hvisor_bin_addr,
-        hvisor_bin_end - hvisor_bin_start);
+// Helper function to write back every payload range before jumping into it,
+// the cost scales with the payloads rather than with the caches
+static void sync_payloads(const struct container_header *container) {
+  UINTN total = 0;
+  UINT64 start = ARCH_READ_COUNTER();
+  for (UINT32 i = 0; i < container->nr_entries; i++) {
+    const struct container_entry *e = container_entry(container, i);
+    UINTN size = e->size + e->zero_size;
+    ARCH_SYNC_RANGE(container_entry_addr(container, e), size);
+    total += size;
+  }
+  UINT64 ticks = ARCH_READ_COUNTER() - start;
+  Print(L"[INFO] sync_payloads: 0x%lx bytes in %ld us\n", total,
+        counter_to_us(ticks));
+}
+
+// Helper function to list one placed payload in the boot-info block
+static void record_payload(UINT32 kind, UINT32 zone_id, const char *name,
+                           UINTN addr, UINTN size, UINTN zero_size,
+                           UINTN entry, const UINT8 *sha256) {
+  struct boot_info_payload p = {
+      .kind = kind,
+      .zone_id = zone_id,
+      .addr = addr,
+      .size = size,
+      .zero_size = zero_size,
+      .entry = entry,
+  };
+  if (sha256 != NULL) {
+    memcpy2(p.sha256, sha256, sizeof(p.sha256));
+  }
+  for (UINTN i = 0; i < sizeof(p.name) - 1 && name[i]; i++) {
+    p.name[i] = name[i];
+  }
+  boot_info_add_payload(&p);
+}
+
+// Helper function to list every container entry in the boot-info block,
+// only hvisor and the kernels get an entry point
+static void record_payloads(const struct container_header *container) {
+  for (UINT32 i = 0; i < container->nr_entries; i++) {
+    const struct container_entry *e = container_entry(container, i);
+    BOOLEAN exec = e->kind == CONTAINER_KIND_HVISOR ||
+                   e->kind == CONTAINER_KIND_ZONE0_KERNEL ||
+                   e->kind == CONTAINER_KIND_ZONE_KERNEL;
+    record_payload(e->kind, e->zone_id, e->name,
+                   (UINTN)container_entry_addr(container, e), e->size,
+                   e->zero_size, exec ? container_entry_point(e) : 0,
+                   e->sha256);
+  }
+}
+
+#if !defined(CONFIG_PAYLOAD_SOURCE_BLOCK)
+// Helper function to place every payload at its load address
+static void load_payloads(const struct container_header *container) {
+  EFI_STATUS status = container_place(container);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] load_payloads: can't place the payloads: %a\n",
+          get_efi_status_string(status));
+    halt();
+  }
+  for (UINT32 i = 0; i < container->nr_entries; i++) {
+    const struct container_entry *e = container_entry(container, i);
+    UINTN addr = (UINTN)container_entry_addr(container, e);
+    UINTN cpus;
+
+    if (e->load_addr == 0) {
+      Print(L"[INFO] %a used in place at 0x%lx\n", e->name, addr);
+      continue;
+    }
+    status = container_reserve(e);
+    if (EFI_ERROR(status)) {
+      halt();
+    }
+    addr = (UINTN)container_entry_addr(container, e);
+    UINT64 start = ARCH_READ_COUNTER();
+    status = container_load(container, e, &cpus);
+    UINT64 ticks = ARCH_READ_COUNTER() - start;
+    if (EFI_ERROR(status)) {
+      Print(L"[ERROR] load_payloads: %a to 0x%lx failed: %a\n", e->name, addr,
+            get_efi_status_string(status));
+      halt();
+    }
+    Print(L"[INFO] %a copied to 0x%lx, size: 0x%lx, %ld MB/s on %d cpus\n",
+          e->name, addr, e->size, throughput_mbps(e->size, ticks), cpus);
+    boot_time_mark(e->name);
+  }
+}
+#endif
+
+#if defined(CONFIG_PAYLOAD_SOURCE_ESP)
+// Helper function to read one payload file from the ESP to its load address,
+// returns its size there
+static UINTN load_esp_payload(EFI_FILE_HANDLE dir, const char *name,
+                              UINTN load_addr) {
+  UINTN size;
+  UINT64 start = ARCH_READ_COUNTER();
+  EFI_STATUS status = esp_load_file(dir, name, load_addr, &size);
+  UINT64 ticks = ARCH_READ_COUNTER() - start;
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] load_esp_payload: %a to 0x%lx failed: %a\n", name,
+          load_addr, get_efi_status_string(status));
+    halt();
+  }
+  Print(L"[INFO] %a read to 0x%lx, size: 0x%lx, %ld MB/s\n", name, load_addr,
+        size, throughput_mbps(size, ticks));
+  boot_time_mark(name);
+  ARCH_SYNC_RANGE((void *)load_addr, size);
+  return size;
+}
+
+#if defined(CONFIG_ENABLE_VMLINUX) && !defined(CONFIG_ESP_VMLINUX_PE)
+// Helper function to check the kernel read from the ESP against its Image
+// header and zero its bss, nothing else around it is cleared. Returns the
+// size of the bss.
+static UINTN place_esp_kernel(const char *name, UINTN addr, UINTN size) {
+  struct linux_image img;
+  if (EFI_ERROR(parse_linux_image(addr, size, &img))) {
+    Print(L"[WARN] place_esp_kernel: %a has no Linux boot header\n", name);
+    return 0;
+  }
+  Print(L"[INFO] %a: %a Image, footprint 0x%lx - 0x%lx, bss 0x%lx, entry "
+        L"0x%lx\n",
+        name, img.arch, addr, addr + img.image_size, img.image_size - size,
+        img.entry);
+  if (!img.placed) {
+    Print(L"[WARN] place_esp_kernel: %a isn't at the 2 MB aligned base or "
+          L"link address its header asks for\n",
+          name);
+  }
+  // only the file was claimed when it was read
+  UINTN bss = addr + size;
+  if (EFI_ERROR(reserve_payload(name, &bss, img.image_size - size, 0))) {
+    halt();
+  }
+  mp_zero((void *)bss, img.image_size - size);
+  ARCH_SYNC_RANGE((void *)bss, img.image_size - size);
+  return img.image_size - size;
+}
+#endif
+
+#if defined(CONFIG_ESP_VMLINUX_PE)
+// Helper function to load the kernel PE32+ image from the ESP to *addr, or
+// wherever it had to move, returns its size in image_size. The PE entry
+// point is the EFI stub, zone0 boots the Image at *addr instead.
+static void load_esp_pe(EFI_FILE_HANDLE dir, const char *name, UINTN *addr,
+                        UINTN *image_size) {
+  void *buf;
+  UINTN size;
+  UINT64 start = ARCH_READ_COUNTER();
+  EFI_STATUS status = esp_read_file(dir, name, &buf, &size);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] load_esp_pe: can't read %a: %a\n", name,
+          get_efi_status_string(status));
+    halt();
+  }
+  UINTN entry = parse_pe((UINTN)buf, addr, size, image_size);
+  UINT64 ticks = ARCH_READ_COUNTER() - start;
+  FreePool(buf);
+  if (entry == 0) {
+    Print(L"[ERROR] load_esp_pe: can't load %a\n", name);
+    halt();
+  }
+  Print(L"[INFO] %a loaded to 0x%lx, size: 0x%lx, %ld MB/s\n", name, *addr,
+        size, throughput_mbps(size, ticks));
+  boot_time_mark(name);
 }
+#endif
 
-#if defined(CONFIG_ENABLE_VMLINUX)
-// Helper function to copy vmlinux binary
-static void copy_vmlinux_binary(void) {
-  const UINTN hvisor_zone0_vmlinux_addr = CONFIG_VMLINUX_LOAD_ADDR;
-  memcpy2((void *)hvisor_zone0_vmlinux_addr, (void *)hvisor_zone0_vmlinux_start,
-          hvisor_zone0_vmlinux_end - hvisor_zone0_vmlinux_start);
-  Print(L"[INFO] hvisor vmlinux.bin copied to 0x%lx, size: 0x%lx\n",
-        hvisor_zone0_vmlinux_addr,
-        hvisor_zone0_vmlinux_end - hvisor_zone0_vmlinux_start);
+#if defined(CONFIG_HVISOR_ELF)
+// Helper function to load the hvisor ELF from the ESP, returns its entry
+// and the span of its segments in addr and mem_size
+static UINTN load_esp_elf(EFI_FILE_HANDLE dir, const char *name, UINTN *addr,
+                          UINTN *mem_size) {
+  void *buf;
+  UINTN size;
+  UINT64 start = ARCH_READ_COUNTER();
+  EFI_STATUS status = esp_read_file(dir, name, &buf, &size);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] load_esp_elf: can't read %a: %a\n", name,
+          get_efi_status_string(status));
+    halt();
+  }
+  UINTN end;
+  UINTN entry = parse_elf((UINTN)buf, size, addr, &end);
+  UINT64 ticks = ARCH_READ_COUNTER() - start;
+  FreePool(buf);
+  if (entry == 0) {
+    Print(L"[ERROR] load_esp_elf: can't load %a\n", name);
+    halt();
+  }
+  *mem_size = end - *addr;
+  Print(L"[INFO] %a loaded, size: 0x%lx, %ld MB/s\n", name, size,
+        throughput_mbps(size, ticks));
+  boot_time_mark(name);
+  return entry;
 }
 #endif
 
+// Helper function to read hvisor and vmlinux from files next to the loader,
+// returns the hvisor entry point
+static UINTN load_esp_payloads(EFI_HANDLE ImageHandle) {
+  EFI_FILE_HANDLE dir;
+  EFI_STATUS status = esp_open_dir(ImageHandle, &dir);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] load_esp_payloads: can't open the loader directory: %a\n",
+          get_efi_status_string(status));
+    halt();
+  }
+#if defined(CONFIG_HVISOR_ELF)
+  // the span of its segments, which may leave gaps in between
+  UINTN hvisor_addr, hvisor_size;
+  UINTN entry = load_esp_elf(dir, CONFIG_ESP_HVISOR_BIN_NAME, &hvisor_addr,
+                             &hvisor_size);
+#else
+  UINTN entry = CONFIG_HVISOR_BIN_LOAD_ADDR;
+  UINTN hvisor_addr = entry;
+  UINTN hvisor_size = load_esp_payload(dir, CONFIG_ESP_HVISOR_BIN_NAME, entry);
+#endif
+  record_payload(CONTAINER_KIND_HVISOR, 0, CONFIG_ESP_HVISOR_BIN_NAME,
+                 hvisor_addr, hvisor_size, 0, entry, NULL);
+#if defined(CONFIG_ESP_VMLINUX_PE)
+  UINTN vmlinux_addr = CONFIG_VMLINUX_LOAD_ADDR, vmlinux_size;
+  load_esp_pe(dir, CONFIG_ESP_VMLINUX_NAME, &vmlinux_addr, &vmlinux_size);
+  record_payload(CONTAINER_KIND_ZONE0_KERNEL, 0, CONFIG_ESP_VMLINUX_NAME,
+                 vmlinux_addr, vmlinux_size, 0, vmlinux_addr, NULL);
+#elif defined(CONFIG_ENABLE_VMLINUX)
+  UINTN size =
+      load_esp_payload(dir, CONFIG_ESP_VMLINUX_NAME, CONFIG_VMLINUX_LOAD_ADDR);
+  UINTN zero_size =
+      place_esp_kernel(CONFIG_ESP_VMLINUX_NAME, CONFIG_VMLINUX_LOAD_ADDR, size);
+  record_payload(CONTAINER_KIND_ZONE0_KERNEL, 0, CONFIG_ESP_VMLINUX_NAME,
+                 CONFIG_VMLINUX_LOAD_ADDR, size, zero_size,
+                 CONFIG_VMLINUX_LOAD_ADDR, NULL);
+#endif
+  uefi_call_wrapper(dir->Close, 1, dir);
+  return entry;
+}
+#endif
+
+#if defined(CONFIG_PAYLOAD_SOURCE_BLOCK)
+// Helper function to open the payload container stored on the boot disk
+static void open_block_container(EFI_HANDLE ImageHandle,
+                                 struct blksrc *blksrc) {
+  EFI_HANDLE disk, handle;
+  EFI_LBA lba;
+  EFI_STATUS status = blksrc_boot_disk(ImageHandle, &disk);
+#if defined(CONFIG_PAYLOAD_BLOCK_PARTITION)
+  if (!EFI_ERROR(status)) {
+    status = blksrc_find_partition(disk, &handle, &lba);
+  }
+#else
+  handle = disk;
+  lba = CONFIG_PAYLOAD_BLOCK_LBA;
+#endif
+  if (!EFI_ERROR(status)) {
+    status = blksrc_open(blksrc, handle, lba);
+  }
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] open_block_container: no payload container on the boot "
+          L"disk: %a\n",
+          get_efi_status_string(status));
+    halt();
+  }
+  Print(L"[INFO] payload container at lba 0x%lx, %ld blocks\n", lba,
+        ALIGN_UP(blksrc->container->image_size, blksrc->block_size) /
+            blksrc->block_size);
+}
+#endif
+
+// Helper function to find where hvisor starts
+static UINTN hvisor_entry_point(const struct container_header *container) {
+#if defined(CONFIG_PAYLOAD_SOURCE_ESP)
+  // hvisor is read from the ESP, the container only holds the extras and
+  // load_esp_payloads() reports the final entry point
+  return CONFIG_HVISOR_BIN_LOAD_ADDR;
+#else
+  const struct container_entry *hvisor =
+      container_find(container, CONTAINER_KIND_HVISOR, 0);
+  if (hvisor == NULL || hvisor->load_addr == 0) {
+    Print(L"[ERROR] hvisor_entry_point: no hvisor entry in the payload "
+          L"container\n");
+    halt();
+  }
+  return container_entry_point(hvisor);
+#endif
+}
+
 // Helper function to jump to hvisor
 static void jump_to_hvisor(UINTN hvisor_bin_addr, EFI_SYSTEM_TABLE *SystemTable,
                            UINTN boot_cpu_id) {
-  UINTN system_table = (UINTN)SystemTable;
   void (*hvisor_entry)(UINTN, UINTN) = (void (*)(UINTN, UINTN))hvisor_bin_addr;
 
+  boot_time_mark("jump");
+  boot_time_report();
   print_str("[INFO] ok, ready to jump to hvisor entry...\n");
+#if defined(CONFIG_BOOT_INFO)
+  // everything the loader found out, see include/bootinfo.h
+  UINTN arg = boot_info_finish();
+#else
   // Due to hvisor don't parse system_table/device-tree, here system_table would
   // be ignored by hvisor
-  hvisor_entry(boot_cpu_id, system_table);
+  UINTN arg = (UINTN)SystemTable;
+#endif
+  console_flush();
+  hvisor_entry(boot_cpu_id, arg);
 
   // Should never reach here
   while (1) {
@@ -81,44 +379,104 @@ efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
 
   // Initialize architecture abstraction layer
   arch_detect_and_init();
+  boot_time_mark("arch init");
 
   print_str("\n\r");
   print_str("[INFO] arch_init done\n");
 
   InitializeLib(ImageHandle, SystemTable);
+  boot_time_mark("InitializeLib");
   Print(L"[INFO] UEFI bootloader initialized!\n");
   Print(L"[INFO] Hello! This is the UEFI bootloader of hvisor, arch = %a\n",
         get_arch());
-  Print(L"[INFO] hvisor binary stored in .data, from 0x%lx to 0x%lx\n",
-        hvisor_bin_start, hvisor_bin_end);
   Print(L"[INFO] CONFIG_EMBEDDED_HVISOR_BIN_PATH: %a\n",
         CONFIG_EMBEDDED_HVISOR_BIN_PATH);
 
+#if !defined(CONFIG_PAYLOAD_SOURCE_BLOCK)
+  Print(L"[INFO] payload container stored in .data, from 0x%lx to 0x%lx\n",
+        container_start, container_end);
+  const struct container_header *container =
+      (const struct container_header *)container_start;
+  status = container_check(container, container_end - container_start);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] efi_main: bad payload container: %a\n",
+          get_efi_status_string(status));
+    halt();
+  }
+  UINTN hvisor_bin_addr = hvisor_entry_point(container);
+#endif
+
   Print(L"[INFO] printing system info...\n");
   print_system_info(SystemTable);
 
-  const UINTN hvisor_bin_addr = CONFIG_HVISOR_BIN_LOAD_ADDR;
+  // APs are only usable while boot services are up, every bulk copy and
+  // clear below is joined before exit_boot_services()
+  mp_init(SystemTable);
+  boot_time_mark("mp init");
 
   Print(L"[INFO] before exit boot services...\n");
   ARCH_BEFORE_EXIT_BOOT_SERVICES();
 
+  Print(L"[INFO] clearing memory regions...\n");
+  ARCH_CLEAR_MEMORY_REGIONS();
+  boot_time_mark("clear memory");
+
+#if defined(CONFIG_PAYLOAD_SOURCE_BLOCK)
+  // the reads land in the load regions, so they come after the clear
+  struct blksrc blksrc;
+  open_block_container(ImageHandle, &blksrc);
+  const struct container_header *container = blksrc.container;
+  UINTN hvisor_bin_addr = hvisor_entry_point(container);
+#endif
+
   Print(L"[INFO] printing binary info...\n");
-  print_binary_info(hvisor_bin_addr);
+  print_binary_info(container);
 
-  Print(L"[INFO] copying hvisor binary to 0x%lx...\n", hvisor_bin_addr);
-  copy_hvisor_binary(hvisor_bin_addr);
+  Print(L"[INFO] loading %d payloads...\n", container->nr_entries);
+#if defined(CONFIG_PAYLOAD_SOURCE_BLOCK)
+  status = blksrc_load(&blksrc);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] efi_main: reading payloads from disk failed: %a\n",
+          get_efi_status_string(status));
+    halt();
+  }
+#else
+  load_payloads(container);
+#endif
+  if (EFI_ERROR(container_fixup_dtb(container))) {
+    halt();
+  }
+  sync_payloads(container);
+  boot_time_mark("sync payloads");
+  record_payloads(container);
 
-#if defined(CONFIG_ENABLE_VMLINUX)
-  Print(L"[INFO] copying vmlinux binary to 0x%lx...\n",
-        CONFIG_VMLINUX_LOAD_ADDR);
-  copy_vmlinux_binary();
+#if defined(CONFIG_PAYLOAD_SOURCE_ESP)
+  Print(L"[INFO] reading payloads from the ESP...\n");
+  hvisor_bin_addr = load_esp_payloads(ImageHandle);
 #endif
 
   EFI_BOOT_SERVICES *g_bs = SystemTable->BootServices;
   UINTN boot_cpu_id = ARCH_GET_BOOT_CPU_ID(g_bs);
 
+  // both tables are written after ExitBootServices(), their pages must be ours
+  if (EFI_ERROR(boot_time_prepare())) {
+    halt();
+  }
+#if defined(CONFIG_BOOT_INFO)
+  if (EFI_ERROR(boot_info_prepare(SystemTable, boot_cpu_id))) {
+    halt();
+  }
+#endif
   Print(L"[INFO] exiting boot services...\n");
+  console_flush();
   status = exit_boot_services(ImageHandle, SystemTable);
+  boot_time_mark("ExitBootServices");
+  if (EFI_ERROR(status)) {
+    // halt() would Print(), which may be gone already
+    console_flush();
+    while (1)
+      ;
+  }
   print_str("[INFO] exit_boot_services done\n");
 
   // Serial is already initialized in arch_detect_and_init()
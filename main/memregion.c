@@ -0,0 +1,170 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "memregion.h"
+#include "core.h"
+
+#define SIZE_2M 0x200000ULL
+#define SIZE_1G 0x40000000ULL
+
+static UINT32 region_type(UINT32 efi_type) {
+  switch (efi_type) {
+  case EfiLoaderCode:
+  case EfiLoaderData:
+  case EfiBootServicesCode:
+  case EfiBootServicesData:
+  case EfiConventionalMemory:
+    return BOOT_INFO_REGION_USABLE;
+  case EfiRuntimeServicesCode:
+  case EfiRuntimeServicesData:
+    return BOOT_INFO_REGION_RUNTIME;
+  case EfiACPIReclaimMemory:
+    return BOOT_INFO_REGION_ACPI;
+  case EfiACPIMemoryNVS:
+    return BOOT_INFO_REGION_ACPI_NVS;
+  case EfiMemoryMappedIO:
+  case EfiMemoryMappedIOPortSpace:
+    return BOOT_INFO_REGION_MMIO;
+  case EFI_HVISOR_PAYLOAD:
+    return BOOT_INFO_REGION_PAYLOAD;
+  default:
+    return BOOT_INFO_REGION_RESERVED;
+  }
+}
+
+// open a gap of n entries at i, the caller checked the room
+static void make_room(struct boot_info_region *r, UINTN nr, UINTN i,
+                      UINTN n) {
+  for (UINTN j = nr; j > i; j--) {
+    r[j - 1 + n] = r[j - 1];
+  }
+}
+
+// the memory a carve range of type may take over: usable memory, and for
+// handoff data also the payload pages it was claimed as
+static BOOLEAN carvable(UINT32 from, UINT32 type) {
+  return from == BOOT_INFO_REGION_USABLE ||
+         (from == BOOT_INFO_REGION_PAYLOAD && type == BOOT_INFO_REGION_HANDOFF);
+}
+
+// Cut [base, end) out of the regions it overlaps as type.
+static UINTN carve_out(struct boot_info_region *r, UINTN nr, UINTN max,
+                       UINT64 base, UINT64 end, UINT32 type) {
+  for (UINTN i = 0; i < nr; i++) {
+    UINT64 rs = r[i].base, re = r[i].base + r[i].size;
+    UINT32 from = r[i].type;
+    if (!carvable(from, type) || re <= base || rs >= end) {
+      continue;
+    }
+    UINT64 cs = rs > base ? rs : base, ce = re < end ? re : end;
+    UINTN pieces = (rs < cs) + 1 + (ce < re);
+    if (nr + pieces - 1 > max) {
+      return 0;
+    }
+    make_room(r, nr, i + 1, pieces - 1);
+    nr += pieces - 1;
+    if (rs < cs) {
+      r[i++] = (struct boot_info_region){rs, cs - rs, from, 0};
+    }
+    r[i] = (struct boot_info_region){cs, ce - cs, type, 0};
+    if (ce < re) {
+      r[++i] = (struct boot_info_region){ce, re - ce, from, 0};
+    }
+  }
+  return nr;
+}
+
+// pieces of a usable range so each one maps with a single block size
+static UINTN split_points(UINT64 base, UINT64 end, UINT64 *points) {
+  UINT64 cut[4] = {ALIGN_UP(base, SIZE_2M), ALIGN_UP(base, SIZE_1G),
+                   ALIGN_DOWN(end, SIZE_1G), ALIGN_DOWN(end, SIZE_2M)};
+  UINTN n = 0;
+
+  points[n++] = base;
+  for (UINTN i = 0; i < 4; i++) {
+    if (cut[i] > points[n - 1] && cut[i] < end) {
+      points[n++] = cut[i];
+    }
+  }
+  points[n++] = end;
+  return n - 1;
+}
+
+UINTN mem_regions_build(struct boot_info_region *out, UINTN max,
+                        const EFI_MEMORY_DESCRIPTOR *map, UINTN map_size,
+                        UINTN desc_size, const struct boot_info_region *carve,
+                        UINTN nr_carve) {
+  UINTN nr = 0;
+
+  // sorted insert, firmware maps are mostly in order already
+  for (UINTN off = 0; off + desc_size <= map_size; off += desc_size) {
+    const EFI_MEMORY_DESCRIPTOR *d =
+        (const EFI_MEMORY_DESCRIPTOR *)((const UINT8 *)map + off);
+    if (d->NumberOfPages == 0) {
+      continue;
+    }
+    if (nr == max) {
+      return 0;
+    }
+    UINTN i = nr;
+    while (i > 0 && out[i - 1].base > d->PhysicalStart) {
+      out[i] = out[i - 1];
+      i--;
+    }
+    out[i] = (struct boot_info_region){
+        d->PhysicalStart, d->NumberOfPages * EFI_PAGE_SIZE,
+        region_type(d->Type), 0};
+    nr++;
+  }
+
+  for (UINTN i = 0; i < nr_carve && nr != 0; i++) {
+    UINT64 base = ALIGN_DOWN(carve[i].base, EFI_PAGE_SIZE);
+    UINT64 end = ALIGN_UP(carve[i].base + carve[i].size, EFI_PAGE_SIZE);
+    if (end > base) {
+      nr = carve_out(out, nr, max, base, end, carve[i].type);
+    }
+  }
+  if (nr == 0) {
+    return 0;
+  }
+
+  UINTN merged = 0;
+  for (UINTN i = 1; i < nr; i++) {
+    struct boot_info_region *last = &out[merged];
+    if (out[i].type == last->type &&
+        out[i].base == last->base + last->size) {
+      last->size += out[i].size;
+    } else {
+      out[++merged] = out[i];
+    }
+  }
+  nr = merged + 1;
+
+  // split usable regions in place, back to front since they only grow
+  UINTN total = 0;
+  UINT64 points[6];
+  for (UINTN i = 0; i < nr; i++) {
+    total += out[i].type == BOOT_INFO_REGION_USABLE
+                 ? split_points(out[i].base, out[i].base + out[i].size, points)
+                 : 1;
+  }
+  if (total > max) {
+    return 0;
+  }
+  UINTN at = total;
+  for (UINTN i = nr; i-- > 0;) {
+    struct boot_info_region r = out[i];
+    if (r.type != BOOT_INFO_REGION_USABLE) {
+      out[--at] = r;
+      continue;
+    }
+    UINTN n = split_points(r.base, r.base + r.size, points);
+    for (UINTN j = n; j-- > 0;) {
+      out[--at] = (struct boot_info_region){
+          points[j], points[j + 1] - points[j], BOOT_INFO_REGION_USABLE, 0};
+    }
+  }
+  return total;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "mp.h"
+#include "core.h"
+
+// Work is split across the enabled APs with StartupAllAPs() in blocking mode.
+// The non-blocking variant is only completed by the firmware's AP poll timer
+// (100ms in edk2), which is far longer than any copy we do, so the BSP just
+// waits. Without the protocol every job runs on the BSP as a single worker.
+
+EFI_GUID gEfiMpServiceProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+
+static EFI_MP_SERVICES_PROTOCOL *mp;
+// processor number -> worker index, NO_WORKER for the BSP and every
+// processor that wasn't an enabled AP when mp_init() looked
+#define NO_WORKER ((UINTN)-1)
+static UINTN worker_of[MP_MAX_CPUS];
+static UINTN nr_workers = 1;
+
+struct mp_job {
+  mp_job_fn fn;
+  void *ctx;
+  volatile BOOLEAN done[MP_MAX_CPUS]; // per worker index
+};
+
+void mp_init(EFI_SYSTEM_TABLE *SystemTable) {
+  EFI_STATUS status;
+  UINTN nr_cpus, nr_enabled;
+
+  status = uefi_call_wrapper(SystemTable->BootServices->LocateProtocol, 3,
+                             &gEfiMpServiceProtocolGuid, NULL, (void **)&mp);
+  if (EFI_ERROR(status)) {
+    Print(L"[INFO] mp_init: MP services not available (%a), running serial\n",
+          get_efi_status_string(status));
+    mp = NULL;
+    return;
+  }
+
+  status = uefi_call_wrapper(mp->GetNumberOfProcessors, 3, mp, &nr_cpus,
+                             &nr_enabled);
+  if (EFI_ERROR(status)) {
+    mp = NULL;
+    return;
+  }
+
+  UINTN aps = 0;
+  for (UINTN i = 0; i < MP_MAX_CPUS; i++) {
+    worker_of[i] = NO_WORKER;
+  }
+  for (UINTN i = 0; i < nr_cpus && i < MP_MAX_CPUS; i++) {
+    EFI_PROCESSOR_INFORMATION info;
+    status = uefi_call_wrapper(mp->GetProcessorInfo, 3, mp, i, &info);
+    if (EFI_ERROR(status) || (info.StatusFlag & PROCESSOR_AS_BSP_BIT) ||
+        !(info.StatusFlag & PROCESSOR_ENABLED_BIT)) {
+      continue;
+    }
+    worker_of[i] = aps++;
+  }
+
+  if (aps == 0) {
+    mp = NULL;
+    Print(L"[INFO] mp_init: no enabled APs, running serial\n");
+    return;
+  }
+  nr_workers = aps;
+  Print(L"[INFO] mp_init: %d processors, %d APs available for payload work\n",
+        nr_cpus, aps);
+}
+
+UINTN mp_worker_count(void) { return nr_workers; }
+
+// the worker index of the calling AP, EFI_NOT_FOUND if it has none
+static EFI_STATUS ap_worker(UINTN *worker) {
+  UINTN cpu;
+  EFI_STATUS status = uefi_call_wrapper(mp->WhoAmI, 2, mp, &cpu);
+
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  if (cpu >= MP_MAX_CPUS || worker_of[cpu] == NO_WORKER) {
+    return EFI_NOT_FOUND;
+  }
+  *worker = worker_of[cpu];
+  return EFI_SUCCESS;
+}
+
+static VOID EFIAPI mp_ap_entry(VOID *arg) {
+  struct mp_job *job = (struct mp_job *)arg;
+  UINTN worker;
+
+  // an AP without a worker index stays parked, sharing another worker's
+  // chunk and context would race; mp_run() picks up the chunk of a worker
+  // that can't tell who it is
+  if (EFI_ERROR(ap_worker(&worker))) {
+    return;
+  }
+  job->fn(job->ctx, worker, nr_workers);
+  job->done[worker] = TRUE;
+}
+
+void mp_run(mp_job_fn fn, void *ctx) {
+  struct mp_job job = {.fn = fn, .ctx = ctx};
+
+  if (mp != NULL) {
+    EFI_STATUS status = uefi_call_wrapper(mp->StartupAllAPs, 7, mp,
+                                          mp_ap_entry, FALSE, NULL, 0,
+                                          (VOID *)&job, NULL);
+    if (!EFI_ERROR(status)) {
+      UINTN missed = 0;
+      for (UINTN i = 0; i < nr_workers; i++) {
+        if (!job.done[i]) {
+          fn(ctx, i, nr_workers);
+          missed++;
+        }
+      }
+      if (missed > 0) {
+        Print(L"[WARN] mp_run: %d chunks redone on the BSP\n", missed);
+      }
+      return;
+    }
+    Print(L"[WARN] mp_run: StartupAllAPs failed (%a), running serial\n",
+          get_efi_status_string(status));
+    mp = NULL;
+  }
+
+  nr_workers = 1;
+  fn(ctx, 0, 1);
+}
+
+struct mp_mem_job {
+  UINT8 *dest;
+  const UINT8 *src; // NULL for zero-fill
+  UINTN size;
+};
+
+// chunk boundaries stay page aligned so every worker starts on a fresh page
+static void mp_mem_worker(void *ctx, UINTN index, UINTN count) {
+  struct mp_mem_job *job = (struct mp_mem_job *)ctx;
+  UINTN chunk = ALIGN_UP((job->size + count - 1) / count, EFI_PAGE_SIZE);
+  UINTN off = index * chunk;
+
+  if (off >= job->size) {
+    return;
+  }
+  UINTN len = job->size - off < chunk ? job->size - off : chunk;
+  if (job->src != NULL) {
+    memcpy2(job->dest + off, job->src + off, len);
+  } else {
+    memzero(job->dest + off, len);
+  }
+}
+
+void mp_copy(void *dest, const void *src, UINTN n) {
+  struct mp_mem_job job = {
+      .dest = (UINT8 *)dest, .src = (const UINT8 *)src, .size = n};
+  mp_run(mp_mem_worker, &job);
+}
+
+void mp_zero(void *dest, UINTN n) {
+  struct mp_mem_job job = {.dest = (UINT8 *)dest, .src = NULL, .size = n};
+  mp_run(mp_mem_worker, &job);
+}
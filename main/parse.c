@@ -3,7 +3,12 @@
  * SPDX-License-Identifier: MulanPSL-2.0
  */
 
+#include "arch.h"
 #include "core.h"
+#include "elf.h"
+#include "linux_image.h"
+#include "mp.h"
+#include "parse.h"
 #include "pe.h"
 
 // Helper function to convert size to human readable string
@@ -49,19 +54,25 @@ static EFI_STATUS validate_dos_header(IMAGE_DOS_HEADER *dos_header) {
 }
 
 // Helper function to validate NT header
-static EFI_STATUS validate_nt_header(IMAGE_NT_HEADERS *nt_header) {
+static EFI_STATUS validate_nt_header(IMAGE_NT_HEADERS64 *nt_header) {
   if (nt_header->Signature != IMAGE_NT_SIGNATURE) {
     Print(L"[ERROR] parse_pe: invalid nt header: Signature = 0x%x\n",
           nt_header->Signature);
     return EFI_INVALID_PARAMETER;
   }
+  if (nt_header->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+    Print(L"[ERROR] parse_pe: not a PE32+ image: Magic = 0x%x\n",
+          nt_header->OptionalHeader.Magic);
+    return EFI_UNSUPPORTED;
+  }
   Print(L"[INFO] parse_pe: nt header is ok: Signature = 0x%x\n",
         nt_header->Signature);
   return EFI_SUCCESS;
 }
 
 // Helper function to print optional header info
-static void print_optional_header_info(IMAGE_OPTIONAL_HEADER *optional_header) {
+static void
+print_optional_header_info(IMAGE_OPTIONAL_HEADER64 *optional_header) {
   Print(L"[INFO] parse_pe: optional header:\n");
   Print(L"[INFO] parse_pe:   SizeOfCode = %d\n", optional_header->SizeOfCode);
   Print(L"[INFO] parse_pe:   SizeOfInitializedData = %d\n",
@@ -73,59 +84,202 @@ static void print_optional_header_info(IMAGE_OPTIONAL_HEADER *optional_header) {
   Print(L"[INFO] parse_pe:   BaseOfCode = 0x%lx\n",
         optional_header->BaseOfCode);
   Print(L"[INFO] parse_pe:   ImageBase = 0x%lx\n", optional_header->ImageBase);
+  Print(L"[INFO] parse_pe:   SizeOfImage = 0x%lx\n",
+        optional_header->SizeOfImage);
 }
 
-// Helper function to load section
+// Helper function to load section, the part of VirtualSize not backed by
+// the file is bss and gets zeroed
 static EFI_STATUS load_section(IMAGE_SECTION_HEADER *section_header,
                                UINTN efi_file_start_addr, UINTN efi_load_addr,
-                               UINTN efi_size, UINTN section_index) {
+                               UINTN efi_size, UINTN image_size,
+                               UINTN section_index) {
   UINTN section_start = efi_file_start_addr + section_header->PointerToRawData;
   UINTN section_size = section_header->SizeOfRawData;
-  UINTN section_end = section_start + section_size;
+  UINTN virtual_size = section_header->Misc.VirtualSize;
   UINTN section_load_addr = efi_load_addr + section_header->VirtualAddress;
 
-  Print(L"[INFO] parse_pe:   Section %d:\n", section_index);
-  Print(L"[INFO] parse_pe:     Name = %s\n",
-        parse_section_name(section_header->Name, IMAGE_SIZEOF_SHORT_NAME));
-  Print(L"[INFO] parse_pe:     VirtualSize = %d\n",
-        section_header->Misc.VirtualSize);
-  Print(L"[INFO] parse_pe:     VirtualAddress = 0x%lx\n",
-        section_header->VirtualAddress);
-  Print(L"[INFO] parse_pe:     SizeOfRawData = %d\n",
-        section_header->SizeOfRawData);
-  Print(L"[INFO] parse_pe:   section_start = 0x%lx\n", section_start);
-  Print(L"[INFO] parse_pe:   section_size = %d\n", section_size);
-  Print(L"[INFO] parse_pe:   section_end = 0x%lx\n", section_end);
-  Print(L"[INFO] parse_pe:   section_load_addr = 0x%lx\n", section_load_addr);
+  // SizeOfRawData is rounded up to FileAlignment, VirtualSize is exact
+  if (virtual_size == 0) {
+    virtual_size = section_size;
+  } else if (section_size > virtual_size) {
+    section_size = virtual_size;
+  }
+
+  Print(L"[INFO] parse_pe:   Section %d: %s at 0x%lx, file 0x%lx, bss 0x%lx\n",
+        section_index,
+        parse_section_name(section_header->Name, IMAGE_SIZEOF_SHORT_NAME),
+        section_load_addr, section_size, virtual_size - section_size);
 
   // Validate section bounds
-  if (section_end > efi_file_start_addr + efi_size) {
-    Print(L"[ERROR] parse_pe: section end out of range\n");
+  if (section_header->PointerToRawData + section_size > efi_size ||
+      section_header->VirtualAddress + virtual_size > image_size) {
+    Print(L"[ERROR] parse_pe: section out of range\n");
     return EFI_INVALID_PARAMETER;
   }
 
-  // Copy section to target location
-  CopyMem((VOID *)section_load_addr, (VOID *)section_start, section_size);
-  Print(L"[INFO] parse_pe:   memcpy2 done: from 0x%lx to 0x%lx, size = %d\n",
-        section_start, section_load_addr, section_size);
+  memcpy2((VOID *)section_load_addr, (VOID *)section_start, section_size);
+  if (virtual_size > section_size) {
+    mp_zero((VOID *)(section_load_addr + section_size),
+            virtual_size - section_size);
+  }
+  return EFI_SUCCESS;
+}
+
+// Helper function to patch the address loaded by a LoongArch
+// lu12i.w/ori/lu32i.d/lu52i.d sequence
+static void relocate_loongarch64_mark_la(UINT32 *insn, UINT64 delta) {
+  UINT64 value = (UINT64)(insn[0] & 0x1ffffe0) << 7 |
+                 (insn[1] & 0x3ffc00) >> 10 |
+                 (UINT64)(insn[2] & 0x1ffffe0) << 27 |
+                 (UINT64)(insn[3] & 0x3ffc00) << 42;
+
+  value += delta;
+  insn[0] = (insn[0] & ~0x1ffffe0) | ((value >> 7) & 0x1ffffe0);
+  insn[1] = (insn[1] & ~0x3ffc00) | ((value << 10) & 0x3ffc00);
+  insn[2] = (insn[2] & ~0x1ffffe0) | ((value >> 27) & 0x1ffffe0);
+  insn[3] = (insn[3] & ~0x3ffc00) | ((value >> 42) & 0x3ffc00);
+}
+
+// Helper function to get the bytes patched by a relocation type, 0 if the
+// type isn't supported
+static UINTN relocation_width(UINTN type) {
+  switch (type) {
+  case IMAGE_REL_BASED_HIGHLOW:
+    return sizeof(UINT32);
+  case IMAGE_REL_BASED_DIR64:
+    return sizeof(UINT64);
+  case IMAGE_REL_BASED_LOONGARCH64_MARK_LA:
+    return 4 * sizeof(UINT32);
+  default:
+    return 0;
+  }
+}
+
+// Helper function to apply the base relocations for an image that isn't
+// loaded at its ImageBase. An image without any, like a Linux vmlinux.efi
+// with ImageBase 0, is position independent unless its relocations were
+// stripped.
+static EFI_STATUS apply_relocations(IMAGE_FILE_HEADER *file_header,
+                                    IMAGE_OPTIONAL_HEADER64 *optional_header,
+                                    UINTN efi_load_addr) {
+  UINT64 delta = efi_load_addr - optional_header->ImageBase;
+  UINTN image_size = optional_header->SizeOfImage;
+  IMAGE_DATA_DIRECTORY *dir;
+
+  if (delta == 0) {
+    return EFI_SUCCESS;
+  }
+  dir = &optional_header->DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC];
+  if (optional_header->NumberOfRvaAndSizes <=
+          IMAGE_DIRECTORY_ENTRY_BASERELOC ||
+      dir->Size == 0) {
+    if (file_header->Characteristics & IMAGE_FILE_RELOCS_STRIPPED) {
+      Print(L"[ERROR] parse_pe: relocations stripped, can't move 0x%lx to "
+            L"0x%lx\n",
+            optional_header->ImageBase, efi_load_addr);
+      return EFI_LOAD_ERROR;
+    }
+    return EFI_SUCCESS;
+  }
+  if (dir->VirtualAddress + (UINT64)dir->Size > image_size) {
+    Print(L"[ERROR] parse_pe: base relocations out of range\n");
+    return EFI_INVALID_PARAMETER;
+  }
+
+  UINTN pos = dir->VirtualAddress, end = pos + dir->Size, count = 0;
+  while (pos + sizeof(IMAGE_BASE_RELOCATION) <= end) {
+    IMAGE_BASE_RELOCATION *block =
+        (IMAGE_BASE_RELOCATION *)(efi_load_addr + pos);
+    if (block->SizeOfBlock < sizeof(*block) ||
+        block->SizeOfBlock > end - pos) {
+      Print(L"[ERROR] parse_pe: bad base relocation block at 0x%lx\n", pos);
+      return EFI_INVALID_PARAMETER;
+    }
+    UINT16 *fixup = (UINT16 *)(block + 1);
+    UINTN nr_fixups = (block->SizeOfBlock - sizeof(*block)) / sizeof(*fixup);
+
+    for (UINTN i = 0; i < nr_fixups; i++) {
+      UINTN type = fixup[i] >> 12;
+      UINTN rva = block->VirtualAddress + (fixup[i] & 0xfff);
+      UINT8 *at = (UINT8 *)(efi_load_addr + rva);
 
+      if (type == IMAGE_REL_BASED_ABSOLUTE) {
+        continue;
+      }
+      UINTN width = relocation_width(type);
+      if (width == 0) {
+        Print(L"[ERROR] parse_pe: unsupported base relocation type %d\n",
+              type);
+        return EFI_UNSUPPORTED;
+      }
+      if (rva + width > image_size) {
+        Print(L"[ERROR] parse_pe: relocation at 0x%lx out of range\n", rva);
+        return EFI_INVALID_PARAMETER;
+      }
+      switch (type) {
+      case IMAGE_REL_BASED_HIGHLOW:
+        *(UINT32 *)at += (UINT32)delta;
+        break;
+      case IMAGE_REL_BASED_DIR64:
+        *(UINT64 *)at += delta;
+        break;
+      case IMAGE_REL_BASED_LOONGARCH64_MARK_LA:
+        relocate_loongarch64_mark_la((UINT32 *)at, delta);
+        break;
+      }
+      count++;
+    }
+    pos += block->SizeOfBlock;
+  }
+  Print(L"[INFO] parse_pe: %ld relocations applied, delta = 0x%lx\n", count,
+        delta);
   return EFI_SUCCESS;
 }
 
-// parse vmlinux.efi which is a PE32+ file
+// Helper function to find a free region for the image
+static UINTN alloc_load_addr(UINTN size, UINTN align) {
+  EFI_PHYSICAL_ADDRESS addr;
+  UINTN pages = EFI_SIZE_TO_PAGES(size);
+  UINTN extra = EFI_SIZE_TO_PAGES(align) - 1;
+  EFI_STATUS status;
+
+  status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages,
+                             EfiLoaderData, pages + extra, &addr);
+  if (EFI_ERROR(status)) {
+    Print(L"[ERROR] parse_pe: can't allocate 0x%lx bytes: %a\n", size,
+          get_efi_status_string(status));
+    return 0;
+  }
+  // hand back the pages the alignment didn't need
+  UINTN start = ALIGN_UP(addr, align);
+  UINTN head = EFI_SIZE_TO_PAGES(start - addr);
+  if (head > 0) {
+    uefi_call_wrapper(BS->FreePages, 2, addr, head);
+  }
+  if (extra > head) {
+    uefi_call_wrapper(BS->FreePages, 2, start + pages * EFI_PAGE_SIZE,
+                      extra - head);
+  }
+  return start;
+}
+
+// parse vmlinux.efi which is a PE32+ file and load it to *efi_load_addr,
+// or to a free SectionAlignment aligned region if that is 0 or taken. The
+// image is relocated when it doesn't land on its ImageBase.
 // if anything wrong, return 0
 // if success, return the entry point address
-UINTN parse_pe(UINTN efi_file_start_addr, UINTN efi_load_addr, UINTN efi_size) {
+UINTN parse_pe(UINTN efi_file_start_addr, UINTN *efi_load_addr,
+               UINTN efi_size, UINTN *image_size) {
   EFI_STATUS status;
   IMAGE_DOS_HEADER *dos_header;
-  IMAGE_NT_HEADERS *nt_header;
+  IMAGE_NT_HEADERS64 *nt_header;
   IMAGE_FILE_HEADER *file_header;
-  IMAGE_OPTIONAL_HEADER *optional_header;
+  IMAGE_OPTIONAL_HEADER64 *optional_header;
   IMAGE_SECTION_HEADER *section_header;
-  UINTN pe_offset, entry;
+  UINTN pe_offset, entry, load_addr;
 
   Print(L"[INFO] parse_pe: efi_file_start_addr = 0x%lx\n", efi_file_start_addr);
-  Print(L"[INFO] parse_pe: efi_load_addr = 0x%lx\n", efi_load_addr);
   Print(L"[INFO] parse_pe: efi_size = %llu (%s)\n", efi_size,
         convert_size_to_str(efi_size));
 
@@ -138,7 +292,11 @@ UINTN parse_pe(UINTN efi_file_start_addr, UINTN efi_load_addr, UINTN efi_size) {
 
   // Parse NT header
   pe_offset = dos_header->e_lfanew;
-  nt_header = (IMAGE_NT_HEADERS *)(efi_file_start_addr + pe_offset);
+  if (pe_offset + sizeof(IMAGE_NT_HEADERS64) > efi_size) {
+    Print(L"[ERROR] parse_pe: nt header out of range\n");
+    return 0;
+  }
+  nt_header = (IMAGE_NT_HEADERS64 *)(efi_file_start_addr + pe_offset);
   status = validate_nt_header(nt_header);
   if (EFI_ERROR(status)) {
     return 0;
@@ -149,25 +307,183 @@ UINTN parse_pe(UINTN efi_file_start_addr, UINTN efi_load_addr, UINTN efi_size) {
 
   print_optional_header_info(optional_header);
 
-  entry = optional_header->AddressOfEntryPoint + efi_load_addr;
+  UINTN align = optional_header->SectionAlignment;
+  align = align > EFI_PAGE_SIZE ? align : EFI_PAGE_SIZE;
+  load_addr = *efi_load_addr;
+  if (load_addr == 0) {
+    load_addr = alloc_load_addr(optional_header->SizeOfImage, align);
+    if (load_addr == 0) {
+      return 0;
+    }
+  } else if (EFI_ERROR(reserve_payload("PE image", &load_addr,
+                                       optional_header->SizeOfImage,
+                                       align))) {
+    return 0;
+  }
+  Print(L"[INFO] parse_pe: efi_load_addr = 0x%lx\n", load_addr);
+
+  entry = optional_header->AddressOfEntryPoint + load_addr;
 
   // Parse section headers
   section_header = (IMAGE_SECTION_HEADER *)((UINTN)&nt_header->OptionalHeader +
                                             file_header->SizeOfOptionalHeader);
 
-  Print(L"[INFO] parse_pe: section header@ 0x%lx:\n", (UINTN)section_header);
+  // The headers are part of the image, relocations may point into them
+  if (optional_header->SizeOfHeaders > efi_size ||
+      optional_header->SizeOfHeaders > optional_header->SizeOfImage) {
+    Print(L"[ERROR] parse_pe: headers out of range\n");
+    return 0;
+  }
+  memcpy2((VOID *)load_addr, (VOID *)efi_file_start_addr,
+          optional_header->SizeOfHeaders);
 
   // Load all sections
   for (UINTN i = 0; i < file_header->NumberOfSections; i++) {
-    status = load_section(&section_header[i], efi_file_start_addr,
-                          efi_load_addr, efi_size, i);
+    status =
+        load_section(&section_header[i], efi_file_start_addr, load_addr,
+                     efi_size, optional_header->SizeOfImage, i);
     if (EFI_ERROR(status)) {
       return 0;
     }
   }
 
-  Print(L"[INFO] parse_pe: section header end\n");
+  status = apply_relocations(file_header, optional_header, load_addr);
+  if (EFI_ERROR(status)) {
+    return 0;
+  }
+  ARCH_SYNC_RANGE((VOID *)load_addr, optional_header->SizeOfImage);
+
   Print(L"[INFO] parse_pe: entry point = 0x%lx\n", entry);
 
+  *efi_load_addr = load_addr;
+  *image_size = optional_header->SizeOfImage;
   return entry;
-}
\ No newline at end of file
+}
+
+// Helper function to validate the ELF header
+static EFI_STATUS validate_elf_header(Elf64_Ehdr *ehdr, UINTN elf_size) {
+  if (elf_size < sizeof(*ehdr) ||
+      CompareMem(ehdr->e_ident, ELFMAG, SELFMAG) != 0) {
+    Print(L"[ERROR] parse_elf: not an ELF file\n");
+    return EFI_INVALID_PARAMETER;
+  }
+  if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+      ehdr->e_ident[EI_DATA] != ELFDATA2LSB || ehdr->e_type != ET_EXEC) {
+    Print(L"[ERROR] parse_elf: not a little endian ELF64 executable\n");
+    return EFI_UNSUPPORTED;
+  }
+  if (ehdr->e_phentsize < sizeof(Elf64_Phdr) ||
+      ehdr->e_phoff + (UINT64)ehdr->e_phnum * ehdr->e_phentsize > elf_size) {
+    Print(L"[ERROR] parse_elf: program headers out of range\n");
+    return EFI_INVALID_PARAMETER;
+  }
+  return EFI_SUCCESS;
+}
+
+// load an ELF64 executable such as hvisor: every PT_LOAD segment goes to
+// its physical address, p_filesz bytes are copied and the rest of p_memsz
+// is zeroed. The file must not overlap any segment.
+// if anything wrong, return 0
+// if success, return the entry point address
+UINTN parse_elf(UINTN elf_file_start_addr, UINTN elf_size, UINTN *start,
+                UINTN *end) {
+  Elf64_Ehdr *ehdr = (Elf64_Ehdr *)elf_file_start_addr;
+  UINTN file_end = elf_file_start_addr + elf_size;
+  UINTN entry = 0, segments = 0;
+
+  *start = (UINTN)-1;
+  *end = 0;
+
+  if (EFI_ERROR(validate_elf_header(ehdr, elf_size))) {
+    return 0;
+  }
+
+  for (UINTN i = 0; i < ehdr->e_phnum; i++) {
+    Elf64_Phdr *phdr = (Elf64_Phdr *)(elf_file_start_addr + ehdr->e_phoff +
+                                      i * ehdr->e_phentsize);
+    if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+      continue;
+    }
+    UINTN dest = phdr->p_paddr;
+    if (phdr->p_filesz > phdr->p_memsz ||
+        phdr->p_offset + phdr->p_filesz > elf_size ||
+        (dest < file_end && dest + phdr->p_memsz > elf_file_start_addr)) {
+      Print(L"[ERROR] parse_elf: bad segment %d\n", i);
+      return 0;
+    }
+
+    // segments are linked where they run, they can't move
+    if (EFI_ERROR(reserve_payload("hvisor segment", &dest, phdr->p_memsz,
+                                  0))) {
+      Print(L"[ERROR] parse_elf: can't reserve segment %d\n", i);
+      return 0;
+    }
+
+    memcpy2((VOID *)dest, (VOID *)(elf_file_start_addr + phdr->p_offset),
+            phdr->p_filesz);
+    if (phdr->p_memsz > phdr->p_filesz) {
+      mp_zero((VOID *)(dest + phdr->p_filesz),
+              phdr->p_memsz - phdr->p_filesz);
+    }
+    ARCH_SYNC_RANGE((VOID *)dest, phdr->p_memsz);
+    segments++;
+    *start = dest < *start ? dest : *start;
+    *end = dest + phdr->p_memsz > *end ? dest + phdr->p_memsz : *end;
+
+    // e_entry is virtual, the loader runs on physical addresses
+    if (ehdr->e_entry >= phdr->p_vaddr &&
+        ehdr->e_entry - phdr->p_vaddr < phdr->p_memsz) {
+      entry = dest + ehdr->e_entry - phdr->p_vaddr;
+    }
+  }
+
+  if (entry == 0) {
+    Print(L"[ERROR] parse_elf: entry 0x%lx is in no segment\n",
+          ehdr->e_entry);
+    return 0;
+  }
+  Print(L"[INFO] parse_elf: %d segments in 0x%lx-0x%lx, entry point = "
+        L"0x%lx\n",
+        segments, *start, *end, entry);
+  return entry;
+}
+
+// Read the boot header of a Linux Image loaded at addr: where it wants to
+// sit, how much memory it takes including the bss and where it starts.
+EFI_STATUS parse_linux_image(UINTN addr, UINTN size, struct linux_image *img) {
+  const struct linux_arm64_header *arm64 = (const VOID *)addr;
+  const struct linux_riscv_header *riscv = (const VOID *)addr;
+  const struct linux_loongarch_header *la = (const VOID *)addr;
+
+  if (size < sizeof(*arm64)) {
+    return EFI_UNSUPPORTED;
+  }
+  img->entry = addr;
+  if (arm64->magic == LINUX_ARM64_MAGIC) {
+    img->arch = "arm64";
+    img->image_size = arm64->image_size;
+    img->placed = (addr - arm64->text_offset) % LINUX_IMAGE_ALIGN == 0;
+  } else if (riscv->magic2 == LINUX_RISCV_MAGIC) {
+    img->arch = "riscv";
+    img->image_size = riscv->image_size;
+    img->placed = addr % LINUX_IMAGE_ALIGN == 0;
+  } else if (la->magic == LINUX_LOONGARCH_MAGIC && la->mz_magic == 0x5a4d) {
+    // loaded through a DMW window, compare the physical addresses
+    UINTN phys = addr & ((1ULL << 48) - 1);
+    img->arch = "loongarch";
+    img->image_size = la->image_size;
+    img->placed = la->load_offset == 0 || la->load_offset == phys;
+    if (la->kernel_entry >= la->load_offset &&
+        la->kernel_entry - la->load_offset < la->image_size) {
+      img->entry = addr + la->kernel_entry - la->load_offset;
+    }
+  } else {
+    return EFI_UNSUPPORTED;
+  }
+
+  // old arm64 kernels leave image_size at 0, the bss is unknown then
+  if (img->image_size < size) {
+    img->image_size = size;
+  }
+  return EFI_SUCCESS;
+}
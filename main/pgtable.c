@@ -0,0 +1,328 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "pgtable.h"
+#include "arch.h"
+#include "container.h"
+#include "core.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1ULL << PAGE_SHIFT)
+#define LEVEL_BITS 9
+
+// aarch64, both stages: stage-1 expects MAIR_EL2 attr 0 normal write-back,
+// attr 1 Device-nGnRE
+#define A64_VALID (1ULL << 0)
+#define A64_TABLE_OR_PAGE (1ULL << 1)
+#define A64_ATTR_IDX(n) ((UINT64)(n) << 2)
+#define A64_S2_MEMATTR_WB (0xfULL << 2)
+#define A64_S2_MEMATTR_DEV (0x1ULL << 2)
+#define A64_S2_RW (3ULL << 6)
+#define A64_SH_INNER (3ULL << 8)
+#define A64_AF (1ULL << 10)
+#define A64_XN (1ULL << 54)
+#define A64_ADDR 0x0000fffffffff000ULL
+
+// riscv, no Svpbmt assumed, so device memory only drops X
+#define RV_V (1ULL << 0)
+#define RV_R (1ULL << 1)
+#define RV_W (1ULL << 2)
+#define RV_X (1ULL << 3)
+#define RV_U (1ULL << 4) // G-stage leaves must have it
+#define RV_A (1ULL << 6)
+#define RV_D (1ULL << 7)
+#define RV_PPN_SHIFT 10
+
+// loongarch, directories hold the plain address of the next level
+#define LA_V (1ULL << 0)
+#define LA_D (1ULL << 1)
+#define LA_MAT_CC (1ULL << 4) // coherent cached, 0 is strongly ordered
+#define LA_HUGE (1ULL << 6)
+#define LA_P (1ULL << 7)
+#define LA_W (1ULL << 8)
+
+struct pgtable_format {
+  UINT32 levels;
+  UINT32 root_pages; // 4 for the x4 stage-2 roots
+  UINT64 (*table)(UINT64 pa);
+  UINT64 (*next)(UINT64 entry);
+  // leaf of 1 << shift bytes, shift 12, 21 or 30
+  UINT64 (*leaf)(UINT64 pa, UINT32 shift, BOOLEAN device);
+};
+
+static UINT64 a64_table(UINT64 pa) {
+  return pa | A64_VALID | A64_TABLE_OR_PAGE;
+}
+static UINT64 a64_next(UINT64 entry) { return entry & A64_ADDR; }
+static UINT64 a64_type(UINT64 pa, UINT32 shift) {
+  return pa | A64_VALID | (shift == PAGE_SHIFT ? A64_TABLE_OR_PAGE : 0);
+}
+static UINT64 a64_s1_leaf(UINT64 pa, UINT32 shift, BOOLEAN device) {
+  return a64_type(pa, shift) | A64_AF | A64_SH_INNER |
+         (device ? A64_ATTR_IDX(1) | A64_XN : A64_ATTR_IDX(0));
+}
+static UINT64 a64_s2_leaf(UINT64 pa, UINT32 shift, BOOLEAN device) {
+  return a64_type(pa, shift) | A64_AF | A64_SH_INNER | A64_S2_RW |
+         (device ? A64_S2_MEMATTR_DEV | A64_XN : A64_S2_MEMATTR_WB);
+}
+
+static UINT64 rv_table(UINT64 pa) {
+  return (pa >> PAGE_SHIFT) << RV_PPN_SHIFT | RV_V;
+}
+static UINT64 rv_next(UINT64 entry) {
+  return (entry >> RV_PPN_SHIFT) << PAGE_SHIFT;
+}
+static UINT64 rv_s1_leaf(UINT64 pa, UINT32 shift, BOOLEAN device) {
+  return rv_table(pa) | RV_R | RV_W | RV_A | RV_D | (device ? 0 : RV_X);
+}
+static UINT64 rv_s2_leaf(UINT64 pa, UINT32 shift, BOOLEAN device) {
+  return rv_s1_leaf(pa, shift, device) | RV_U;
+}
+
+static UINT64 la_table(UINT64 pa) { return pa; }
+static UINT64 la_next(UINT64 entry) { return entry & ~(PAGE_SIZE - 1); }
+static UINT64 la_leaf(UINT64 pa, UINT32 shift, BOOLEAN device) {
+  return pa | LA_V | LA_D | LA_P | LA_W | (device ? 0 : LA_MAT_CC) |
+         (shift == PAGE_SHIFT ? 0 : LA_HUGE);
+}
+
+static const struct pgtable_format a64_s1 = {4, 1, a64_table, a64_next,
+                                             a64_s1_leaf};
+static const struct pgtable_format a64_s2 = {4, 1, a64_table, a64_next,
+                                             a64_s2_leaf};
+static const struct pgtable_format sv39 = {3, 1, rv_table, rv_next,
+                                           rv_s1_leaf};
+static const struct pgtable_format sv39x4 = {3, 4, rv_table, rv_next,
+                                             rv_s2_leaf};
+static const struct pgtable_format sv48 = {4, 1, rv_table, rv_next,
+                                           rv_s1_leaf};
+static const struct pgtable_format sv48x4 = {4, 4, rv_table, rv_next,
+                                             rv_s2_leaf};
+static const struct pgtable_format la_s2 = {4, 1, la_table, la_next,
+                                            la_leaf};
+
+static UINT8 *pool, *pool_cur, *pool_end;
+
+UINTN pgtable_prepare(void) {
+  EFI_PHYSICAL_ADDRESS addr;
+  EFI_STATUS status = uefi_call_wrapper(
+      BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData,
+      EFI_SIZE_TO_PAGES(CONFIG_PAGE_TABLES_SIZE), &addr);
+  if (EFI_ERROR(status)) {
+    Print(L"[WARN] pgtable_prepare: can't reserve 0x%lx bytes: %a\n",
+          CONFIG_PAGE_TABLES_SIZE, get_efi_status_string(status));
+    return 0;
+  }
+  pool = (UINT8 *)addr;
+  Print(L"[INFO] pgtable_prepare: pool at 0x%lx\n", addr);
+  return addr;
+}
+
+// Tables are aligned to their size, the 16 KB x4 roots included.
+static UINT64 *alloc_table(UINTN pages) {
+  UINT8 *t8 = (UINT8 *)ALIGN_UP((UINTN)pool_cur, pages * PAGE_SIZE);
+  if (t8 > pool_end || pages * PAGE_SIZE > (UINTN)(pool_end - t8)) {
+    return NULL;
+  }
+  pool_cur = t8;
+  UINT64 *t = (UINT64 *)pool_cur;
+  memzero(t, pages * PAGE_SIZE);
+  pool_cur += pages * PAGE_SIZE;
+  return t;
+}
+
+static UINT32 level_shift(const struct pgtable_format *f, UINT32 level) {
+  return PAGE_SHIFT + LEVEL_BITS * (f->levels - 1 - level);
+}
+
+static UINTN level_index(const struct pgtable_format *f, UINT32 level,
+                         UINT64 addr) {
+  UINT64 entries = 1ULL << LEVEL_BITS;
+  if (level == 0) {
+    entries *= f->root_pages;
+  }
+  return (addr >> level_shift(f, level)) & (entries - 1);
+}
+
+// Map [base, end) to itself with the largest 1 GB or 2 MB blocks the
+// alignment allows, 4 KB pages around them.
+static EFI_STATUS map_range(const struct pgtable_format *f, UINT64 *root,
+                            UINT64 base, UINT64 end, BOOLEAN device) {
+  base = ALIGN_DOWN(base, PAGE_SIZE);
+  end = ALIGN_UP(end, PAGE_SIZE);
+  while (base < end) {
+    UINT32 leaf = f->levels - 1;
+    for (UINT32 l = 0; l < f->levels - 1; l++) {
+      UINT64 size = 1ULL << level_shift(f, l);
+      if (level_shift(f, l) <= 30 && base % size == 0 && end - base >= size) {
+        leaf = l;
+        break;
+      }
+    }
+
+    UINT64 *table = root;
+    for (UINT32 l = 0; l < leaf; l++) {
+      UINT64 *e = &table[level_index(f, l, base)];
+      if (*e == 0) {
+        UINT64 *next = alloc_table(1);
+        if (next == NULL) {
+          return EFI_OUT_OF_RESOURCES;
+        }
+        *e = f->table((UINT64)next);
+      }
+      table = (UINT64 *)f->next(*e);
+    }
+    UINT32 shift = level_shift(f, leaf);
+    table[level_index(f, leaf, base)] = f->leaf(base, shift, device);
+    base += 1ULL << shift;
+  }
+  return EFI_SUCCESS;
+}
+
+// zone0 gets a payload region except for the pages hvisor's own payloads
+// take, whatever else the loader claimed there was set aside for zone0
+static EFI_STATUS map_payloads(const struct pgtable_format *f, UINT64 *root,
+                               const struct boot_info_region *r,
+                               const struct boot_info_payload *payloads,
+                               UINTN nr_payloads) {
+  UINT64 cur = r->base, end = r->base + r->size;
+
+  while (cur < end) {
+    // the first hvisor range still ahead of cur
+    UINT64 hole = end, hole_end = end;
+    for (UINTN i = 0; i < nr_payloads; i++) {
+      const struct boot_info_payload *p = &payloads[i];
+      UINT64 base = ALIGN_DOWN(arch_phys_addr(p->addr), PAGE_SIZE);
+      UINT64 top = ALIGN_UP(arch_phys_addr(p->addr) + p->size + p->zero_size,
+                            PAGE_SIZE);
+      if (p->kind != CONTAINER_KIND_HVISOR || top <= cur || base >= end ||
+          base == top) {
+        continue;
+      }
+      base = base < cur ? cur : base;
+      if (base < hole || (base == hole && top > hole_end)) {
+        hole = base;
+        hole_end = top;
+      }
+    }
+    if (hole > cur) {
+      EFI_STATUS status = map_range(f, root, cur, hole, FALSE);
+      if (EFI_ERROR(status)) {
+        return status;
+      }
+    }
+    cur = hole_end;
+  }
+  return EFI_SUCCESS;
+}
+
+static EFI_STATUS build(const struct pgtable_format *f, BOOLEAN stage2,
+                        const struct boot_info_region *regions, UINTN nr,
+                        const struct boot_info_payload *payloads,
+                        UINTN nr_payloads, UINT64 *root_out) {
+  UINT64 *root = alloc_table(f->root_pages);
+  EFI_STATUS status = EFI_SUCCESS;
+  UINT64 lowest = 0, gap = 0;
+
+  if (root == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  for (UINTN i = 0; i < nr; i++) {
+    if (regions[i].type != BOOT_INFO_REGION_RESERVED &&
+        regions[i].type != BOOT_INFO_REGION_MMIO) {
+      lowest = regions[i].base;
+      break;
+    }
+  }
+  // the UART, the interrupt controller and friends usually sit below RAM,
+  // the gaps between what the map lists there are taken as device memory
+  for (UINTN i = 0; i < nr && regions[i].base < lowest && !EFI_ERROR(status);
+       i++) {
+    if (regions[i].base > gap) {
+      status = map_range(f, root, gap, regions[i].base, TRUE);
+    }
+    gap = regions[i].base + regions[i].size;
+  }
+  if (gap < lowest && !EFI_ERROR(status)) {
+    status = map_range(f, root, gap, lowest, TRUE);
+  }
+
+  for (UINTN i = 0; i < nr && !EFI_ERROR(status); i++) {
+    const struct boot_info_region *r = &regions[i];
+    switch (r->type) {
+    case BOOT_INFO_REGION_RESERVED:
+      break;
+    case BOOT_INFO_REGION_MMIO:
+      status = map_range(f, root, r->base, r->base + r->size, TRUE);
+      break;
+    case BOOT_INFO_REGION_PAYLOAD:
+      status = stage2 ? map_payloads(f, root, r, payloads, nr_payloads)
+                      : map_range(f, root, r->base, r->base + r->size, FALSE);
+      break;
+    case BOOT_INFO_REGION_HANDOFF:
+      if (stage2) {
+        break;
+      }
+      // fall through
+    default:
+      status = map_range(f, root, r->base, r->base + r->size, FALSE);
+      break;
+    }
+  }
+  *root_out = (UINT64)root;
+  return status;
+}
+
+EFI_STATUS pgtable_build(const struct boot_info_region *regions, UINTN nr,
+                         const struct boot_info_payload *payloads,
+                         UINTN nr_payloads, struct boot_info_page_tables *pt) {
+  const struct pgtable_format *s1 = NULL, *s2;
+  EFI_STATUS status = EFI_SUCCESS;
+
+  if (pool == NULL) {
+    return EFI_NOT_READY;
+  }
+  pool_cur = pool;
+  pool_end = pool + CONFIG_PAGE_TABLES_SIZE;
+  memzero(pt, sizeof(*pt));
+
+  switch (ARCH_TYPE()) {
+  case ARCH_AARCH64:
+    pt->format = BOOT_INFO_PGTABLE_AARCH64_4K;
+    s1 = &a64_s1;
+    s2 = &a64_s2;
+    break;
+  case ARCH_RISCV64:
+#if defined(CONFIG_PAGE_TABLES_RISCV_SV48)
+    pt->format = BOOT_INFO_PGTABLE_RISCV_SV48;
+    s1 = &sv48;
+    s2 = &sv48x4;
+#else
+    pt->format = BOOT_INFO_PGTABLE_RISCV_SV39;
+    s1 = &sv39;
+    s2 = &sv39x4;
+#endif
+    break;
+  case ARCH_LOONGARCH64:
+    pt->format = BOOT_INFO_PGTABLE_LOONGARCH_4K;
+    s2 = &la_s2;
+    break;
+  default:
+    return EFI_UNSUPPORTED;
+  }
+  pt->levels = s2->levels;
+  if (s1 != NULL) {
+    status = build(s1, FALSE, regions, nr, payloads, nr_payloads,
+                   &pt->stage1_root);
+  }
+  if (!EFI_ERROR(status)) {
+    status = build(s2, TRUE, regions, nr, payloads, nr_payloads,
+                   &pt->stage2_root);
+  }
+  pt->pool = (UINT64)pool;
+  pt->pool_size = pool_cur - pool;
+  ARCH_SYNC_RANGE(pool, pool_cur - pool);
+  return status;
+}
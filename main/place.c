@@ -0,0 +1,149 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "place.h"
+#include "core.h"
+
+#define SIZE_2M 0x200000ULL
+#define SIZE_1G 0x40000000ULL
+
+// specific purpose memory (HBM, CXL, ...) the OS isn't meant to take
+#ifndef EFI_MEMORY_SP
+#define EFI_MEMORY_SP 0x0000000000040000
+#endif
+
+struct place_range {
+  UINT64 base;
+  UINT64 end;
+};
+
+// Sorted, merged free memory of the map, 0 if there are too many ranges.
+static UINTN free_ranges(struct place_range *r,
+                         const EFI_MEMORY_DESCRIPTOR *map, UINTN map_size,
+                         UINTN desc_size) {
+  UINTN nr = 0;
+
+  for (UINTN off = 0; off + desc_size <= map_size; off += desc_size) {
+    const EFI_MEMORY_DESCRIPTOR *d =
+        (const EFI_MEMORY_DESCRIPTOR *)((const UINT8 *)map + off);
+    if (d->Type != EfiConventionalMemory || d->NumberOfPages == 0 ||
+        !(d->Attribute & EFI_MEMORY_WB) || (d->Attribute & EFI_MEMORY_SP)) {
+      continue;
+    }
+    if (nr == PLACE_MAX_RANGES) {
+      return 0;
+    }
+    UINTN i = nr++;
+    while (i > 0 && r[i - 1].base > d->PhysicalStart) {
+      r[i] = r[i - 1];
+      i--;
+    }
+    r[i].base = d->PhysicalStart;
+    r[i].end = d->PhysicalStart + d->NumberOfPages * EFI_PAGE_SIZE;
+  }
+
+  UINTN merged = 0;
+  for (UINTN i = 1; i < nr; i++) {
+    if (r[i].base == r[merged].end) {
+      r[merged].end = r[i].end;
+    } else {
+      r[++merged] = r[i];
+    }
+  }
+  return nr ? merged + 1 : 0;
+}
+
+// Take [base, end) out of the free ranges, 0 if a split doesn't fit.
+static UINTN take(struct place_range *r, UINTN nr, UINT64 base, UINT64 end) {
+  for (UINTN i = 0; i < nr; i++) {
+    if (r[i].end <= base || r[i].base >= end) {
+      continue;
+    }
+    if (r[i].base < base && r[i].end > end) {
+      if (nr == PLACE_MAX_RANGES) {
+        return 0;
+      }
+      for (UINTN j = nr++; j > i + 1; j--) {
+        r[j] = r[j - 1];
+      }
+      r[i + 1] = (struct place_range){end, r[i].end};
+      r[i].end = base;
+      return nr;
+    }
+    if (r[i].base < base) {
+      r[i].end = base;
+    } else if (r[i].end > end) {
+      r[i].base = end;
+    } else {
+      r[i].base = r[i].end; // empty, left in place
+    }
+  }
+  return nr;
+}
+
+// largest free range taking size bytes at align, its aligned start in *at
+static BOOLEAN best_fit(const struct place_range *r, UINTN nr, UINT64 size,
+                        UINT64 align, UINT64 *at) {
+  UINT64 best = 0;
+
+  for (UINTN i = 0; i < nr; i++) {
+    UINT64 start = ALIGN_UP(r[i].base, align);
+    if (start < r[i].base || start + size > r[i].end ||
+        r[i].end - r[i].base <= best) {
+      continue;
+    }
+    best = r[i].end - r[i].base;
+    *at = start;
+  }
+  return best != 0;
+}
+
+EFI_STATUS place_payloads(struct place_request *req, UINTN nr,
+                          const EFI_MEMORY_DESCRIPTOR *map, UINTN map_size,
+                          UINTN desc_size) {
+  struct place_range r[PLACE_MAX_RANGES];
+  UINT64 done = 0;
+
+  if (nr > PLACE_MAX_REQUESTS) {
+    return EFI_UNSUPPORTED;
+  }
+  UINTN nr_free = free_ranges(r, map, map_size, desc_size);
+  for (UINTN i = 0; i < nr && nr_free != 0; i++) {
+    if (req[i].fixed) {
+      nr_free = take(r, nr_free, ALIGN_DOWN(req[i].addr, EFI_PAGE_SIZE),
+                     ALIGN_UP(req[i].addr + req[i].size, EFI_PAGE_SIZE));
+      done |= 1ULL << i;
+    }
+  }
+
+  // no free ranges left shows up as no room for the next request
+  for (;;) {
+    UINTN next = nr;
+    for (UINTN i = 0; i < nr; i++) {
+      if (!(done & (1ULL << i)) &&
+          (next == nr || req[i].size > req[next].size)) {
+        next = i;
+      }
+    }
+    if (next == nr) {
+      return EFI_SUCCESS;
+    }
+
+    struct place_request *p = &req[next];
+    UINT64 size = ALIGN_UP(p->size, EFI_PAGE_SIZE);
+    UINT64 align = p->align > EFI_PAGE_SIZE ? p->align : EFI_PAGE_SIZE;
+    UINT64 block = size >= SIZE_1G ? SIZE_1G : SIZE_2M;
+    UINT64 at;
+    if (!best_fit(r, nr_free, size, align > block ? align : block, &at) &&
+        !best_fit(r, nr_free, size, align, &at)) {
+      Print(L"[ERROR] place_payloads: no free range for %a, 0x%lx bytes\n",
+            p->name, size);
+      return EFI_OUT_OF_RESOURCES;
+    }
+    nr_free = take(r, nr_free, at, at + size);
+    p->addr = at;
+    done |= 1ULL << next;
+  }
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "sha256.h"
+
+// FIPS 180-4
+static const UINT32 k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline UINT32 ror(UINT32 x, UINT32 n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_block(UINT32 h[8], const UINT8 *p) {
+  UINT32 w[64];
+
+  for (int i = 0; i < 16; i++) {
+    w[i] = ((UINT32)p[4 * i] << 24) | ((UINT32)p[4 * i + 1] << 16) |
+           ((UINT32)p[4 * i + 2] << 8) | p[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+    UINT32 s0 = ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    UINT32 s1 = ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  UINT32 a = h[0], b = h[1], c = h[2], d = h[3];
+  UINT32 e = h[4], f = h[5], g = h[6], hh = h[7];
+  for (int i = 0; i < 64; i++) {
+    UINT32 t1 = hh + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) +
+                ((e & f) ^ (~e & g)) + k[i] + w[i];
+    UINT32 t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) +
+                ((a & b) ^ (a & c) ^ (b & c));
+    hh = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+  h[5] += f;
+  h[6] += g;
+  h[7] += hh;
+}
+
+void sha256(const void *data, UINTN size, UINT8 digest[SHA256_DIGEST_SIZE]) {
+  UINT32 h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  const UINT8 *p = (const UINT8 *)data;
+  UINT8 tail[128];
+  UINTN n = size;
+
+  for (; n >= 64; n -= 64, p += 64) {
+    sha256_block(h, p);
+  }
+
+  // padding: 0x80, zeros, then the bit length big endian
+  UINTN tail_len = n < 56 ? 64 : 128;
+  for (UINTN i = 0; i < tail_len; i++) {
+    tail[i] = i < n ? p[i] : 0;
+  }
+  tail[n] = 0x80;
+  UINT64 bits = (UINT64)size * 8;
+  for (int i = 0; i < 8; i++) {
+    tail[tail_len - 1 - i] = bits >> (8 * i);
+  }
+  sha256_block(h, tail);
+  if (tail_len == 128) {
+    sha256_block(h, tail + 64);
+  }
+
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i] = h[i] >> 24;
+    digest[4 * i + 1] = h[i] >> 16;
+    digest[4 * i + 2] = h[i] >> 8;
+    digest[4 * i + 3] = h[i];
+  }
+}
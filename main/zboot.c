@@ -0,0 +1,112 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "zboot.h"
+#include "core.h"
+#include "gzip.h"
+#include "zstd.h"
+
+#define MZ_MAGIC 0x5a4d
+
+enum zboot_codec { ZBOOT_UNSUPPORTED, ZBOOT_GZIP, ZBOOT_ZSTD };
+
+// comp_type is the compression the kernel was built with, see
+// drivers/firmware/efi/libstub/Makefile.zboot
+static enum zboot_codec zboot_codec(const struct zboot_header *h) {
+  char type[sizeof(h->comp_type) + 1];
+
+  CopyMem(type, h->comp_type, sizeof(h->comp_type));
+  type[sizeof(h->comp_type)] = 0;
+  if (strcmpa((CHAR8 *)type, (CHAR8 *)"gzip") == 0) {
+    return ZBOOT_GZIP;
+  }
+  if (strcmpa((CHAR8 *)type, (CHAR8 *)"zstd22") == 0 ||
+      strcmpa((CHAR8 *)type, (CHAR8 *)"zstd") == 0) {
+    return ZBOOT_ZSTD;
+  }
+  Print(L"[ERROR] zboot_codec: unsupported compression %a\n", type);
+  return ZBOOT_UNSUPPORTED;
+}
+
+BOOLEAN zboot_detect(const void *src, UINTN src_size) {
+  const struct zboot_header *h = src;
+
+  return src_size >= sizeof(*h) && (h->mz_magic & 0xffff) == MZ_MAGIC &&
+         h->image_type == ZBOOT_IMAGE_TYPE;
+}
+
+// locate the compressed payload, zstd22 is followed by the decoded size
+static EFI_STATUS zboot_payload(const void *src, UINTN src_size,
+                                const UINT8 **payload, UINTN *payload_size,
+                                UINTN *content_size) {
+  const struct zboot_header *h = src;
+
+  if (!zboot_detect(src, src_size)) {
+    return EFI_UNSUPPORTED;
+  }
+  enum zboot_codec codec = zboot_codec(h);
+  UINTN trailer = codec == ZBOOT_ZSTD ? 4 : 0;
+  if (codec == ZBOOT_UNSUPPORTED) {
+    return EFI_UNSUPPORTED;
+  }
+  if (h->payload_offset > src_size ||
+      (UINTN)h->payload_size + trailer > src_size - h->payload_offset) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  *payload = (const UINT8 *)src + h->payload_offset;
+  *payload_size = h->payload_size;
+  if (codec == ZBOOT_GZIP) {
+    *content_size = gzip_content_size(*payload, *payload_size);
+  } else {
+    CopyMem(content_size, *payload + *payload_size, 4);
+    *content_size &= 0xffffffff;
+  }
+  return *content_size ? EFI_SUCCESS : EFI_COMPROMISED_DATA;
+}
+
+UINTN zboot_content_size(const void *src, UINTN src_size) {
+  const UINT8 *payload;
+  UINTN payload_size, content_size;
+
+  if (EFI_ERROR(zboot_payload(src, src_size, &payload, &payload_size,
+                              &content_size))) {
+    return 0;
+  }
+  return content_size;
+}
+
+EFI_STATUS zboot_decompress(void *dest, UINTN dest_size, const void *src,
+                            UINTN src_size, UINTN *out_size) {
+  const UINT8 *payload;
+  UINTN payload_size, content_size;
+  EFI_STATUS status;
+
+  status = zboot_payload(src, src_size, &payload, &payload_size,
+                         &content_size);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  if (content_size > dest_size) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  if (zboot_codec(src) == ZBOOT_GZIP) {
+    status = gzip_decompress(dest, content_size, payload, payload_size,
+                             out_size);
+  } else {
+    struct zstd_dctx *dctx = zstd_alloc_dctx();
+    if (dctx == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+    }
+    status = zstd_decompress_frame(dctx, dest, content_size, payload,
+                                   payload_size, out_size);
+    zstd_free_dctx(dctx);
+  }
+  if (!EFI_ERROR(status) && *out_size != content_size) {
+    status = EFI_COMPROMISED_DATA;
+  }
+  return status;
+}
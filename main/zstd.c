@@ -0,0 +1,936 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+#include "zstd.h"
+#include "core.h"
+#include "mp.h"
+
+// Single-pass zstd frame decoder after RFC 8878. The whole frame is decoded
+// in place at its destination, so there is no window buffer: matches are
+// copied from output that is already there. Dictionaries and the content
+// checksum are not supported/verified.
+
+#define BLOCK_SIZE_MAX (128 * 1024)
+
+#define HUF_TABLELOG_MAX 11
+#define HUF_WEIGHT_TABLELOG_MAX 6
+
+#define LL_MAX_SYMBOL 35
+#define ML_MAX_SYMBOL 52
+#define OF_MAX_SYMBOL 31
+#define LL_MAX_LOG 9
+#define ML_MAX_LOG 9
+#define OF_MAX_LOG 8
+#define FSE_TABLE_MAX (1 << 9)
+
+enum { BLOCK_RAW = 0, BLOCK_RLE = 1, BLOCK_COMPRESSED = 2 };
+enum { LIT_RAW = 0, LIT_RLE = 1, LIT_COMPRESSED = 2, LIT_TREELESS = 3 };
+enum { SEQ_PREDEFINED = 0, SEQ_RLE = 1, SEQ_FSE = 2, SEQ_REPEAT = 3 };
+
+struct fse_entry {
+  UINT16 new_state;
+  UINT8 symbol;
+  UINT8 nb_bits;
+};
+
+struct fse_table {
+  struct fse_entry e[FSE_TABLE_MAX];
+  UINT32 log;
+  BOOLEAN valid;
+};
+
+struct huf_entry {
+  UINT8 symbol;
+  UINT8 nb_bits;
+};
+
+struct zstd_dctx {
+  // sequence and literal tables survive across blocks for Repeat/Treeless
+  struct fse_table ll, of, ml;
+  struct huf_entry huf[1 << HUF_TABLELOG_MAX];
+  UINT32 huf_log; // 0 while there is no table yet
+  UINT64 rep[3];
+  UINT8 literals[BLOCK_SIZE_MAX];
+};
+
+// RFC 8878 3.1.1.3.2.2
+static const INT16 ll_default_norm[LL_MAX_SYMBOL + 1] = {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1, -1, -1, -1, -1};
+static const INT16 ml_default_norm[ML_MAX_SYMBOL + 1] = {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1,  1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,  1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1, -1, -1};
+static const INT16 of_default_norm[OF_MAX_SYMBOL - 2] = {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1};
+
+static const UINT32 ll_base[LL_MAX_SYMBOL + 1] = {
+    0,  1,  2,  3,  4,  5,   6,   7,   8,   9,    10,   11,
+    12, 13, 14, 15, 16, 18,  20,  22,  24,  28,   32,   40,
+    48, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536};
+static const UINT8 ll_bits[LL_MAX_SYMBOL + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,  1,  1,
+    1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+static const UINT32 ml_base[ML_MAX_SYMBOL + 1] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  12,  13,   14,   15,   16,
+    17, 18, 19, 20, 21, 22, 23, 24, 25,  26,  27,   28,   29,   30,
+    31, 32, 33, 34, 35, 37, 39, 41, 43,  47,  51,   59,   67,   83,
+    99, 131, 259, 515, 1027, 2051, 4099, 8195, 16387, 32771, 65539};
+static const UINT8 ml_bits[ML_MAX_SYMBOL + 1] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1,  1,
+    2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+
+static inline UINT32 highbit(UINT32 v) { return 31 - __builtin_clz(v); }
+
+static inline UINT16 get_le16(const UINT8 *p) { return p[0] | (p[1] << 8); }
+
+static inline UINT32 get_le24(const UINT8 *p) {
+  return p[0] | (p[1] << 8) | ((UINT32)p[2] << 16);
+}
+
+static inline UINT32 get_le32(const UINT8 *p) {
+  return get_le24(p) | ((UINT32)p[3] << 24);
+}
+
+// n (<= 56) bits starting at bit pos of a little-endian stream. Positions
+// before the start of the stream read as zero, which is what the backward
+// streams expect when the final states are loaded.
+static inline UINT64 load_bits(const UINT8 *buf, UINTN size, INT64 pos,
+                               UINT32 n) {
+  if (n == 0) {
+    return 0;
+  }
+  if (pos < 0) {
+    if (pos + (INT64)n <= 0) {
+      return 0;
+    }
+    return load_bits(buf, size, 0, n + pos) << -pos;
+  }
+
+  UINTN byte = pos >> 3;
+  UINT64 v = 0;
+  if (byte + 8 <= size) {
+    __builtin_memcpy(&v, buf + byte, 8);
+  } else {
+    for (UINTN i = 0; i < 8 && byte + i < size; i++) {
+      v |= (UINT64)buf[byte + i] << (8 * i);
+    }
+  }
+  return (v >> (pos & 7)) & ((1ULL << n) - 1);
+}
+
+// backward bitstream, read from the last byte towards the first
+struct bits {
+  const UINT8 *buf;
+  UINTN size;
+  INT64 pos; // bits left, goes negative once the stream is overread
+};
+
+static EFI_STATUS bits_init(struct bits *b, const UINT8 *buf, UINTN size) {
+  // the last byte carries the end-of-stream marker bit
+  if (size == 0 || buf[size - 1] == 0) {
+    return EFI_COMPROMISED_DATA;
+  }
+  b->buf = buf;
+  b->size = size;
+  b->pos = (INT64)size * 8 - 8 + highbit(buf[size - 1]);
+  return EFI_SUCCESS;
+}
+
+static inline UINT64 bits_read(struct bits *b, UINT32 n) {
+  b->pos -= n;
+  return load_bits(b->buf, b->size, b->pos, n);
+}
+
+static EFI_STATUS fse_read_ncount(INT16 *norm, UINT32 *max_symbol,
+                                  UINT32 *table_log, UINT32 max_log,
+                                  const UINT8 *src, UINTN size,
+                                  UINTN *consumed) {
+  if (size == 0) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  UINTN pos = 4;
+  UINT32 log = (src[0] & 0xf) + 5;
+  if (log > max_log) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  INT32 remaining = (1 << log) + 1;
+  INT32 threshold = 1 << log;
+  UINT32 nb_bits = log + 1;
+  UINT32 sym = 0;
+  BOOLEAN prev0 = FALSE;
+
+  while (remaining > 1 && sym <= *max_symbol) {
+    if (prev0) {
+      UINT32 repeat;
+      do {
+        repeat = load_bits(src, size, pos, 2);
+        pos += 2;
+        for (UINT32 i = 0; i < repeat; i++) {
+          if (sym > *max_symbol) {
+            return EFI_COMPROMISED_DATA;
+          }
+          norm[sym++] = 0;
+        }
+      } while (repeat == 3);
+      if (sym > *max_symbol) {
+        return EFI_COMPROMISED_DATA;
+      }
+    }
+
+    INT32 bits = load_bits(src, size, pos, nb_bits);
+    INT32 max = (2 * threshold - 1) - remaining;
+    INT32 count;
+    if ((bits & (threshold - 1)) < max) {
+      count = bits & (threshold - 1);
+      pos += nb_bits - 1;
+    } else {
+      count = bits & (2 * threshold - 1);
+      if (count >= threshold) {
+        count -= max;
+      }
+      pos += nb_bits;
+    }
+
+    count--; // -1 is "less than 1", it still takes one slot
+    remaining -= count < 0 ? -count : count;
+    norm[sym++] = count;
+    prev0 = count == 0;
+    if (remaining < 1) {
+      return EFI_COMPROMISED_DATA;
+    }
+    while (remaining < threshold) {
+      nb_bits--;
+      threshold >>= 1;
+    }
+  }
+
+  if (remaining != 1 || pos > size * 8) {
+    return EFI_COMPROMISED_DATA;
+  }
+  *max_symbol = sym - 1;
+  *table_log = log;
+  *consumed = (pos + 7) / 8;
+  return EFI_SUCCESS;
+}
+
+static EFI_STATUS fse_build(struct fse_entry *t, const INT16 *norm,
+                            UINT32 max_symbol, UINT32 log) {
+  UINT32 size = 1 << log;
+  UINT32 high = size - 1;
+  UINT16 next[ML_MAX_SYMBOL + 1];
+
+  // "less than 1" symbols sit at the top of the table
+  for (UINT32 s = 0; s <= max_symbol; s++) {
+    if (norm[s] == -1) {
+      t[high--].symbol = s;
+      next[s] = 1;
+    } else {
+      next[s] = norm[s];
+    }
+  }
+
+  UINT32 step = (size >> 1) + (size >> 3) + 3;
+  UINT32 pos = 0;
+  for (UINT32 s = 0; s <= max_symbol; s++) {
+    for (INT32 i = 0; i < norm[s]; i++) {
+      t[pos].symbol = s;
+      do {
+        pos = (pos + step) & (size - 1);
+      } while (pos > high);
+    }
+  }
+  if (pos != 0) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  for (UINT32 u = 0; u < size; u++) {
+    UINT32 x = next[t[u].symbol]++;
+    UINT32 nb = log - highbit(x);
+    t[u].nb_bits = nb;
+    t[u].new_state = (x << nb) - size;
+  }
+  return EFI_SUCCESS;
+}
+
+static EFI_STATUS huf_read_table(struct zstd_dctx *d, const UINT8 *src,
+                                 UINTN size, UINTN *consumed) {
+  UINT8 weights[256];
+  UINT32 nw = 0;
+  EFI_STATUS status;
+
+  if (size == 0) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  UINT32 header = src[0];
+  if (header >= 128) {
+    // direct representation, 4 bits per weight
+    nw = header - 127;
+    UINTN bytes = (nw + 1) / 2;
+    if (1 + bytes > size) {
+      return EFI_COMPROMISED_DATA;
+    }
+    for (UINT32 i = 0; i < nw; i++) {
+      UINT8 b = src[1 + i / 2];
+      weights[i] = (i & 1) ? (b & 0xf) : (b >> 4);
+    }
+    *consumed = 1 + bytes;
+  } else {
+    // FSE compressed weights, two interleaved states
+    struct fse_entry t[1 << HUF_WEIGHT_TABLELOG_MAX];
+    INT16 norm[16];
+    UINT32 max_symbol = 15, log;
+    UINTN used;
+    struct bits b;
+
+    if (1 + header > size) {
+      return EFI_COMPROMISED_DATA;
+    }
+    status = fse_read_ncount(norm, &max_symbol, &log, HUF_WEIGHT_TABLELOG_MAX,
+                             src + 1, header, &used);
+    if (EFI_ERROR(status)) {
+      return status;
+    }
+    status = fse_build(t, norm, max_symbol, log);
+    if (EFI_ERROR(status)) {
+      return status;
+    }
+    status = bits_init(&b, src + 1 + used, header - used);
+    if (EFI_ERROR(status)) {
+      return status;
+    }
+
+    UINT32 s1 = bits_read(&b, log);
+    UINT32 s2 = bits_read(&b, log);
+    for (;;) {
+      if (nw > 253) {
+        return EFI_COMPROMISED_DATA;
+      }
+      weights[nw++] = t[s1].symbol;
+      s1 = t[s1].new_state + bits_read(&b, t[s1].nb_bits);
+      if (b.pos < 0) {
+        weights[nw++] = t[s2].symbol;
+        break;
+      }
+      weights[nw++] = t[s2].symbol;
+      s2 = t[s2].new_state + bits_read(&b, t[s2].nb_bits);
+      if (b.pos < 0) {
+        weights[nw++] = t[s1].symbol;
+        break;
+      }
+    }
+    *consumed = 1 + header;
+  }
+
+  // the last weight is implied by completing the sum to a power of two
+  UINT32 total = 0;
+  for (UINT32 i = 0; i < nw; i++) {
+    if (weights[i] > HUF_TABLELOG_MAX) {
+      return EFI_COMPROMISED_DATA;
+    }
+    if (weights[i]) {
+      total += 1 << (weights[i] - 1);
+    }
+  }
+  if (total == 0 || nw > 255) {
+    return EFI_COMPROMISED_DATA;
+  }
+  UINT32 max_bits = highbit(total) + 1;
+  UINT32 rest = (1 << max_bits) - total;
+  if (max_bits > HUF_TABLELOG_MAX || (rest & (rest - 1))) {
+    return EFI_COMPROMISED_DATA;
+  }
+  weights[nw++] = highbit(rest) + 1;
+
+  // lowest weights take the lowest (longest) codes
+  UINT32 rank_count[HUF_TABLELOG_MAX + 1] = {0};
+  UINT32 rank_start[HUF_TABLELOG_MAX + 1];
+  for (UINT32 i = 0; i < nw; i++) {
+    rank_count[weights[i]]++;
+  }
+  UINT32 next = 0;
+  for (UINT32 w = 1; w <= max_bits; w++) {
+    rank_start[w] = next;
+    next += rank_count[w] << (w - 1);
+  }
+  for (UINT32 s = 0; s < nw; s++) {
+    UINT32 w = weights[s];
+    if (w == 0) {
+      continue;
+    }
+    UINT32 len = 1 << (w - 1);
+    struct huf_entry e = {.symbol = s, .nb_bits = max_bits + 1 - w};
+    for (UINT32 i = 0; i < len; i++) {
+      d->huf[rank_start[w] + i] = e;
+    }
+    rank_start[w] += len;
+  }
+  d->huf_log = max_bits;
+  return EFI_SUCCESS;
+}
+
+static EFI_STATUS huf_decode_stream(struct zstd_dctx *d, UINT8 *out, UINTN n,
+                                    const UINT8 *src, UINTN size) {
+  struct bits b;
+  UINT32 log = d->huf_log;
+  EFI_STATUS status = bits_init(&b, src, size);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  for (UINTN i = 0; i < n; i++) {
+    UINT32 v = load_bits(b.buf, b.size, b.pos - log, log);
+    out[i] = d->huf[v].symbol;
+    b.pos -= d->huf[v].nb_bits;
+  }
+  return b.pos == 0 ? EFI_SUCCESS : EFI_COMPROMISED_DATA;
+}
+
+static EFI_STATUS decode_literals(struct zstd_dctx *d, const UINT8 *src,
+                                  UINTN size, const UINT8 **lit,
+                                  UINTN *lit_size, UINTN *consumed) {
+  EFI_STATUS status;
+
+  if (size == 0) {
+    return EFI_COMPROMISED_DATA;
+  }
+  UINT32 type = src[0] & 3;
+  UINT32 size_format = (src[0] >> 2) & 3;
+
+  if (type == LIT_RAW || type == LIT_RLE) {
+    UINTN hdr, regen;
+    switch (size_format) {
+    case 1:
+      hdr = 2;
+      break;
+    case 3:
+      hdr = 3;
+      break;
+    default:
+      hdr = 1;
+      break;
+    }
+    if (hdr > size) {
+      return EFI_COMPROMISED_DATA;
+    }
+    if (hdr == 1) {
+      regen = src[0] >> 3;
+    } else if (hdr == 2) {
+      regen = (src[0] >> 4) + (src[1] << 4);
+    } else {
+      regen = (src[0] >> 4) + (src[1] << 4) + (src[2] << 12);
+    }
+    if (regen > BLOCK_SIZE_MAX) {
+      return EFI_COMPROMISED_DATA;
+    }
+
+    if (type == LIT_RAW) {
+      if (hdr + regen > size) {
+        return EFI_COMPROMISED_DATA;
+      }
+      *lit = src + hdr; // used in place, no copy
+      *consumed = hdr + regen;
+    } else {
+      if (hdr + 1 > size) {
+        return EFI_COMPROMISED_DATA;
+      }
+      memset2(d->literals, src[hdr], regen);
+      *lit = d->literals;
+      *consumed = hdr + 1;
+    }
+    *lit_size = regen;
+    return EFI_SUCCESS;
+  }
+
+  UINTN hdr = size_format < 2 ? 3 : size_format + 2;
+  UINTN streams = size_format == 0 ? 1 : 4;
+  UINTN regen, comp;
+  if (hdr > size) {
+    return EFI_COMPROMISED_DATA;
+  }
+  if (hdr == 3) {
+    UINT32 v = get_le24(src);
+    regen = (v >> 4) & 0x3ff;
+    comp = (v >> 14) & 0x3ff;
+  } else if (hdr == 4) {
+    UINT32 v = get_le32(src);
+    regen = (v >> 4) & 0x3fff;
+    comp = v >> 18;
+  } else {
+    UINT64 v = get_le32(src) | ((UINT64)src[4] << 32);
+    regen = (v >> 4) & 0x3ffff;
+    comp = (v >> 22) & 0x3ffff;
+  }
+  if (hdr + comp > size || regen > BLOCK_SIZE_MAX) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  const UINT8 *p = src + hdr;
+  UINTN rem = comp;
+  if (type == LIT_COMPRESSED) {
+    UINTN used;
+    status = huf_read_table(d, p, rem, &used);
+    if (EFI_ERROR(status)) {
+      return status;
+    }
+    p += used;
+    rem -= used;
+  } else if (d->huf_log == 0) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  if (streams == 1) {
+    status = huf_decode_stream(d, d->literals, regen, p, rem);
+  } else {
+    if (rem < 6) {
+      return EFI_COMPROMISED_DATA;
+    }
+    UINTN sizes[4] = {get_le16(p), get_le16(p + 2), get_le16(p + 4), 0};
+    UINTN seg = (regen + 3) / 4;
+    p += 6;
+    rem -= 6;
+    if (sizes[0] + sizes[1] + sizes[2] > rem || 3 * seg > regen) {
+      return EFI_COMPROMISED_DATA;
+    }
+    sizes[3] = rem - sizes[0] - sizes[1] - sizes[2];
+
+    status = EFI_SUCCESS;
+    for (UINTN i = 0; i < 4 && !EFI_ERROR(status); i++) {
+      UINTN n = i < 3 ? seg : regen - 3 * seg;
+      status = huf_decode_stream(d, d->literals + i * seg, n, p, sizes[i]);
+      p += sizes[i];
+    }
+  }
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+
+  *lit = d->literals;
+  *lit_size = regen;
+  *consumed = hdr + comp;
+  return EFI_SUCCESS;
+}
+
+static EFI_STATUS build_seq_table(struct fse_table *t, UINT32 mode,
+                                  const INT16 *default_norm,
+                                  UINT32 default_log, UINT32 max_symbol,
+                                  UINT32 max_log, const UINT8 **pp,
+                                  const UINT8 *end) {
+  EFI_STATUS status;
+  const UINT8 *p = *pp;
+
+  switch (mode) {
+  case SEQ_PREDEFINED:
+    status = fse_build(t->e, default_norm, max_symbol, default_log);
+    t->log = default_log;
+    break;
+  case SEQ_RLE:
+    if (p >= end || *p > max_symbol) {
+      return EFI_COMPROMISED_DATA;
+    }
+    t->e[0].symbol = *p++;
+    t->e[0].nb_bits = 0;
+    t->e[0].new_state = 0;
+    t->log = 0;
+    status = EFI_SUCCESS;
+    break;
+  case SEQ_FSE: {
+    INT16 norm[ML_MAX_SYMBOL + 1];
+    UINTN used;
+    status =
+        fse_read_ncount(norm, &max_symbol, &t->log, max_log, p, end - p, &used);
+    if (EFI_ERROR(status)) {
+      return status;
+    }
+    p += used;
+    status = fse_build(t->e, norm, max_symbol, t->log);
+    break;
+  }
+  default: // SEQ_REPEAT
+    return t->valid ? EFI_SUCCESS : EFI_COMPROMISED_DATA;
+  }
+
+  t->valid = !EFI_ERROR(status);
+  *pp = p;
+  return status;
+}
+
+// Match copies overlap whenever offset < length, in that case the bytes
+// must be replicated in order. Longer distances copy whole words.
+static inline void copy_match(UINT8 *d, const UINT8 *m, UINTN len) {
+  if ((UINTN)(d - m) >= 8) {
+    for (; len >= 8; len -= 8, d += 8, m += 8) {
+      __builtin_memcpy(d, m, 8);
+    }
+  }
+  while (len--) {
+    *d++ = *m++;
+  }
+}
+
+static EFI_STATUS decode_block(struct zstd_dctx *d, const UINT8 *src,
+                               UINTN size, UINT8 *frame_start, UINT8 **opp,
+                               UINT8 *oend) {
+  const UINT8 *end = src + size;
+  const UINT8 *lit;
+  UINTN lit_size, used;
+  UINT8 *op = *opp;
+  EFI_STATUS status;
+
+  status = decode_literals(d, src, size, &lit, &lit_size, &used);
+  if (EFI_ERROR(status)) {
+    return status;
+  }
+  const UINT8 *p = src + used;
+  const UINT8 *lit_end = lit + lit_size;
+
+  if (p >= end) {
+    return EFI_COMPROMISED_DATA;
+  }
+  UINTN nseq = p[0];
+  if (nseq < 128) {
+    p += 1;
+  } else if (nseq < 255) {
+    if (end - p < 2) {
+      return EFI_COMPROMISED_DATA;
+    }
+    nseq = ((nseq - 128) << 8) + p[1];
+    p += 2;
+  } else {
+    if (end - p < 3) {
+      return EFI_COMPROMISED_DATA;
+    }
+    nseq = p[1] + (p[2] << 8) + 0x7f00;
+    p += 3;
+  }
+
+  if (nseq > 0) {
+    if (p >= end) {
+      return EFI_COMPROMISED_DATA;
+    }
+    UINT32 modes = *p++;
+    status = build_seq_table(&d->ll, modes >> 6, ll_default_norm, 6,
+                             LL_MAX_SYMBOL, LL_MAX_LOG, &p, end);
+    if (!EFI_ERROR(status)) {
+      status = build_seq_table(&d->of, (modes >> 4) & 3, of_default_norm, 5,
+                               OF_MAX_SYMBOL - 3, OF_MAX_LOG, &p, end);
+    }
+    if (!EFI_ERROR(status)) {
+      status = build_seq_table(&d->ml, (modes >> 2) & 3, ml_default_norm, 6,
+                               ML_MAX_SYMBOL, ML_MAX_LOG, &p, end);
+    }
+    if (EFI_ERROR(status)) {
+      return status;
+    }
+
+    struct bits b;
+    status = bits_init(&b, p, end - p);
+    if (EFI_ERROR(status)) {
+      return status;
+    }
+    UINT32 ll_state = bits_read(&b, d->ll.log);
+    UINT32 of_state = bits_read(&b, d->of.log);
+    UINT32 ml_state = bits_read(&b, d->ml.log);
+
+    for (UINTN i = 0; i < nseq; i++) {
+      struct fse_entry ll_e = d->ll.e[ll_state];
+      struct fse_entry of_e = d->of.e[of_state];
+      struct fse_entry ml_e = d->ml.e[ml_state];
+      if (ll_e.symbol > LL_MAX_SYMBOL || of_e.symbol > OF_MAX_SYMBOL ||
+          ml_e.symbol > ML_MAX_SYMBOL) {
+        return EFI_COMPROMISED_DATA;
+      }
+
+      UINT64 of_value = (1ULL << of_e.symbol) + bits_read(&b, of_e.symbol);
+      UINTN ml = ml_base[ml_e.symbol] + bits_read(&b, ml_bits[ml_e.symbol]);
+      UINTN ll = ll_base[ll_e.symbol] + bits_read(&b, ll_bits[ll_e.symbol]);
+
+      UINT64 offset;
+      if (of_value > 3) {
+        offset = of_value - 3;
+        d->rep[2] = d->rep[1];
+        d->rep[1] = d->rep[0];
+        d->rep[0] = offset;
+      } else {
+        UINT32 idx = of_value - 1 + (ll == 0);
+        if (idx == 0) {
+          offset = d->rep[0];
+        } else {
+          offset = idx == 3 ? d->rep[0] - 1 : d->rep[idx];
+          if (idx != 1) {
+            d->rep[2] = d->rep[1];
+          }
+          d->rep[1] = d->rep[0];
+          d->rep[0] = offset;
+        }
+      }
+
+      if (i + 1 < nseq) {
+        ll_state = ll_e.new_state + bits_read(&b, ll_e.nb_bits);
+        ml_state = ml_e.new_state + bits_read(&b, ml_e.nb_bits);
+        of_state = of_e.new_state + bits_read(&b, of_e.nb_bits);
+      }
+
+      if (ll > (UINTN)(lit_end - lit) || ll + ml > (UINTN)(oend - op)) {
+        return EFI_COMPROMISED_DATA;
+      }
+      memcpy2(op, lit, ll);
+      op += ll;
+      lit += ll;
+
+      if (offset == 0 || offset > (UINTN)(op - frame_start)) {
+        return EFI_COMPROMISED_DATA;
+      }
+      copy_match(op, op - offset, ml);
+      op += ml;
+    }
+    if (b.pos != 0) {
+      return EFI_COMPROMISED_DATA;
+    }
+  }
+
+  // trailing literals after the last sequence
+  UINTN tail = lit_end - lit;
+  if (tail > (UINTN)(oend - op)) {
+    return EFI_COMPROMISED_DATA;
+  }
+  memcpy2(op, lit, tail);
+  *opp = op + tail;
+  return EFI_SUCCESS;
+}
+
+struct zstd_dctx *zstd_alloc_dctx(void) {
+  return AllocatePool(sizeof(struct zstd_dctx));
+}
+
+void zstd_free_dctx(struct zstd_dctx *dctx) { FreePool(dctx); }
+
+EFI_STATUS zstd_decompress_frame(struct zstd_dctx *d, void *dest,
+                                 UINTN dest_size, const void *src,
+                                 UINTN src_size, UINTN *out_size) {
+  const UINT8 *ip = (const UINT8 *)src;
+  const UINT8 *iend = ip + src_size;
+  UINT8 *op = (UINT8 *)dest;
+  UINT8 *oend = op + dest_size;
+  EFI_STATUS status;
+
+  if (src_size < 5 || get_le32(ip) != ZSTD_FRAME_MAGIC) {
+    return EFI_UNSUPPORTED;
+  }
+  UINT8 fhd = ip[4];
+  ip += 5;
+
+  UINT32 fcs_flag = fhd >> 6;
+  BOOLEAN single_segment = (fhd >> 5) & 1;
+  BOOLEAN has_checksum = (fhd >> 2) & 1;
+  UINT32 dict_id_size = (const UINT8[]){0, 1, 2, 4}[fhd & 3];
+  UINT32 fcs_size = fcs_flag == 0 ? single_segment : 1 << fcs_flag;
+  if (fhd & (1 << 3)) {
+    return EFI_COMPROMISED_DATA;
+  }
+
+  UINTN hdr = !single_segment + dict_id_size + fcs_size;
+  if (hdr > (UINTN)(iend - ip)) {
+    return EFI_COMPROMISED_DATA;
+  }
+  ip += !single_segment; // no window to size, output is flat
+  UINT32 dict_id = 0;
+  for (UINT32 i = 0; i < dict_id_size; i++) {
+    dict_id |= (UINT32)ip[i] << (8 * i);
+  }
+  ip += dict_id_size;
+  if (dict_id != 0) {
+    return EFI_UNSUPPORTED;
+  }
+  UINT64 content_size = 0;
+  for (UINT32 i = 0; i < fcs_size; i++) {
+    content_size |= (UINT64)ip[i] << (8 * i);
+  }
+  if (fcs_size == 2) {
+    content_size += 256;
+  }
+  ip += fcs_size;
+  if (fcs_size && content_size > dest_size) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+
+  d->ll.valid = d->of.valid = d->ml.valid = FALSE;
+  d->huf_log = 0;
+  d->rep[0] = 1;
+  d->rep[1] = 4;
+  d->rep[2] = 8;
+
+  for (;;) {
+    if (iend - ip < 3) {
+      return EFI_COMPROMISED_DATA;
+    }
+    UINT32 bh = get_le24(ip);
+    ip += 3;
+    BOOLEAN last = bh & 1;
+    UINT32 type = (bh >> 1) & 3;
+    UINTN bsize = bh >> 3;
+
+    switch (type) {
+    case BLOCK_RAW:
+      if (bsize > (UINTN)(iend - ip) || bsize > (UINTN)(oend - op)) {
+        return EFI_COMPROMISED_DATA;
+      }
+      memcpy2(op, ip, bsize);
+      ip += bsize;
+      op += bsize;
+      break;
+    case BLOCK_RLE:
+      if (ip >= iend || bsize > (UINTN)(oend - op)) {
+        return EFI_COMPROMISED_DATA;
+      }
+      memset2(op, *ip++, bsize);
+      op += bsize;
+      break;
+    case BLOCK_COMPRESSED:
+      if (bsize > BLOCK_SIZE_MAX || bsize > (UINTN)(iend - ip)) {
+        return EFI_COMPROMISED_DATA;
+      }
+      status = decode_block(d, ip, bsize, (UINT8 *)dest, &op, oend);
+      if (EFI_ERROR(status)) {
+        return status;
+      }
+      ip += bsize;
+      break;
+    default:
+      return EFI_COMPROMISED_DATA;
+    }
+
+    if (last) {
+      break;
+    }
+  }
+
+  // XXH64 content checksum is skipped, the payload is verified as a whole
+  if (has_checksum) {
+    ip += 4;
+  }
+
+  *out_size = op - (UINT8 *)dest;
+  if (fcs_size && *out_size != content_size) {
+    return EFI_COMPROMISED_DATA;
+  }
+  return EFI_SUCCESS;
+}
+
+UINTN zstd_payload_content_size(const void *src, UINTN src_size) {
+  const struct zstd_payload_header *hdr = src;
+
+  if (src_size < sizeof(*hdr) || hdr->magic != ZSTD_PAYLOAD_MAGIC ||
+      hdr->nr_frames > (src_size - sizeof(*hdr)) / sizeof(hdr->frames[0])) {
+    return 0;
+  }
+  return hdr->content_size;
+}
+
+struct zstd_job {
+  const UINT8 *src;
+  UINTN src_size;
+  UINT8 *dest;
+  UINTN dest_size;
+  UINTN first, end;        // frames [first, end)
+  struct zstd_dctx **dctx; // one per worker
+  EFI_STATUS status;       // any failing worker stores its error
+};
+
+// frames are dealt out round-robin, they all decode to the same size except
+// for the last one of the payload
+static void zstd_worker(void *ctx, UINTN index, UINTN count) {
+  struct zstd_job *job = (struct zstd_job *)ctx;
+  const struct zstd_payload_header *hdr =
+      (const struct zstd_payload_header *)job->src;
+
+  for (UINTN i = job->first + index; i < job->end; i += count) {
+    const struct zstd_payload_frame *f = &hdr->frames[i];
+    UINTN out;
+
+    if (f->src_offset > job->src_size ||
+        f->src_size > job->src_size - f->src_offset ||
+        f->dst_offset > job->dest_size ||
+        f->dst_size > job->dest_size - f->dst_offset) {
+      job->status = EFI_COMPROMISED_DATA;
+      return;
+    }
+    EFI_STATUS status = zstd_decompress_frame(
+        job->dctx[index], job->dest + f->dst_offset, f->dst_size,
+        job->src + f->src_offset, f->src_size, &out);
+    if (!EFI_ERROR(status) && out != f->dst_size) {
+      status = EFI_COMPROMISED_DATA;
+    }
+    if (EFI_ERROR(status)) {
+      job->status = status;
+      return;
+    }
+  }
+}
+
+EFI_STATUS zstd_payload_decompress_frames(void *dest, UINTN dest_size,
+                                          const void *src, UINTN src_size,
+                                          UINTN first, UINTN count) {
+  const struct zstd_payload_header *hdr = src;
+  UINTN content_size = zstd_payload_content_size(src, src_size);
+  if (content_size == 0) {
+    return EFI_UNSUPPORTED;
+  }
+  if (content_size > dest_size) {
+    return EFI_BUFFER_TOO_SMALL;
+  }
+  if (first > hdr->nr_frames || count > hdr->nr_frames - first) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  struct zstd_job job = {
+      .src = (const UINT8 *)src,
+      .src_size = src_size,
+      .dest = (UINT8 *)dest,
+      .dest_size = content_size,
+      .first = first,
+      .end = first + count,
+      .status = EFI_SUCCESS,
+  };
+
+  // APs can't allocate, so every worker context is set up front
+  UINTN workers = mp_worker_count();
+  job.dctx = AllocateZeroPool(workers * sizeof(job.dctx[0]));
+  if (job.dctx == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  for (UINTN i = 0; i < workers; i++) {
+    job.dctx[i] = zstd_alloc_dctx();
+    if (job.dctx[i] == NULL) {
+      job.status = EFI_OUT_OF_RESOURCES;
+      break;
+    }
+  }
+
+  if (!EFI_ERROR(job.status)) {
+    mp_run(zstd_worker, &job);
+  }
+
+  for (UINTN i = 0; i < workers && job.dctx[i] != NULL; i++) {
+    zstd_free_dctx(job.dctx[i]);
+  }
+  FreePool(job.dctx);
+  return job.status;
+}
+
+EFI_STATUS zstd_payload_decompress(void *dest, UINTN dest_size,
+                                   const void *src, UINTN src_size) {
+  const struct zstd_payload_header *hdr = src;
+  if (zstd_payload_content_size(src, src_size) == 0) {
+    return EFI_UNSUPPORTED;
+  }
+  return zstd_payload_decompress_frames(dest, dest_size, src, src_size, 0,
+                                        hdr->nr_frames);
+}
@@ -0,0 +1,299 @@
+#!/usr/bin/env python3
+# Turn the serial output of a CONFIG_CONSOLE_TOKENIZED loader back into text.
+#
+# Print() format strings live in the .log_fmt section of the EFI file.
+# make_image dumps it to hvisor.logfmt, the ELF the EFI file was made from
+# (main/built-in.o) works as well. On the wire a record is
+#
+#   0x1e  varint id  fields...
+#
+# with id the offset of the format string in .log_fmt in UTF-16 units and
+# one field per argument the format takes, see console_log() in
+# main/console.c. Everything outside of records is passed through as is.
+#
+#   detokenize.py hvisor.logfmt [serial.log]
+
+import argparse
+import struct
+import sys
+
+RECORD = 0x1E
+
+ELF_HEADER = struct.Struct("<16sHHIQQQIHHHHHH")
+ELF_SHDR = struct.Struct("<IIQQQQIIQQ")
+
+EFI_ERROR = 1 << 63
+# gnu-efi lib/error.c
+EFI_STATUS = {
+    0: "Success",
+    EFI_ERROR | 1: "Load Error",
+    EFI_ERROR | 2: "Invalid Parameter",
+    EFI_ERROR | 3: "Unsupported",
+    EFI_ERROR | 4: "Bad Buffer Size",
+    EFI_ERROR | 5: "Buffer Too Small",
+    EFI_ERROR | 6: "Not Ready",
+    EFI_ERROR | 7: "Device Error",
+    EFI_ERROR | 8: "Write Protected",
+    EFI_ERROR | 9: "Out of Resources",
+    EFI_ERROR | 10: "Volume Corrupt",
+    EFI_ERROR | 11: "Volume Full",
+    EFI_ERROR | 12: "No Media",
+    EFI_ERROR | 13: "Media changed",
+    EFI_ERROR | 14: "Not Found",
+    EFI_ERROR | 15: "Access Denied",
+    EFI_ERROR | 16: "No Response",
+    EFI_ERROR | 17: "No mapping",
+    EFI_ERROR | 18: "Time out",
+    EFI_ERROR | 19: "Not started",
+    EFI_ERROR | 20: "Already started",
+    EFI_ERROR | 21: "Aborted",
+    EFI_ERROR | 22: "ICMP Error",
+    EFI_ERROR | 23: "TFTP Error",
+    EFI_ERROR | 24: "Protocol Error",
+    EFI_ERROR | 25: "Incompatible Version",
+    EFI_ERROR | 26: "Security Policy Violation",
+    EFI_ERROR | 27: "CRC Error",
+    EFI_ERROR | 28: "End of Media",
+    EFI_ERROR | 31: "End of File",
+    EFI_ERROR | 32: "Invalid Languages",
+    EFI_ERROR | 33: "Compromised Data",
+    1: "Warning Unknown Glyph",
+    2: "Warning Delete Failure",
+    3: "Warning Write Failure",
+    4: "Warning Buffer Too Small",
+}
+
+
+class Truncated(Exception):
+    pass
+
+
+def fail(msg):
+    sys.exit(f"detokenize: {msg}")
+
+
+def load_table(data):
+    if data[:4] != b"\x7fELF":
+        return data
+    hdr = ELF_HEADER.unpack_from(data)
+    shoff, shentsize, shnum, shstrndx = hdr[6], hdr[11], hdr[12], hdr[13]
+    shdrs = [ELF_SHDR.unpack_from(data, shoff + i * shentsize)
+             for i in range(shnum)]
+    names = shdrs[shstrndx][4]
+    for sh in shdrs:
+        name = data[names + sh[0]:data.index(b"\0", names + sh[0])]
+        if name == b".log_fmt":
+            return data[sh[4]:sh[4] + sh[5]]
+    fail("no .log_fmt section in the ELF, not a tokenized build?")
+
+
+class Reader:
+    def __init__(self, data, pos):
+        self.data = data
+        self.pos = pos
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise Truncated()
+        self.pos += 1
+        return self.data[self.pos - 1]
+
+    def bytes(self, n):
+        if self.pos + n > len(self.data):
+            raise Truncated()
+        self.pos += n
+        return self.data[self.pos - n:self.pos]
+
+    def varint(self):
+        v, shift = 0, 0
+        while True:
+            b = self.byte()
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    def signed(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+    def string(self):
+        end = self.data.find(b"\0", self.pos)
+        if end < 0:
+            raise Truncated()
+        s = self.data[self.pos:end].decode("latin-1")
+        self.pos = end + 1
+        return s
+
+
+def value_to_string(v, comma):
+    s = str(abs(v))
+    if comma:
+        s = f"{abs(v):,}"
+    return "-" + s if v < 0 else s
+
+
+def as_int64(v):
+    return v - (1 << 64) if v >= 1 << 63 else v
+
+
+def time_to_string(raw):
+    year, month, day, hour, minute = struct.unpack_from("<HBBBB", raw)
+    ampm = "a"
+    if hour == 0:
+        hour = 12
+    elif hour >= 12:
+        ampm = "p"
+        if hour >= 13:
+            hour -= 12
+    return (f"{month:02d}/{day:02d}/{year % 100:02d}  "
+            f"{hour:02d}:{minute:02d}{ampm}")
+
+
+def guid_to_string(raw):
+    d1, d2, d3 = struct.unpack_from("<IHH", raw)
+    d4 = "".join(f"{b:02X}" for b in raw[8:10])
+    d5 = "".join(f"{b:02X}" for b in raw[10:16])
+    return f"{d1:08X}-{d2:04X}-{d3:04X}-{d4}-{d5}"
+
+
+# gnu-efi PITEM(): the pad character fills up to the width in front of the
+# item even for '-', which only moves the spaces up to the field width
+def pitem(item, width, field, pad, before):
+    if field is not None:
+        item = item[:field]
+    else:
+        field = len(item)
+    width = max(width, len(item))
+    spaces = " " * max(field - width, 0)
+    out = pad * (width - len(item)) + item
+    return spaces + out if before else out + spaces
+
+
+# Walk fmt the way gnu-efi _Print() does, taking the fields from the record.
+def render(fmt, r):
+    out = []
+    i = 0
+    while i < len(fmt):
+        c = fmt[i]
+        i += 1
+        if c != "%":
+            out.append(c)
+            continue
+        width, field, pad, before = 0, None, " ", True
+        comma = long = in_field = False
+        while i < len(fmt):
+            c = fmt[i]
+            i += 1
+            item = None
+            if c == "%":
+                item = "%"
+            elif c == "0":
+                pad = "0"
+            elif c == "-":
+                before = False
+            elif c == ",":
+                comma = True
+            elif c == ".":
+                in_field = True
+            elif c == "*" or c in "123456789":
+                if c == "*":
+                    v = r.varint()
+                else:
+                    j = i
+                    while i < len(fmt) and fmt[i].isdigit():
+                        i += 1
+                    v = int(fmt[j - 1:i])
+                if in_field:
+                    field = v
+                else:
+                    width = v
+            elif c == "l":
+                long = True
+            elif c in "asD":
+                item = r.string()
+            elif c == "c":
+                item = chr(r.varint() & 0xFFFF)
+            elif c in "xX":
+                if c == "X":
+                    width, pad = (16 if long else 8), "0"
+                item = f"{r.varint():X}"
+            elif c == "u":
+                item = value_to_string(as_int64(r.varint()), comma)
+            elif c == "d":
+                item = value_to_string(r.signed(), comma)
+            elif c == "g":
+                item = guid_to_string(r.bytes(16))
+            elif c == "t":
+                item = time_to_string(r.bytes(16))
+            elif c == "f":
+                (v,) = struct.unpack("<d", r.bytes(8))
+                item = f"{v:f}"
+            elif c == "r":
+                v = r.varint()
+                item = EFI_STATUS.get(v, f"{v:X}")
+            elif c in "nhe":
+                continue
+            elif c in "NHE":
+                break
+            else:
+                item = "?"
+            if item is not None:
+                out.append(pitem(item, width, field, pad, before))
+                break
+    return "".join(out)
+
+
+def format_at(table, fid):
+    start = fid * 2
+    if start >= len(table):
+        return None
+    end = start
+    while end + 1 < len(table) and table[end:end + 2] != b"\0\0":
+        end += 2
+    return table[start:end].decode("utf-16-le")
+
+
+def detokenize(table, data, out):
+    pos = 0
+    while pos < len(data):
+        rs = data.find(bytes([RECORD]), pos)
+        if rs < 0:
+            rs = len(data)
+        out.write(data[pos:rs].decode("latin-1"))
+        if rs == len(data):
+            break
+        r = Reader(data, rs + 1)
+        try:
+            fid = r.varint()
+            fmt = format_at(table, fid)
+            if fmt is None:
+                out.write(f"<unknown token {fid}>\n")
+                pos = r.pos
+                continue
+            out.write(render(fmt, r))
+        except Truncated:
+            out.write("<truncated record>\n")
+            break
+        pos = r.pos
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("table", help="hvisor.logfmt or main/built-in.o")
+    parser.add_argument("log", nargs="?", help="captured serial output, "
+                        "stdin if omitted")
+    args = parser.parse_args()
+
+    with open(args.table, "rb") as f:
+        table = load_table(f.read())
+    if args.log:
+        with open(args.log, "rb") as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+    detokenize(table, data, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+# Build the payload container embedded by main/data.S, see include/container.h.
+#
+#   mkcontainer.py -o payload/container.bin --codec zstd \
+#       -e kind=hvisor,path=hvisor.bin,load=0x80200000 \
+#       -e kind=zone0-dtb,path=zone0.dtb \
+#       --zones zones.json --zone-kernel 'target/nonroot-{name}/vmlinux-{name}.bin'
+#
+# Entry keys: kind, path, load (0 or absent: consumed in place), codec,
+# align, zone, name, format (auto, raw, elf, pe or linux, see
+# mkloadplan.py), reloc (1: the loader may move the entry to free memory
+# near load when the firmware holds that range, not for hvisor).
+# In-place entries are always stored uncompressed and never flattened. The
+# load plans of all entries are checked against each other for overlaps.
+# Linux EFI zboot kernels are stored as they are and decoded by the loader.
+
+import argparse
+import gzip
+import hashlib
+import json
+import os
+import struct
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mkloadplan  # noqa: E402
+import mkzstdpayload  # noqa: E402
+
+MAGIC = 0x4B505648
+VERSION = 2
+BLOB_ALIGN = 4096
+FLAG_RELOCATABLE = 1
+HEADER = struct.Struct("<IHHIIQ")
+ENTRY = struct.Struct("<IIIIQQQQQ32s32sQQ")
+# mz magic, image type, payload offset, payload size, reserved, compression
+ZBOOT_HEADER = struct.Struct("<4s4sII8x32s")
+
+KINDS = {
+    "hvisor": 1,
+    "zone0-kernel": 2,
+    "zone0-initrd": 3,
+    "zone0-dtb": 4,
+    "zone-kernel": 5,
+}
+CODECS = {"none": 0, "lz4": 1, "zstd": 2, "zboot": 3}
+
+
+def parse_entry(spec):
+    entry = dict(kv.split("=", 1) for kv in spec.split(","))
+    for key in ("kind", "path"):
+        if key not in entry:
+            sys.exit(f"mkcontainer: entry '{spec}' has no {key}")
+    if entry["kind"] not in KINDS:
+        sys.exit(f"mkcontainer: unknown kind '{entry['kind']}'")
+    return entry
+
+
+def unzboot(data):
+    # the Image inside a zboot kernel, None for anything else
+    if len(data) < ZBOOT_HEADER.size:
+        return None
+    mz, kind, offset, size, comp = ZBOOT_HEADER.unpack_from(data)
+    if mz[:2] != b"MZ" or kind != b"zimg":
+        return None
+    comp = comp.split(b"\0")[0].decode()
+    payload = data[offset:offset + size]
+    if comp == "gzip":
+        return gzip.decompress(payload)
+    if comp in ("zstd", "zstd22"):
+        return subprocess.run(["zstd", "-d", "-q", "-c"], input=payload,
+                              stdout=subprocess.PIPE, check=True).stdout
+    sys.exit(f"mkcontainer: zboot {comp} kernels can't be decoded by the "
+             "loader, build with gzip or zstd")
+
+
+def encode(data, codec, frame_size):
+    if codec == "lz4":
+        cmd = ["lz4", "-9", "-BD", "-B7", "--content-size", "-q", "-c"]
+        return subprocess.run(cmd, input=data, stdout=subprocess.PIPE,
+                              check=True).stdout
+    if codec == "zstd":
+        return mkzstdpayload.pack(data, frame_size)
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("-e", "--entry", action="append", default=[],
+                        type=parse_entry)
+    parser.add_argument("--codec", choices=("none", "lz4", "zstd"),
+                        default="none",
+                        help="codec for entries that don't name one")
+    parser.add_argument("--zstd-frame-size", type=lambda x: int(x, 0),
+                        default=0x100000)
+    parser.add_argument("--zones", help="zones.json with nonroot zones")
+    parser.add_argument("--zone-kernel",
+                        help="kernel path pattern, {name} is the zone name")
+    args = parser.parse_args()
+
+    entries = args.entry
+    if args.zones:
+        if not args.zone_kernel:
+            sys.exit("mkcontainer: --zones needs --zone-kernel")
+        with open(args.zones) as f:
+            zones = json.load(f)["nonroot"]
+        for zone_id, zone in enumerate(zones, 1):
+            entries.append({
+                "kind": "zone-kernel",
+                "path": args.zone_kernel.format(name=zone["name"]),
+                "load": zone["load_addr"],
+                "zone": str(zone_id),
+                "name": zone["name"],
+            })
+
+    toc_end = HEADER.size + ENTRY.size * len(entries)
+    offset = -(-toc_end // BLOB_ALIGN) * BLOB_ALIGN
+    toc = b""
+    blobs = b""
+    ranges = []
+    for e in entries:
+        with open(e["path"], "rb") as f:
+            data = f.read()
+        load = int(e.get("load", "0"), 0)
+        zero_size = entry_point = 0
+        image = unzboot(data) if load else None
+        if image is not None:
+            zboot, data = data, image
+        if load:
+            plan = mkloadplan.flatten(data, load, e.get("format", "auto"))
+            if image is not None and plan.fmt not in ("raw", "linux"):
+                sys.exit(f"mkcontainer: {e['path']}: zboot kernels are "
+                         "loaded as they are")
+            data = plan.blob
+            zero_size, entry_point = plan.zero_size, plan.entry
+            if plan.fmt != "raw":
+                print(f"mkcontainer: {e['path']}: {plan.fmt}, zero "
+                      f"{zero_size:#x}, entry {entry_point:#x}")
+            ranges.append((load, load + len(data) + zero_size, e["path"]))
+        align = int(e.get("align", "0"), 0)
+        codec = e.get("codec", args.codec) if load else "none"
+        if image is not None:
+            # already compressed, the loader decodes it like the EFI stub
+            codec = "zboot"
+        if codec not in CODECS or (codec == "zboot") != (image is not None):
+            sys.exit(f"mkcontainer: {e['path']}: bad codec '{codec}'")
+        if align & (align - 1) or (align and load % align):
+            sys.exit(f"mkcontainer: {e['path']}: bad alignment {align:#x}")
+        flags = FLAG_RELOCATABLE if int(e.get("reloc", "0"), 0) else 0
+        if flags and (not load or e["kind"] == "hvisor"):
+            sys.exit(f"mkcontainer: {e['path']}: can't be relocated")
+        name = e.get("name", e["kind"]).encode()[:31]
+
+        if codec == "zboot":
+            stored = zboot
+        else:
+            stored = encode(data, codec, args.zstd_frame_size)
+        blob_offset = offset + len(blobs)
+        toc += ENTRY.pack(KINDS[e["kind"]], CODECS[codec],
+                          int(e.get("zone", "0"), 0), flags, blob_offset,
+                          len(stored), len(data), load, align,
+                          hashlib.sha256(data).digest(), name, zero_size,
+                          entry_point)
+        blobs += stored + b"\0" * (-len(stored) % BLOB_ALIGN)
+        print(f"mkcontainer: {e['kind']:<12} {name.decode():<16} "
+              f"{codec:<4} {len(data):#10x} -> {len(stored):#10x} "
+              f"@ {blob_offset:#x}, load {load:#x}")
+
+    ranges.sort()
+    for (_, end, path), (start, _, other) in zip(ranges, ranges[1:]):
+        if start < end:
+            sys.exit(f"mkcontainer: {path} and {other} overlap")
+
+    image_size = offset + len(blobs)
+    header = HEADER.pack(MAGIC, VERSION, ENTRY.size, HEADER.size,
+                         len(entries), image_size)
+    with open(args.output, "wb") as f:
+        f.write(header + toc)
+        f.write(b"\0" * (offset - toc_end))
+        f.write(blobs)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+# Flatten an ELF64, PE32+ or Linux Image into the load plan of a container
+# entry, see include/container.h, so the boot loader never parses the headers:
+#
+#   copy  the flattened image to load_addr (the entry's blob)
+#   zero  zero_size bytes right behind it (bss)
+#   entry the address execution starts at
+#
+# ELF segments go to their physical addresses, PE sections keep their
+# distance to the image base. Gaps in between are zero-filled in the blob.
+# PE images are relocated to the load address here when it isn't their
+# ImageBase. Linux Images (arm64, RISC-V and LoongArch boot headers) stay as
+# they are, their header gives the size of the bss and the placement is
+# checked. ELF and Linux Images are detected by their magic, PE has to be
+# asked for since Linux Images carry an MZ header as well. Anything else is
+# passed through as a raw image loaded at load_addr.
+#
+#   mkloadplan.py [-l load_addr] [-f auto|raw|elf|pe|linux] image
+
+import argparse
+import struct
+import sys
+
+ELF_HEADER = struct.Struct("<16sHHIQQQIHHHHHH")
+ELF_PHDR = struct.Struct("<IIQQQQQQ")
+PT_LOAD = 1
+
+DOS_LFANEW = 0x3C
+PE_FILE_HEADER = struct.Struct("<4sHHIIIHH")
+PE_OPT_MAGIC_PE32PLUS = 0x20B
+PE_SECTION = struct.Struct("<8sIIIIIIHHI")
+PE_DIR_BASERELOC = 5
+IMAGE_REL_BASED_ABSOLUTE = 0
+IMAGE_REL_BASED_DIR64 = 10
+
+# Documentation/arch/{arm64/booting,riscv/boot-image-header}.rst and
+# arch/loongarch/kernel/head.S, the magic sits at 0x38 in all three
+LINUX_MAGIC_OFFSET = 0x38
+LINUX_ARM64_MAGIC = 0x644D5241  # "ARM\x64"
+LINUX_RISCV_MAGIC = 0x05435352  # "RSC\x05"
+LINUX_LOONGARCH_MAGIC = 0x818223CD  # LINUX_PE_MAGIC
+LINUX_HEADER = struct.Struct("<IIQQQ")
+LINUX_ALIGN = 0x200000
+
+
+class Plan:
+    def __init__(self, fmt, load, blob, zero_size, entry):
+        self.fmt = fmt
+        self.load = load
+        self.blob = blob
+        self.zero_size = zero_size
+        self.entry = entry
+
+    def check(self):
+        end = self.load + len(self.blob) + self.zero_size
+        if self.entry and not self.load <= self.entry < end:
+            sys.exit(f"mkloadplan: entry {self.entry:#x} outside the image "
+                     f"{self.load:#x}-{end:#x}")
+
+
+def fail(msg):
+    sys.exit(f"mkloadplan: {msg}")
+
+
+def flatten_elf(data, load):
+    (ident, _, _, _, e_entry, phoff, _, _, _, phentsize, phnum, _, _,
+     _) = ELF_HEADER.unpack_from(data)
+    if ident[4] != 2 or ident[5] != 1:
+        fail("only little endian ELF64 is supported")
+    segs = []
+    for i in range(phnum):
+        p = ELF_PHDR.unpack_from(data, phoff + i * phentsize)
+        p_type, _, offset, vaddr, paddr, filesz, memsz, _ = p
+        if p_type == PT_LOAD and memsz:
+            segs.append((paddr, vaddr, offset, filesz, memsz))
+    if not segs:
+        fail("no PT_LOAD segment")
+    segs.sort()
+
+    # ELF images can't be moved, the load address only confirms the link
+    low = segs[0][0]
+    base = load or low
+    if base != low:
+        fail(f"linked at {low:#x}, not at the load address {base:#x}")
+    blob = bytearray()
+    mem_end = 0
+    entry = 0
+    for paddr, vaddr, offset, filesz, memsz in segs:
+        at = paddr - low
+        if at < mem_end:
+            fail(f"segment at {paddr:#x} overlaps the one before")
+        blob[len(blob):at] = bytes(max(0, at - len(blob)))
+        blob[at:at + filesz] = data[offset:offset + filesz]
+        mem_end = at + memsz
+        if vaddr <= e_entry < vaddr + memsz:
+            entry = base + at + e_entry - vaddr
+    if not entry:
+        fail(f"entry {e_entry:#x} is in no segment")
+    return Plan("elf", base, bytes(blob), mem_end - len(blob), entry)
+
+
+def linux_magic(data):
+    if len(data) < LINUX_MAGIC_OFFSET + 4:
+        return None
+    (magic,) = struct.unpack_from("<I", data, LINUX_MAGIC_OFFSET)
+    if magic in (LINUX_ARM64_MAGIC, LINUX_RISCV_MAGIC):
+        return magic
+    if magic == LINUX_LOONGARCH_MAGIC and data[:2] == b"MZ":
+        return magic
+    return None
+
+
+def flatten_linux(data, load):
+    magic = linux_magic(data)
+    if magic is None:
+        fail("no arm64, RISC-V or LoongArch Linux boot header")
+    _, _, a, b, c = LINUX_HEADER.unpack_from(data)
+    entry = load
+    if magic == LINUX_LOONGARCH_MAGIC:
+        # kernel entry, effective size, physical link address
+        entry_phys, image_size, link = a, b, c
+        # DMW windows map physical memory at the top 16 bits
+        if link and load & (1 << 48) - 1 != link:
+            print(f"mkloadplan: warning: kernel linked at {link:#x}, loaded "
+                  f"at {load:#x}, it has to be relocatable", file=sys.stderr)
+        if link <= entry_phys < link + image_size:
+            entry = load + entry_phys - link
+    else:
+        text_offset, image_size = a, b
+        # the 2 MB aligned base the kernel is placed text_offset bytes into,
+        # RISC-V only uses text_offset for the offset from the start of RAM
+        base = load - text_offset if magic == LINUX_ARM64_MAGIC else load
+        if base % LINUX_ALIGN:
+            fail(f"kernel at {load:#x} isn't text_offset {text_offset:#x} "
+                 f"into a 2 MB aligned base")
+    # old kernels leave image_size at 0, then the bss is unknown
+    return Plan("linux", load, data, max(0, image_size - len(data)), entry)
+
+
+def relocate_pe(image, delta, reloc_rva, reloc_size):
+    pos = reloc_rva
+    while pos < reloc_rva + reloc_size:
+        page, block_size = struct.unpack_from("<II", image, pos)
+        if block_size < 8:
+            fail("bad base relocation block")
+        for i in range(8, block_size, 2):
+            (word,) = struct.unpack_from("<H", image, pos + i)
+            kind, offset = word >> 12, word & 0xFFF
+            if kind == IMAGE_REL_BASED_ABSOLUTE:
+                continue
+            if kind != IMAGE_REL_BASED_DIR64:
+                fail(f"unsupported base relocation type {kind}")
+            (value,) = struct.unpack_from("<Q", image, page + offset)
+            struct.pack_into("<Q", image, page + offset,
+                             (value + delta) & (1 << 64) - 1)
+        pos += block_size
+
+
+def flatten_pe(data, load):
+    (pe_offset,) = struct.unpack_from("<I", data, DOS_LFANEW)
+    (sig, _, nr_sections, _, _, _, opt_size,
+     _) = PE_FILE_HEADER.unpack_from(data, pe_offset)
+    if sig != b"PE\0\0":
+        fail("bad PE signature")
+    opt = pe_offset + PE_FILE_HEADER.size
+    (magic,) = struct.unpack_from("<H", data, opt)
+    if magic != PE_OPT_MAGIC_PE32PLUS:
+        fail("only PE32+ is supported")
+    (entry_rva,) = struct.unpack_from("<I", data, opt + 16)
+    (image_base, section_align) = struct.unpack_from("<QI", data, opt + 24)
+    (image_size, headers_size) = struct.unpack_from("<II", data, opt + 56)
+    (nr_dirs,) = struct.unpack_from("<I", data, opt + 108)
+    reloc_rva = reloc_size = 0
+    if nr_dirs > PE_DIR_BASERELOC:
+        reloc_rva, reloc_size = struct.unpack_from(
+            "<II", data, opt + 112 + 8 * PE_DIR_BASERELOC)
+
+    base = load or image_base
+    if base % section_align:
+        fail(f"load address {base:#x} not {section_align:#x} aligned")
+    image = bytearray(image_size)
+    image[:headers_size] = data[:headers_size]
+    file_end = headers_size
+    for i in range(nr_sections):
+        s = PE_SECTION.unpack_from(data, opt + opt_size + i * PE_SECTION.size)
+        _, vsize, rva, raw_size, raw_ptr = s[:5]
+        raw_size = min(raw_size, vsize or raw_size)
+        if rva + max(vsize, raw_size) > image_size:
+            fail(f"section {i} outside SizeOfImage")
+        image[rva:rva + raw_size] = data[raw_ptr:raw_ptr + raw_size]
+        file_end = max(file_end, rva + raw_size)
+
+    if base != image_base:
+        if not reloc_size:
+            fail(f"no base relocations to move {image_base:#x} to {base:#x}")
+        relocate_pe(image, base - image_base, reloc_rva, reloc_size)
+    return Plan("pe", base, bytes(image[:file_end]), image_size - file_end,
+                base + entry_rva)
+
+
+def flatten(data, load, fmt="auto"):
+    if fmt == "auto":
+        # Linux Image files start with MZ too, PE must be asked for
+        if data[:4] == b"\x7fELF":
+            fmt = "elf"
+        elif linux_magic(data) is not None and load:
+            fmt = "linux"
+        else:
+            fmt = "raw"
+    if fmt == "elf":
+        plan = flatten_elf(data, load)
+    elif fmt == "pe":
+        plan = flatten_pe(data, load)
+    elif fmt == "linux":
+        plan = flatten_linux(data, load)
+    else:
+        plan = Plan("raw", load, data, 0, 0)
+    plan.check()
+    return plan
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-l", "--load", type=lambda x: int(x, 0), default=0)
+    parser.add_argument("-f", "--format", default="auto",
+                        choices=("auto", "raw", "elf", "pe", "linux"))
+    parser.add_argument("image")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        plan = flatten(f.read(), args.load, args.format)
+    print(f"{plan.fmt}")
+    print(f"  copy  {plan.load:#x} - {plan.load + len(plan.blob):#x}")
+    if plan.zero_size:
+        end = plan.load + len(plan.blob)
+        print(f"  zero  {end:#x} - {end + plan.zero_size:#x}")
+    if plan.entry:
+        print(f"  entry {plan.entry:#x}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+# Write the payload container to the raw payload partition of a GPT disk,
+# where the loader reads it with PAYLOAD_BLOCK_PARTITION, see
+# include/blksrc.h. Works on block devices and on disk images.
+#
+#   mkpayloadpart.py /dev/nvme0n1 payload/container.bin
+#   mkpayloadpart.py disk.img payload/container.bin
+#
+# The partition is found by its type GUID. If there is none yet, the
+# sgdisk command that creates one is printed.
+
+import argparse
+import os
+import struct
+import sys
+import uuid
+
+PARTITION_TYPE = uuid.UUID("6d851684-bbb0-4c41-9372-17530b2d0107")
+CONTAINER_MAGIC = 0x4B505648
+GPT_SIGNATURE = b"EFI PART"
+# signature, revision, header size, crc, reserved, my lba, alternate lba,
+# first usable, last usable, disk guid, entries lba, nr entries, entry size
+GPT_HEADER = struct.Struct("<8sIIIIQQQQ16sQII")
+GPT_ENTRY = struct.Struct("<16s16sQQQ72s")
+
+
+def read_gpt(disk):
+    # the header sits in lba 1, try the usual block sizes
+    for block_size in (512, 4096):
+        disk.seek(block_size)
+        raw = disk.read(GPT_HEADER.size)
+        if len(raw) == GPT_HEADER.size and raw.startswith(GPT_SIGNATURE):
+            return block_size, GPT_HEADER.unpack(raw)
+    sys.exit("mkpayloadpart: no GPT found")
+
+
+def find_partition(disk):
+    block_size, hdr = read_gpt(disk)
+    entries_lba, nr_entries, entry_size = hdr[10:13]
+    disk.seek(entries_lba * block_size)
+    table = disk.read(nr_entries * entry_size)
+    for i in range(nr_entries):
+        entry = table[i * entry_size:i * entry_size + GPT_ENTRY.size]
+        ptype, _, first, last, _, _ = GPT_ENTRY.unpack(entry)
+        if uuid.UUID(bytes_le=ptype) == PARTITION_TYPE:
+            return i + 1, block_size, first, last
+    return None, block_size, 0, 0
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("disk", help="block device or disk image")
+    parser.add_argument("container", help="payload/container.bin")
+    args = parser.parse_args()
+
+    with open(args.container, "rb") as f:
+        data = f.read()
+    if len(data) < 4 or struct.unpack_from("<I", data)[0] != CONTAINER_MAGIC:
+        sys.exit(f"mkpayloadpart: {args.container} is not a payload container")
+
+    with open(args.disk, "r+b") as disk:
+        number, block_size, first, last = find_partition(disk)
+        if number is None:
+            mib = (len(data) + (1 << 20) - 1) >> 20
+            sys.exit("mkpayloadpart: no payload partition, create one with\n"
+                     f"  sgdisk -n 0:0:+{mib}M -t 0:{PARTITION_TYPE} "
+                     f"-c 0:hvisor-payload {args.disk}")
+        size = (last + 1 - first) * block_size
+        if len(data) > size:
+            sys.exit(f"mkpayloadpart: container is {len(data)} bytes, "
+                     f"partition {number} only {size}")
+        disk.seek(first * block_size)
+        disk.write(data)
+        disk.flush()
+        os.fsync(disk.fileno())
+    print(f"mkpayloadpart: wrote {len(data)} bytes to partition {number} "
+          f"of {args.disk} at lba {first:#x}")
+
+
+if __name__ == "__main__":
+    main()
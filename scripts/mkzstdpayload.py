@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Build a multi-frame zstd payload for main/zstd.c.
+#
+# The input is cut into frame_size pieces, each compressed as an independent
+# zstd frame so the boot loader can decode them in parallel. Layout (little
+# endian), see include/zstd.h:
+#
+#   u32 magic "HVZS", u32 nr_frames, u64 content_size, u64 frame_size
+#   nr_frames * { u64 src_offset, u64 src_size, u64 dst_offset, u64 dst_size }
+#   frame data, each frame 8-byte aligned
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+from concurrent.futures import ThreadPoolExecutor
+
+MAGIC = 0x535A5648
+HEADER = struct.Struct("<IIQQ")
+FRAME = struct.Struct("<QQQQ")
+
+
+def compress(chunk, level):
+    cmd = ["zstd", "-q", "-c", "--no-check", f"--stream-size={len(chunk)}"]
+    cmd += ["--ultra", f"-{level}"] if level > 19 else [f"-{level}"]
+    return subprocess.run(cmd, input=chunk, stdout=subprocess.PIPE,
+                          check=True).stdout
+
+
+def pack(data, frame_size=0x100000, level=19):
+    chunks = [data[i:i + frame_size] for i in range(0, len(data), frame_size)]
+
+    with ThreadPoolExecutor(os.cpu_count()) as pool:
+        frames = list(pool.map(lambda c: compress(c, level), chunks))
+
+    offset = HEADER.size + FRAME.size * len(frames)
+    table = b""
+    body = b""
+    for i, frame in enumerate(frames):
+        pad = -(offset + len(body)) % 8
+        body += b"\0" * pad
+        table += FRAME.pack(offset + len(body), len(frame), i * frame_size,
+                            len(chunks[i]))
+        body += frame
+
+    return HEADER.pack(MAGIC, len(frames), len(data), frame_size) + table + body
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("input")
+    parser.add_argument("output")
+    parser.add_argument("-s", "--frame-size", type=lambda x: int(x, 0),
+                        default=0x100000)
+    parser.add_argument("-l", "--level", type=int, default=19)
+    args = parser.parse_args()
+
+    if args.frame_size <= 0:
+        sys.exit("mkzstdpayload: frame size must be positive")
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    payload = pack(data, args.frame_size, args.level)
+    with open(args.output, "wb") as f:
+        f.write(payload)
+
+    print(f"mkzstdpayload: {args.input}: {len(data)} -> {len(payload)} bytes, "
+          f"{struct.unpack_from('<I', payload, 4)[0]} frames")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2025 Syswonder
+ * SPDX-License-Identifier: MulanPSL-2.0
+ */
+
+// Host test for main/pgtable.c, run by scripts/pgtable_test.sh: builds the
+// tables of every architecture from a sample region table and walks them,
+// checking which addresses are mapped, to where and with which attributes.
+// Also builds a region table with main/memregion.c from a memory map where
+// the handoff data sits in claimed payload pages, which zone0 must not see.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arch.h"
+#include "container.h"
+#include "core.h"
+#include "memregion.h"
+#include "pgtable.h"
+
+#define PAGE_SIZE 0x1000ULL
+#define ADDR_MASK 0x0000fffffffff000ULL
+
+static void sync_range(void *addr, UINTN size) {}
+static struct arch_ops ops = {.memory = {.sync_range = sync_range}};
+struct arch_ops *arch_ops = &ops;
+
+static UINT8 *pool_mem;
+
+static EFI_STATUS EFIAPI allocate_pages(EFI_ALLOCATE_TYPE type,
+                                        EFI_MEMORY_TYPE mem, UINTN pages,
+                                        EFI_PHYSICAL_ADDRESS *addr) {
+  *addr = (EFI_PHYSICAL_ADDRESS)pool_mem;
+  return EFI_SUCCESS;
+}
+static EFI_BOOT_SERVICES bs = {.AllocatePages = allocate_pages};
+EFI_BOOT_SERVICES *BS = &bs;
+
+UINTN Print(const CHAR16 *fmt, ...) { return 0; }
+char *get_efi_status_string(EFI_STATUS status) { return ""; }
+void memzero(void *dest, UINTN n) { memset(dest, 0, n); }
+
+enum { NONE, NORMAL, DEVICE };
+
+// MMIO below RAM, hvisor and its handoff data, the zone0 kernel with an
+// unrecorded tail, a claimed range nothing was recorded for, reserved memory
+static const struct boot_info_region regions[] = {
+    {0x09000000, 0x1000, BOOT_INFO_REGION_MMIO},
+    {0x40000000, 0x200000, BOOT_INFO_REGION_USABLE},
+    {0x40200000, 0x400000, BOOT_INFO_REGION_PAYLOAD},
+    {0x40600000, 0x3000, BOOT_INFO_REGION_HANDOFF},
+    {0x40603000, 0x1fd000, BOOT_INFO_REGION_USABLE},
+    {0x40800000, 0x1000000, BOOT_INFO_REGION_PAYLOAD},
+    {0x41800000, 0x10000, BOOT_INFO_REGION_PAYLOAD},
+    {0x41810000, 0x3e7f0000, BOOT_INFO_REGION_USABLE},
+    {0x80000000, 0x40000000, BOOT_INFO_REGION_USABLE},
+    {0xc0000000, 0x1000, BOOT_INFO_REGION_RESERVED},
+};
+#define NR_REGIONS (sizeof(regions) / sizeof(regions[0]))
+
+static const struct {
+  UINT64 addr;
+  int stage1, stage2;
+} probes[] = {
+    {0x0, DEVICE, DEVICE},
+    {0x08fff000, DEVICE, DEVICE},
+    {0x09000010, DEVICE, DEVICE},
+    {0x3ffff000, DEVICE, DEVICE},
+    {0x40000000, NORMAL, NORMAL},
+    {0x401ff008, NORMAL, NORMAL},
+    {0x40200000, NORMAL, NONE},
+    {0x405ff000, NORMAL, NONE},
+    {0x40600000, NORMAL, NONE},
+    {0x40602ff8, NORMAL, NONE},
+    {0x40603000, NORMAL, NORMAL},
+    {0x40800000, NORMAL, NORMAL},
+    {0x41780000, NORMAL, NORMAL},
+    {0x41800000, NORMAL, NORMAL},
+    {0x4180f000, NORMAL, NORMAL},
+    {0x41810000, NORMAL, NORMAL},
+    {0x7ffff000, NORMAL, NORMAL},
+    {0x80000000, NORMAL, NORMAL},
+    {0xbffff000, NORMAL, NORMAL},
+    {0xc0000000, NONE, NONE},
+    {0xc0001000, NONE, NONE},
+};
+
+static int failures;
+
+static void fail(const char *arch, int stage, UINT64 addr, const char *what) {
+  printf("FAIL %s stage-%d 0x%llx: %s\n", arch, stage,
+         (unsigned long long)addr, what);
+  failures++;
+}
+
+static int is_table(UINT32 format, UINT64 e, UINT32 level, UINT32 levels) {
+  switch (format) {
+  case BOOT_INFO_PGTABLE_AARCH64_4K:
+    return level < levels - 1 && (e & 3) == 3;
+  case BOOT_INFO_PGTABLE_LOONGARCH_4K:
+    return level < levels - 1 && !(e & (1ULL << 6));
+  default:
+    return (e & 0xe) == 0;
+  }
+}
+
+static UINT64 entry_addr(UINT32 format, UINT64 e) {
+  if (format == BOOT_INFO_PGTABLE_RISCV_SV39 ||
+      format == BOOT_INFO_PGTABLE_RISCV_SV48) {
+    return (e >> 10) << 12;
+  }
+  return e & ADDR_MASK;
+}
+
+// the leaf translating addr and the size it maps, 0 if there is none
+static UINT32 walk(const struct boot_info_page_tables *pt, int stage2,
+                   UINT64 root, UINT64 addr, UINT64 *leaf) {
+  int x4 = stage2 && (pt->format == BOOT_INFO_PGTABLE_RISCV_SV39 ||
+                      pt->format == BOOT_INFO_PGTABLE_RISCV_SV48);
+  const UINT64 *table = (const UINT64 *)root;
+
+  for (UINT32 l = 0; l < pt->levels; l++) {
+    UINT32 shift = 12 + 9 * (pt->levels - 1 - l);
+    UINT64 entries = 512 * (l == 0 && x4 ? 4 : 1);
+    UINT64 e = table[(addr >> shift) & (entries - 1)];
+    if (e == 0) {
+      return 0;
+    }
+    if (!is_table(pt->format, e, l, pt->levels)) {
+      *leaf = e;
+      return shift;
+    }
+    table = (const UINT64 *)entry_addr(pt->format, e);
+  }
+  return 0;
+}
+
+// what the attribute bits of a leaf say, NONE if they make no sense
+static int leaf_kind(UINT32 format, int stage2, UINT64 e, UINT32 shift) {
+  switch (format) {
+  case BOOT_INFO_PGTABLE_AARCH64_4K: {
+    UINT64 xn = e & (1ULL << 54);
+    if ((e & 3) != (shift == 12 ? 3 : 1) || !(e & (1ULL << 10)) ||
+        (e & (3ULL << 8)) != (3ULL << 8)) {
+      return NONE;
+    }
+    if (stage2) {
+      UINT64 memattr = (e >> 2) & 0xf;
+      if ((e & (3ULL << 6)) != (3ULL << 6)) {
+        return NONE;
+      }
+      return memattr == 0xf && !xn ? NORMAL : memattr == 1 && xn ? DEVICE
+                                                                 : NONE;
+    }
+    UINT64 idx = (e >> 2) & 7;
+    return idx == 0 && !xn ? NORMAL : idx == 1 && xn ? DEVICE : NONE;
+  }
+  case BOOT_INFO_PGTABLE_LOONGARCH_4K: {
+    UINT64 mat = (e >> 4) & 3;
+    if ((e & 0x183) != 0x183 || !!(e & (1ULL << 6)) != (shift != 12)) {
+      return NONE;
+    }
+    return mat == 1 ? NORMAL : mat == 0 ? DEVICE : NONE;
+  }
+  default:
+    if ((e & 0xc7) != 0xc7 || !!(e & 0x10) != stage2) {
+      return NONE;
+    }
+    return e & 8 ? NORMAL : DEVICE;
+  }
+}
+
+static void check_stage(const char *arch,
+                        const struct boot_info_page_tables *pt, int stage2,
+                        UINT64 root, UINTN root_pages) {
+  int stage = stage2 ? 2 : 1;
+
+  if (root % (root_pages * PAGE_SIZE) != 0) {
+    fail(arch, stage, root, "root not aligned to its size");
+  }
+  for (UINTN i = 0; i < sizeof(probes) / sizeof(probes[0]); i++) {
+    UINT64 addr = probes[i].addr, leaf;
+    int want = stage2 ? probes[i].stage2 : probes[i].stage1;
+    UINT32 shift = walk(pt, stage2, root, addr, &leaf);
+
+    if (shift == 0) {
+      if (want != NONE) {
+        fail(arch, stage, addr, "not mapped");
+      }
+      continue;
+    }
+    if (want == NONE) {
+      fail(arch, stage, addr, "mapped");
+      continue;
+    }
+    UINT64 size = 1ULL << shift;
+    if (entry_addr(pt->format, leaf) + (addr & (size - 1)) != addr) {
+      fail(arch, stage, addr, "not an identity map");
+    }
+    if (leaf_kind(pt->format, stage2, leaf, shift) != want) {
+      fail(arch, stage, addr, want == NORMAL ? "not normal memory"
+                                             : "not device memory");
+    }
+  }
+}
+
+static void test_arch(const char *arch, arch_type_t type, UINT32 format,
+                      UINTN stage2_root_pages) {
+  // loongarch records payloads by their DMW address
+  UINT64 dmw = type == ARCH_LOONGARCH64 ? 0x9000000000000000ULL : 0;
+  struct boot_info_payload payloads[] = {
+      {.kind = CONTAINER_KIND_HVISOR, .addr = dmw | 0x40200000,
+       .size = 0x3ff800},
+      {.kind = CONTAINER_KIND_ZONE0_KERNEL, .addr = dmw | 0x40800000,
+       .size = 0xf00000, .zero_size = 0x80000},
+  };
+  struct boot_info_page_tables pt;
+
+  ops.type = type;
+  if (pgtable_prepare() == 0) {
+    fail(arch, 0, 0, "no pool");
+    return;
+  }
+  EFI_STATUS status = pgtable_build(regions, NR_REGIONS, payloads, 2, &pt);
+  if (EFI_ERROR(status)) {
+    fail(arch, 0, 0, "pgtable_build failed");
+    return;
+  }
+  if (pt.format != format) {
+    fail(arch, 0, 0, "wrong format");
+    return;
+  }
+  if (type == ARCH_LOONGARCH64) {
+    if (pt.stage1_root != 0) {
+      fail(arch, 1, pt.stage1_root, "unexpected stage-1 table");
+    }
+  } else {
+    check_stage(arch, &pt, 0, pt.stage1_root, 1);
+  }
+  check_stage(arch, &pt, 1, pt.stage2_root, stage2_root_pages);
+}
+
+// reserve_payload() claims the boot-info block as EFI_HVISOR_PAYLOAD, the
+// region table still has to report it as handoff memory
+static void test_handoff(void) {
+  static const EFI_MEMORY_DESCRIPTOR map[] = {
+      {EfiConventionalMemory, 0, 0x40000000, 0, 0x200, 0},
+      {EFI_HVISOR_PAYLOAD, 0, 0x40200000, 0, 0x400, 0},
+      {EFI_HVISOR_PAYLOAD, 0, 0x40600000, 0, 0x3, 0},
+      {EfiConventionalMemory, 0, 0x40603000, 0, 0x3f9fd, 0},
+  };
+  static const struct boot_info_region carve[] = {
+      {0x40200000, 0x400000, BOOT_INFO_REGION_PAYLOAD},
+      {0x40600000, 0x3000, BOOT_INFO_REGION_HANDOFF},
+  };
+  struct boot_info_payload payloads[] = {
+      {.kind = CONTAINER_KIND_HVISOR, .addr = 0x40200000, .size = 0x400000},
+  };
+  struct boot_info_region out[32];
+  struct boot_info_page_tables pt;
+  UINTN nr = mem_regions_build(out, 32, map, sizeof(map), sizeof(map[0]),
+                               carve, 2);
+  BOOLEAN found = FALSE;
+
+  for (UINTN i = 0; i < nr; i++) {
+    if (out[i].base <= 0x40600000 && out[i].base + out[i].size > 0x40600000) {
+      found = out[i].type == BOOT_INFO_REGION_HANDOFF &&
+              out[i].base == 0x40600000 && out[i].size == 0x3000;
+    }
+  }
+  if (!found) {
+    fail("regions", 0, 0x40600000, "boot-info block isn't handoff memory");
+  }
+
+  ops.type = ARCH_AARCH64;
+  if (pgtable_prepare() == 0 ||
+      EFI_ERROR(pgtable_build(out, nr, payloads, 1, &pt))) {
+    fail("regions", 0, 0, "pgtable_build failed");
+    return;
+  }
+  UINT64 leaf;
+  if (walk(&pt, 1, pt.stage2_root, 0x40600000, &leaf) != 0) {
+    fail("regions", 2, 0x40600000, "handoff data mapped");
+  }
+  if (walk(&pt, 1, pt.stage2_root, 0x40603000, &leaf) == 0) {
+    fail("regions", 2, 0x40603000, "not mapped");
+  }
+  if (walk(&pt, 0, pt.stage1_root, 0x40600000, &leaf) == 0) {
+    fail("regions", 1, 0x40600000, "not mapped");
+  }
+}
+
+int main(void) {
+  // a pool 4 KB past a 16 KB boundary, so a misplaced x4 root shows up
+  UINT8 *mem = aligned_alloc(0x4000, CONFIG_PAGE_TABLES_SIZE + 0x4000);
+  pool_mem = mem + PAGE_SIZE;
+
+  test_arch("aarch64", ARCH_AARCH64, BOOT_INFO_PGTABLE_AARCH64_4K, 1);
+#if defined(CONFIG_PAGE_TABLES_RISCV_SV48)
+  test_arch("riscv64", ARCH_RISCV64, BOOT_INFO_PGTABLE_RISCV_SV48, 4);
+#else
+  test_arch("riscv64", ARCH_RISCV64, BOOT_INFO_PGTABLE_RISCV_SV39, 4);
+#endif
+  test_arch("loongarch64", ARCH_LOONGARCH64, BOOT_INFO_PGTABLE_LOONGARCH_4K,
+            1);
+  test_handoff();
+  free(mem);
+  return failures != 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Build scripts/pgtable_test.c against main/pgtable.c and main/memregion.c
+# for the host and run it, once per riscv format.
+#
+#   scripts/pgtable_test.sh [cc]
+
+cd "$(dirname "$0")/.." || exit 1
+CC=${1:-cc}
+OUT=$(mktemp -d) || exit 1
+trap 'rm -rf "$OUT"' EXIT
+
+HOST=$(uname -m)
+CFLAGS="-std=gnu11 -Wall -Wno-unused-parameter -Wno-unused-const-variable \
+  -fshort-wchar -Iinclude -Ilib/gnu-efi/inc -Ilib/gnu-efi/inc/$HOST \
+  -Ilib/gnu-efi/inc/protocol -DCONFIG_PAGE_TABLES=1 \
+  -DCONFIG_PAGE_TABLES_SIZE=0x200000"
+# boot services are called directly, gnu-efi wraps them on x86_64 otherwise
+if [ "$HOST" = x86_64 ]; then
+  CFLAGS="$CFLAGS -DHAVE_USE_MS_ABI"
+fi
+
+for riscv in SV39 SV48; do
+  if [ $riscv = SV48 ]; then
+    flags="-DCONFIG_PAGE_TABLES_RISCV_SV48=1"
+  else
+    flags=""
+  fi
+  $CC $CFLAGS $flags scripts/pgtable_test.c main/pgtable.c main/memregion.c \
+    -o "$OUT/pgtable_test" || exit 1
+  "$OUT/pgtable_test" || { echo "pgtable_test: $riscv failed"; exit 1; }
+  echo "pgtable_test: aarch64, riscv64 $riscv and loongarch64 passed"
+done
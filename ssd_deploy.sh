@@ -166,6 +166,24 @@ fi
 echo "Copying HVISOR_UEFI.EFI to partition 3..."
 cp -v "$DEPLOY_DIR/HVISOR_UEFI.EFI" "$PARTITION3_MOUNTPOINT/"
 
+# Payload files read by the loader from its own directory, if any
+if [ -d "$DEPLOY_DIR/ESP_PAYLOAD" ]; then
+    echo "Copying ESP payload files to partition 3..."
+    cp -v "$DEPLOY_DIR/ESP_PAYLOAD"/* "$PARTITION3_MOUNTPOINT/"
+fi
+
+# Payload container read by the loader from its raw GPT partition, if any
+if [ -f "$DEPLOY_DIR/PAYLOAD_CONTAINER.bin" ]; then
+    PAYLOAD_PARTITION_TYPE="6d851684-bbb0-4c41-9372-17530b2d0107"
+    PAYLOAD_PARTITION=$(lsblk -lnpo NAME,PARTTYPE /dev/nvme0n1 | awk -v t="$PAYLOAD_PARTITION_TYPE" '$2 == t { print $1; exit }')
+    if [ -z "$PAYLOAD_PARTITION" ]; then
+        echo "Error: no payload partition of type $PAYLOAD_PARTITION_TYPE on /dev/nvme0n1"
+        exit 1
+    fi
+    echo "Writing payload container to $PAYLOAD_PARTITION..."
+    dd if="$DEPLOY_DIR/PAYLOAD_CONTAINER.bin" of="$PAYLOAD_PARTITION" bs=1M conv=fsync
+fi
+
 # Copy DEPLOY_OVERLAY to partition 4
 echo "Copying DEPLOY_OVERLAY to partition 4..."
 cp -rv "$DEPLOY_DIR/DEPLOY_OVERLAY"/* "$PARTITION4_MOUNTPOINT/"
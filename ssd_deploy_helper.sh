@@ -74,6 +74,17 @@ fi
 # copy hvisor UEFI image
 cp $HVISOR_UEFI_IMAGE deploy/HVISOR_UEFI.EFI
 
+# copy the payload files the loader reads next to itself (PAYLOAD_SOURCE_ESP)
+if grep -q "^CONFIG_PAYLOAD_SOURCE_ESP=y" .config; then
+    mkdir -p deploy/ESP_PAYLOAD
+    find esp -maxdepth 1 -type f ! -name "*.EFI" -exec cp {} deploy/ESP_PAYLOAD/ \;
+fi
+
+# copy the container the loader reads from the raw payload partition
+if grep -q "^CONFIG_PAYLOAD_BLOCK_PARTITION=y" .config; then
+    cp payload/container.bin deploy/PAYLOAD_CONTAINER.bin
+fi
+
 # copy root linux kernel modules
 cp -r $HVISOR_LINUX_SRC/target/root/kernel_modules deploy/root_linux_kernel_modules_6_11_6
 